@@ -10,7 +10,7 @@ emcc -O2 \
 ../3rdparty/ImGuiColorTextEdit/TextEditor.cpp \
 -I ../3rdparty/imgui \
 -std=c++14 -s TOTAL_MEMORY=268435456 \
-    -s USE_SDL_IMAGE=2 -s USE_SDL=2 -s USE_WEBGL2=1 -I ../3rdparty \
+    -s USE_SDL_IMAGE=2 -s USE_SDL=2 -s USE_WEBGL2=1 -s USE_ZLIB=1 -I ../3rdparty \
     -s FULL_ES3=1 -o index.html && \
     cp ../default_index.html index.html && \
     python3 -m http.server
@@ -49,104 +49,158 @@ struct _String2D {
   bool     world_space;
 };
 // static Temporary_Storage<>          ts             = Temporary_Storage<>::create(16 * (1 << 20));
-static Pool<Line2D>        line_storage   = Pool<Line2D>::create(1 << 17);
-static Pool<Rect2D>        quad_storage   = Pool<Rect2D>::create(1 << 17);
-static Pool<CubicBezier2D> bezier_storage = Pool<CubicBezier2D>::create(1 << 17);
-static Pool<_String2D>     string_storage = Pool<_String2D>::create(1 << 18);
-static Pool<char>          char_storage   = Pool<char>::create(1 * (1 << 20));
+// Filled and read every frame: committed up front in huge pages, the first frame doesn't fault
+static constexpr u32 RENDER_POOL_BACKING = POOL_BACKING_HUGE_PAGES | POOL_BACKING_PREFAULT;
+static Pool<Line2D>  line_storage        = Pool<Line2D>::create(1 << 17, RENDER_POOL_BACKING);
+static Pool<Rect2D>  quad_storage        = Pool<Rect2D>::create(1 << 17, RENDER_POOL_BACKING);
+static Pool<CubicBezier2D> bezier_storage =
+    Pool<CubicBezier2D>::create(1 << 17, RENDER_POOL_BACKING);
+static Pool<_String2D> string_storage = Pool<_String2D>::create(1 << 18, RENDER_POOL_BACKING);
+static Pool<char>      char_storage   = Pool<char>::create(1 * (1 << 20), RENDER_POOL_BACKING);
+// Primitives converted to GL instances per job
+static constexpr u32       RENDER_JOB_GRAIN = 1 << 12;
+
+// Orders GL instances by descending z. Depth is z and the test is GL_GEQUAL, so the nearest
+// layers are drawn first and fragments they hide fail the early depth test. Equal layers keep
+// their submission order
+template <typename T> static void sort_front_to_back(T *instances, u32 count) {
+  TMP_STORAGE_SCOPE;
+  u32 *keys          = (u32 *)tl_alloc_tmp(sizeof(u32) * count);
+  u32 *keys_tmp      = (u32 *)tl_alloc_tmp(sizeof(u32) * count);
+  T *  instances_tmp = (T *)tl_alloc_tmp(sizeof(T) * count);
+  parallel_for(0, count, RENDER_JOB_GRAIN, [&](u32 begin, u32 end) {
+    for (u32 i = begin; i < end; i++) keys[i] = ~radix_key_f32(instances[i].z);
+  });
+  radix_sort(keys, instances, count, keys_tmp, instances_tmp, RENDER_JOB_GRAIN);
+}
+
+// Forms evaluated by Evaluator::eval, dispatched through one perfect hash lookup
+static constexpr char const *Eval_Builtin_Names[] = {
+    "main",
+    "add_node",
+    "set_node_position",
+    "get_node_id",
+    "remove_node",
+    "set_node_size",
+    "add_input_slot",
+    "add_link",
+    "add_output_slot",
+    "itof",
+    "add",
+    "mul",
+    "add_source",
+    "for",
+    "scope",
+    "get_num_nodes",
+    "is_node_alive",
+    "print",
+    "let",
+    "move_camera",
+    "format",
+};
+static constexpr Perfect_Hash<ARRAY_SIZE(Eval_Builtin_Names)> Eval_Builtins{Eval_Builtin_Names};
 
 struct Source {
-  // Name and text are also zero terminated
-  string_ref name;
-  string_ref text;
-  u8 *       storage;
-  bool       is_alive() { return storage != NULL; }
-  void       init(string_ref name, string_ref text) {
-    ASSERT_DEBUG(name.len != 0);
-    storage = (u8 *)malloc(name.len + text.len + 2);
-    memcpy(storage, name.ptr, name.len);
-    storage[name.len] = '\0';
+  Atom        name;
+  // Text is also zero terminated
+  string_ref  text;
+  // Either a private copy or the mapped file the text was loaded from
+  u8 *        storage;
+  Mapped_File file;
+  bool        is_alive() { return storage != NULL || file.is_open(); }
+  void        init(Atom name, string_ref text) {
+    ASSERT_DEBUG(!name.is_null());
+    file    = {};
+    storage = (u8 *)malloc(text.len + 1);
     if (text.ptr != NULL && text.len != 0) {
-      memcpy(storage + name.len + 1, text.ptr, text.len);
+      memcpy(storage, text.ptr, text.len);
     }
-    storage[name.len + text.len + 1] = '\0';
-    this->name = string_ref{.ptr = (char const *)storage, .len = name.len};
-    this->text = string_ref{.ptr = (char const *)(storage + name.len + 1), .len = text.len};
+    storage[text.len] = '\0';
+    this->name        = name;
+    this->text        = string_ref{.ptr = (char const *)storage, .len = text.len};
+  }
+  // Takes ownership of `file`
+  void init_mapped(Atom name, Mapped_File file) {
+    ASSERT_DEBUG(!name.is_null());
+    ASSERT_DEBUG(file.is_open());
+    storage    = NULL;
+    this->file = file;
+    this->name = name;
+    this->text = file.get_view();
   }
   void release() {
     free(storage);
+    file.release();
     memset(this, 0, sizeof(*this));
   }
 };
 
 struct SourceDB {
-  Array<Source>               sources;
-  Array<char const *>         names_packed;
-  Hash_Table<string_ref, u32> name2id;
-  void                        init() {
+  ALLOC_SITE(SourceDB_sources);
+  ALLOC_SITE(SourceDB_names_packed);
+  Dense_Hash_Table<Atom, Source, Tracking_Allocator<SourceDB_sources>>  sources;
+  Array<char const *, 0x100, Tracking_Allocator<SourceDB_names_packed>> names_packed;
+  void                                                                  init() {
     sources.init();
-    name2id.init();
+    names_packed.init();
   }
   void release() {
+    sources.iter_values([](Source &src) { src.release(); });
     sources.release();
-    name2id.release();
+    names_packed.release();
   }
   void rebuild_index() {
-    names_packed.release();
-    ito(sources.size) {
-      if (sources[i].storage != NULL) {
-        names_packed.push(sources[i].name.ptr);
-      }
-    }
+    PERF_SCOPE("SourceDB::rebuild_index");
+    names_packed.reset();
+    sources.iter_values([&](Source &src) { names_packed.push(atom_str(src.name).ptr); });
   }
-  void remove_source(string_ref name) {
-    ASSERT_DEBUG(name2id.contains(name));
-    u32 id = name2id.get(name);
-    name2id.remove(name);
-    sources[id].release();
+  void remove_source(Atom name) {
+    Source *src = sources.get_or_null(name);
+    ASSERT_DEBUG(src != NULL);
+    src->release();
+    sources.remove(name);
   }
-  void add_source(string_ref name, string_ref text) {
-    if (name2id.contains(name)) {
-      remove_source(name);
-    }
-    ASSERT_DEBUG(!name2id.contains(name));
+  void add_source(Atom name, string_ref text) {
+    // `text` may point into the storage being replaced, copy it first
     Source src;
     src.init(name, text);
-    // linear search for a new slot
-    u32 new_slot = 0;
-    ito(sources.size) {
-      if (sources[i].storage == NULL) {
-        break;
-      }
-      new_slot++;
-    }
-    if (new_slot == sources.size)
-      sources.push(src);
-    else
-      sources[new_slot] = src;
-    name2id.insert(src.name, new_slot);
+    bool    found = false;
+    Source *dst   = sources.get_or_insert(name, &found);
+    if (found) dst->release();
+    *dst = src;
   }
-  void update_text(string_ref name, string_ref new_text) {
-    tl_alloc_tmp_enter();
-    defer(tl_alloc_tmp_exit());
-    name = stref_tmp_copy(name);
-    remove_source(name);
+  // The source owns `file` from here on, loading is zero-copy
+  void add_mapped_source(Atom name, Mapped_File file) {
+    Source src;
+    src.init_mapped(name, file);
+    bool    found = false;
+    Source *dst   = sources.get_or_insert(name, &found);
+    if (found) dst->release();
+    *dst = src;
+  }
+  void update_text(Atom name, string_ref new_text) {
+    ASSERT_DEBUG(sources.contains(name));
     add_source(name, new_text);
   }
-  string_ref get_text(string_ref name) {
-    ASSERT_DEBUG(name2id.contains(name));
-    u32 id = name2id.get(name);
-    return sources[id].text;
+  string_ref get_text(Atom name) {
+    Source *src = sources.get_or_null(name);
+    ASSERT_DEBUG(src != NULL);
+    return src->text;
   }
 };
 
 struct NodeDB {
+  ALLOC_SITE(NodeDB_name2id);
+  ALLOC_SITE(NodeDB_nodes);
+  ALLOC_SITE(NodeDB_wrappers);
+  ALLOC_SITE(NodeDB_slots);
+  ALLOC_SITE(NodeDB_links);
   struct Node_Wrapper {
-    u32                       node_id;
-    string_ref                node_name;
-    SmallArray<string_ref, 8> output_slots;
-    SmallArray<string_ref, 8> input_slots;
-    void                      init() {
+    u32                                                   node_id;
+    Atom                                                  node_name;
+    SmallArray<Atom, 8, Tracking_Allocator<NodeDB_slots>> output_slots;
+    SmallArray<Atom, 8, Tracking_Allocator<NodeDB_slots>> input_slots;
+    void                                                  init() {
       output_slots.init();
       input_slots.init();
     }
@@ -156,160 +210,136 @@ struct NodeDB {
       memset(this, 0, sizeof(*this));
     }
   };
-  Hash_Table<string_ref, u32> name2id;
-
-  Array<Node>         nodes;
-  Array<string_ref>   id2name;
-  Array<Node_Wrapper> wrappers;
+  // Names are interned, lookups compare atoms. Maps a name to the node handle
+  Hash_Table<Atom, u32, Tracking_Allocator<NodeDB_name2id>> name2id;
 
-  Array<Link> links;
+  // Node ids are SlotMap handles, only live nodes are stored
+  SlotMap<Node, 0x100, Tracking_Allocator<NodeDB_nodes>>          nodes;
+  // Parallel to nodes.items
+  Array<Node_Wrapper, 0x100, Tracking_Allocator<NodeDB_wrappers>> wrappers;
 
-  Pool<char> string_storage;
+  Array<Link, 0x100, Tracking_Allocator<NodeDB_links>> links;
 
   void init() {
     name2id.init();
-    id2name.init();
     nodes.init();
+    wrappers.init();
     links.init();
-    string_storage = Pool<char>::create(1 << 20);
   }
   void release() {
     name2id.release();
-    id2name.release();
     nodes.release();
+    ito(wrappers.size) wrappers[i].release();
+    wrappers.release();
     links.release();
-    string_storage.release();
   }
 
-  string_ref move_cstr(string_ref old) {
-    if (!string_storage.has_space(old.len + 1)) {
-      rebuild_index();
-    }
-    char *     new_ptr = string_storage.put(old.ptr, old.len + 1);
-    string_ref new_ref = string_ref{.ptr = new_ptr, .len = old.len};
-    new_ptr[old.len]   = '\0';
-    return new_ref;
-  }
-  string_ref move_str(string_ref old) {
-    if (!string_storage.has_space(old.len + 1)) {
-      rebuild_index();
-    }
-    return string_ref{.ptr = string_storage.put(old.ptr, old.len), .len = old.len};
+  Node *get_node(u32 id) { return nodes.get_or_null(id); }
+  Node_Wrapper *get_wrapper(u32 id) {
+    i32 index = nodes.find(id);
+    return index >= 0 ? &wrappers[index] : NULL;
   }
+  bool is_alive(u32 id) { return nodes.is_alive(id); }
 
-  void rebuild_index() {
-    // not re-entrant
-    static bool rebuilding_index = false;
-    if (rebuilding_index) {
-      TRAP;
-    }
-    rebuilding_index        = true;
-    auto old_string_storage = string_storage;
-    string_storage          = Pool<char>::create(1 << 20);
-    auto old_id2name        = id2name;
-    id2name                 = Array<string_ref>();
-    id2name.init();
-    name2id.release();
-    name2id.init();
-    id2name.resize(nodes.size);
-    ASSERT_DEBUG(nodes.size == wrappers.size);
-    ito(nodes.size) {
-      Node &node = nodes[i];
-      if (node.is_alive()) {
-        string_ref new_name_ref = move_cstr(old_id2name[node.get_index()]);
-        name2id.insert(new_name_ref, node.get_index());
-        id2name[i]            = new_name_ref;
-        wrappers[i].node_name = new_name_ref;
-        jto(wrappers[i].input_slots.size) {
-          wrappers[i].input_slots[j] = move_cstr(wrappers[i].input_slots[j]);
-        }
-        jto(wrappers[i].output_slots.size) {
-          wrappers[i].output_slots[j] = move_cstr(wrappers[i].output_slots[j]);
-        }
-      }
-    }
-    old_string_storage.release();
-    old_id2name.release();
-    rebuilding_index = false;
+  Atom get_name_atom(u32 id) {
+    Node_Wrapper *w = get_wrapper(id);
+    return w != NULL ? w->node_name : Atom{};
   }
-  string_ref get_name(u32 id) {
-    ASSERT_DEBUG(id > 0);
-    return id2name[id - 1];
+  string_ref get_name(u32 id) { return atom_str(get_name_atom(id)); }
+  void remove_node(u32 id) {
+    PERF_SCOPE("NodeDB::remove_node");
+    i32 index = nodes.remove(id);
+    if (index < 0) return;
+    // Mirror the swap-remove
+    wrappers[index].release();
+    Node_Wrapper last = wrappers.pop();
+    if ((u32)index != wrappers.size) wrappers[index] = last;
+    // One pass over every link, order is kept
+    u32 kept = parallel_compact(links.ptr, links.get_size(), 1 << 14, [&](u32 i, Link *dst) {
+      Link link = links[i];
+      if (link.src_node_id == id || link.dst_node_id == id) return false;
+      *dst = link;
+      return true;
+    });
+    links.size = kept;
   }
-  void remove_node(string_ref name) {
-    ASSERT_DEBUG(name2id.contains(name));
-    u32 id = name2id.get(name);
-    wrappers[id].release();
-    nodes[id].release();
+  void remove_node(Atom name) {
+    u32 *id = name2id.get_or_null(name);
+    if (id == NULL) return;
+    remove_node(*id);
     name2id.remove(name);
   }
-  u32 get_id(string_ref name) {
-    if (name2id.contains(name)) {
-      return name2id.get(name);
-    }
-    return 0;
+  u32 get_id(Atom name) {
+    u32 *id = name2id.get_or_null(name);
+    return id != NULL ? *id : 0;
   }
-  u32 add_node(string_ref name, string_ref type_name) {
+  u32 add_node(Atom name, Atom type_name) {
+    PERF_SCOPE("NodeDB::add_node");
     Node_t type = str_to_node_type(type_name);
     if (type == Node_t::UNKNOWN) return 0;
-    if (name2id.contains(name)) {
-      PUSH_WARNING("Node name collision: %.*s", STRF(name));
-      remove_node(name);
+    bool found = false;
+    u32 *id    = name2id.get_or_insert(name, &found);
+    if (found) {
+      PUSH_WARNING("Node name collision: %.*s", STRF(atom_str(name)));
+      remove_node(*id);
     }
     Node node;
+    MEMZERO(node);
     node.type   = type;
     node.pos.x  = 0.0f;
     node.pos.y  = 0.0f;
     node.size.x = 1.0f;
     node.size.y = 1.0f;
-    node.id     = nodes.size + 1;
-    nodes.push(node);
-    wrappers.push({});
-    string_ref new_name_ref = move_cstr(name);
-    name2id.insert(new_name_ref, node.get_index());
-    id2name.push(new_name_ref);
+    u32 handle  = nodes.insert(node);
+    nodes.get(handle).id = handle;
     Node_Wrapper wrapper;
     wrapper.init();
-    wrapper.node_id       = node.id;
-    wrapper.node_name     = new_name_ref;
-    wrappers[node.id - 1] = wrapper;
-    return node.id;
+    wrapper.node_id   = handle;
+    wrapper.node_name = name;
+    wrappers.push(wrapper);
+    *id = handle;
+    return handle;
   }
-  void set_node_position(string_ref name, float x, float y) {
-    if (name2id.contains(name)) {
-      u32 id = name2id.get(name);
-      set_node_position(id, x, y);
+  void set_node_position(Atom name, float x, float y) {
+    if (u32 *id = name2id.get_or_null(name)) {
+      set_node_position(*id, x, y);
     }
   }
   void set_node_position(u32 id, float x, float y) {
-    nodes[id - 1].pos.x = x;
-    nodes[id - 1].pos.y = y;
+    Node *node = get_node(id);
+    if (node == NULL) return;
+    node->pos.x = x;
+    node->pos.y = y;
   }
   void set_node_size(u32 id, float size_x, float size_y) {
-    nodes[id - 1].size.x = size_x;
-    nodes[id - 1].size.y = size_y;
+    Node *node = get_node(id);
+    if (node == NULL) return;
+    node->size.x = size_x;
+    node->size.y = size_y;
   }
-  u32 add_input_slot(u32 node_id, string_ref name) {
-    auto &s = wrappers[node_id - 1].input_slots;
-    s.push(move_cstr(name));
-    nodes[node_id - 1].num_in_slots++;
+  u32 add_input_slot(u32 node_id, Atom name) {
+    i32 index = nodes.find(node_id);
+    ASSERT_RETNULL(index >= 0);
+    auto &s = wrappers[index].input_slots;
+    s.push(name);
+    nodes.items[index].num_in_slots++;
     return s.size;
   }
-  u32 add_output_slot(u32 node_id, string_ref name) {
-    auto &s = wrappers[node_id - 1].output_slots;
-    s.push(move_cstr(name));
-    nodes[node_id - 1].num_out_slots++;
+  u32 add_output_slot(u32 node_id, Atom name) {
+    i32 index = nodes.find(node_id);
+    ASSERT_RETNULL(index >= 0);
+    auto &s = wrappers[index].output_slots;
+    s.push(name);
+    nodes.items[index].num_out_slots++;
     return s.size;
   }
   u32 add_link(u32 src_node_id, u32 src_slot_id, u32 dst_node_id, u32 dst_slot_id) {
-    ASSERT_RETNULL(src_node_id > 0 && src_node_id <= nodes.size);
-    ASSERT_RETNULL(dst_node_id > 0 && dst_node_id <= nodes.size);
-    Node &src = nodes[src_node_id - 1];
-    //    Node_Wrapper &wsrc = wrappers[src_node_id];
-    Node &dst = nodes[dst_node_id - 1];
-    //    Node_Wrapper &wdst = wrappers[dst_node_id];
-    ASSERT_RETNULL(src_slot_id > 0 && src_slot_id <= src.num_out_slots);
-    ASSERT_RETNULL(dst_slot_id > 0 && dst_slot_id <= dst.num_in_slots);
+    Node *src = get_node(src_node_id);
+    Node *dst = get_node(dst_node_id);
+    ASSERT_RETNULL(src != NULL);
+    ASSERT_RETNULL(dst != NULL);
+    ASSERT_RETNULL(src_slot_id > 0 && src_slot_id <= src->num_out_slots);
+    ASSERT_RETNULL(dst_slot_id > 0 && dst_slot_id <= dst->num_in_slots);
     links.push(Link{.src_node_id = src_node_id,
                     .src_slot_id = src_slot_id,
                     .dst_node_id = dst_node_id,
@@ -346,17 +376,29 @@ struct _Scene : public Scene {
     *count = sourcedb.names_packed.size;
     *ptr   = sourcedb.names_packed.ptr;
   }
-  char const *get_source(char const *name) { return sourcedb.get_text(stref_s(name)).ptr; }
-  void        set_source(char const *name, char const *new_src) {
-    sourcedb.update_text(stref_s(name), stref_s(new_src));
+  char const *get_source(char const *name) {
+    return sourcedb.get_text(atom_find(stref_s(name))).ptr;
+  }
+  void set_source(char const *name, char const *new_src) {
+    sourcedb.update_text(atom_find(stref_s(name)), stref_s(new_src));
   }
-  void remove_source(char const *name) { sourcedb.remove_source(stref_s(name)); }
+  void remove_source(char const *name) { sourcedb.remove_source(atom_find(stref_s(name))); }
   void add_source(char const *name, char const *text) {
     if (!is_valid_name(name)) {
       push_warning("Source's name is invalid");
       return;
     }
-    sourcedb.add_source(stref_s(name), stref_s(text));
+    sourcedb.add_source(intern(stref_s(name)), stref_s(text));
+  }
+  bool load_source(char const *name, char const *path) {
+    if (!is_valid_name(name)) {
+      push_warning("Source's name is invalid");
+      return false;
+    }
+    Mapped_File file;
+    if (!file.init(path)) return false;
+    sourcedb.add_mapped_source(intern(stref_s(name)), file);
+    return true;
   }
   u32 add_node(char const *name, char const *type_name, float x, float y, float size_x,
                float size_y) {
@@ -365,14 +407,15 @@ struct _Scene : public Scene {
       push_warning("Node's name is invalid");
       return 0;
     }
-    u32 id = nodedb.add_node(stref_s(name), stref_s(type_name));
+    u32 id = nodedb.add_node(intern(stref_s(name)), intern(stref_s(type_name)));
     ASSERT_RETNULL(id > 0);
     nodedb.set_node_position(id, x, y);
     nodedb.set_node_size(id, size_x, size_y);
     return id;
   }
   void run_script(char const *src_name) {
-    string_ref source = sourcedb.get_text(stref_s(src_name));
+    PERF_HIST_SCOPE("run_script_ns");
+    string_ref source = sourcedb.get_text(atom_find(stref_s(src_name)));
     Evaluator  evaluator;
     evaluator.scene = this;
     evaluator.parse_and_eval(source);
@@ -411,32 +454,47 @@ struct _Scene : public Scene {
     Tmp_String_Builder builder;
     builder.init(1 << 20);
     builder.push_string("(main\n");
-    ito(nodedb.nodes.size) {
-      Node &                node  = nodedb.nodes[i];
-      NodeDB::Node_Wrapper &nodew = nodedb.wrappers[i];
+    // Nodes and sources go out in name order, the same scene always saves to the same text
+    u32         num_nodes  = nodedb.nodes.get_size();
+    string_ref *node_names = (string_ref *)tl_alloc_tmp(sizeof(string_ref) * num_nodes);
+    u32 *       node_order = (u32 *)tl_alloc_tmp(sizeof(u32) * num_nodes);
+    ito(num_nodes) {
+      node_names[i] = nodedb.nodes.items[i].is_alive() ? atom_str(nodedb.wrappers[i].node_name)
+                                                       : string_ref{};
+    }
+    radix_sort_strings(node_names, num_nodes, node_order);
+    ito(num_nodes) {
+      Node &                node  = nodedb.nodes.items[node_order[i]];
+      NodeDB::Node_Wrapper &nodew = nodedb.wrappers[node_order[i]];
       if (node.is_alive()) {
         builder.push_fmt(                                   //
             "  (let node_%i (add_node \"%.*s\" \"%s\"))\n", //
             node.id,
-            STRF(nodedb.get_name(node.id)), //
+            STRF(atom_str(nodew.node_name)), //
             node_type_to_str(node.type),    //
             0.0f, 0.0f,                     //
             1.0f, 1.0f);
+        // Shortest round trip text, positions don't drift over save/load cycles
+        char x[F32_FORMAT_MAX], y[F32_FORMAT_MAX];
+        format_f32(x, node.pos.x);
+        format_f32(y, node.pos.y);
         builder.push_fmt(                            //
-            "  (set_node_position node_%i %f %f)\n", //
+            "  (set_node_position node_%i %s %s)\n", //
             node.id,                                 //
-            node.pos.x, node.pos.y);
+            x, y);
+        format_f32(x, node.size.x);
+        format_f32(y, node.size.y);
         builder.push_fmt(                        //
-            "  (set_node_size node_%i %f %f)\n", //
+            "  (set_node_size node_%i %s %s)\n", //
             node.id,                             //
-            node.size.x, node.size.y);
+            x, y);
         jto(nodew.input_slots.size) {
           builder.push_fmt(                                                //
               "  (let node_%i_in_%i (add_input_slot node_%i \"%.*s\"))\n", //
               node.id,                                                     //
               j + 1,                                                       //
               node.id,                                                     //
-              STRF(nodew.input_slots[j]));
+              STRF(atom_str(nodew.input_slots[j])));
         }
         jto(nodew.output_slots.size) {
           builder.push_fmt(                                                  //
@@ -444,7 +502,7 @@ struct _Scene : public Scene {
               node.id,                                                       //
               j + 1,                                                         //
               node.id,                                                       //
-              STRF(nodew.output_slots[j]));
+              STRF(atom_str(nodew.output_slots[j])));
         }
       }
     }
@@ -455,43 +513,56 @@ struct _Scene : public Scene {
           link.src_node_id, link.src_node_id, link.src_slot_id, link.dst_node_id, link.dst_node_id,
           link.dst_slot_id);
     }
-    ito(sourcedb.sources.size) {
-      Source &src = sourcedb.sources[i];
-      if (!src.is_alive()) continue;
-      if (src.name == stref_s("init")) continue;
+    u32 num_sources = 0;
+    sourcedb.sources.iter_values([&](Source &) { num_sources++; });
+    Source **   sources      = (Source **)tl_alloc_tmp(sizeof(Source *) * num_sources);
+    string_ref *source_names = (string_ref *)tl_alloc_tmp(sizeof(string_ref) * num_sources);
+    u32 *       source_order = (u32 *)tl_alloc_tmp(sizeof(u32) * num_sources);
+    num_sources              = 0;
+    sourcedb.sources.iter_values([&](Source &src) {
+      source_names[num_sources] = atom_str(src.name);
+      sources[num_sources++]    = &src;
+    });
+    radix_sort_strings(source_names, num_sources, source_order);
+    ito(num_sources) {
+      Source &src = *sources[source_order[i]];
+      if (src.name == ATOM("init")) continue;
       builder.push_fmt(                                   //
           "  (add_source\n\"%.*s\"\n\"\"\"%.*s\"\"\")\n", //
-          STRF(src.name),                                 //
+          STRF(atom_str(src.name)),                       //
           STRF(src.text)                                  //
       );
     }
+    char x[F32_FORMAT_MAX], y[F32_FORMAT_MAX], z[F32_FORMAT_MAX];
+    format_f32(x, c2d.camera.pos.x);
+    format_f32(y, c2d.camera.pos.y);
+    format_f32(z, c2d.camera.pos.z);
     builder.push_fmt(                 //
-        "  (move_camera %f %f %f)\n", //
-        c2d.camera.pos.x, c2d.camera.pos.y, c2d.camera.pos.z);
+        "  (move_camera %s %s %s)\n", //
+        x, y, z);
     builder.push_string(")");
     return builder.finish();
   }
   struct Evaluator {
     _Scene *     scene;
+    Ast *        ast;
     bool         eval_error;
     static char *get_msg_buf() {
       static char msg_buf[0x100] = {};
       return msg_buf;
     }
-    static Pool<List> &get_list_storage() {
-      static Pool<List> list_storage = Pool<List>::create((1 << 10));
-      return list_storage;
-    }
     struct Value {
       enum class Value_t { UNKNOWN = 0, I32, F32, SYMBOL };
       Value_t    type;
       f32        f;
       i32        i;
       string_ref str;
+      // Null unless the symbol came from an interned name
+      Atom atom;
     };
     struct Symbol {
-      string_ref name;
-      Value *    val;
+      Atom   name;
+      Value *val;
     };
     static Pool<Symbol> &get_symbol_table() {
       static Pool<Symbol> symbol_table = Pool<Symbol>::create((1 << 10));
@@ -499,10 +570,8 @@ struct _Scene : public Scene {
     }
     void enter_scope() { get_symbol_table().enter_scope(); }
     void exit_scope() { get_symbol_table().exit_scope(); }
-    void add_symbol(string_ref name, Value *val) {
-      get_symbol_table().push({.name = name, .val = val});
-    }
-    Value *lookup_symbol(string_ref name) {
+    void add_symbol(Atom name, Value *val) { get_symbol_table().push({.name = name, .val = val}); }
+    Value *lookup_symbol(Atom name) {
       ito(get_symbol_table().cursor) {
         u32 index = get_symbol_table().cursor - 1 - i;
         if (get_symbol_table().at(index)->name == name) {
@@ -511,18 +580,21 @@ struct _Scene : public Scene {
       }
       return NULL;
     }
+    static Atom get_atom(Value *val) {
+      return val->atom.is_null() ? intern(val->str) : val->atom;
+    }
     void parse_and_eval(string_ref source) {
-      get_list_storage().enter_scope();
-      defer(get_list_storage().exit_scope());
-      struct List_Allocator {
-        List *alloc() { return get_list_storage().alloc_zero(1); }
-        void  reset() {}
-      } list_allocator;
-      List *root = List::parse(source, list_allocator);
-      if (root != NULL) {
+      Ast tree;
+      tree.init();
+      defer(tree.release());
+      if (tree.parse(source)) {
         TMP_STORAGE_SCOPE;
+        ast        = &tree;
         eval_error = false;
-        eval(root);
+        // Top level forms run in order, the first error stops the script
+        for (u32 form = tree.first_child[0]; form != AST_NULL && !eval_error;
+             form = tree.next_sibling[form])
+          eval(form);
         if (eval_error) {
           scene->push_warning("Evaluation error");
         }
@@ -530,8 +602,9 @@ struct _Scene : public Scene {
         scene->push_warning("Parse error");
       }
     }
-    Value *eval(List *l) {
-      if (l == NULL) return NULL;
+    Value *eval(u32 l) {
+      if (l == AST_NULL) return NULL;
+      PERF_SCOPE("Evaluator::eval");
         ///////////////////
         // Macro helpers //
         ///////////////////
@@ -557,75 +630,74 @@ struct _Scene : public Scene {
 #define ASSERT_I32(x) EVAL_ASSERT(x != NULL && x->type == Value::Value_t::I32);
 #define ASSERT_F32(x) EVAL_ASSERT(x != NULL && x->type == Value::Value_t::F32);
 #define EVAL_SMB(res, id)                                                                          \
-  Value *res = CALL_EVAL(l->get(id));                                                              \
+  Value *res = CALL_EVAL(ast->child(l, id));                                                       \
   ASSERT_SMB(res)
 #define EVAL_I32(res, id)                                                                          \
-  Value *res = CALL_EVAL(l->get(id));                                                              \
+  Value *res = CALL_EVAL(ast->child(l, id));                                                       \
   ASSERT_I32(res)
 #define EVAL_F32(res, id)                                                                          \
-  Value *res = CALL_EVAL(l->get(id));                                                              \
+  Value *res = CALL_EVAL(ast->child(l, id));                                                       \
   ASSERT_F32(res)
       ///////////////////
-      if (l->nonempty()) {
-        i32  imm32;
-        f32  immf32;
-        bool is_imm32  = parse_decimal_int(l->symbol.ptr, l->symbol.len, &imm32);
-        bool is_immf32 = parse_float(l->symbol.ptr, l->symbol.len, &immf32);
-        if (is_imm32) {
-          Value *new_val = ALLOC_VAL();
-          new_val->i     = imm32;
-          new_val->type  = Value::Value_t::I32;
-          return new_val;
-        } else if (is_immf32) {
-          Value *new_val = ALLOC_VAL();
-          new_val->f     = immf32;
-          new_val->type  = Value::Value_t::F32;
-          return new_val;
-        } else if (l->cmp_symbol("main")) {
+      if (ast->kind(l) == Ast_Kind::LIST) {
+        u32 head = ast->first_child[l];
+        EVAL_ASSERT(head != AST_NULL);
+        // Strings and numbers never name a builtin
+        switch (ast->kind(head) == Ast_Kind::SYMBOL ? Eval_Builtins.find(ast->token(head)) : -1) {
+        case Eval_Builtins.index("main"): {
           enter_scope();
           defer(exit_scope());
-          List *cur = l->next;
-          while (cur != NULL) {
+          for (u32 cur = ast->next_sibling[head]; cur != AST_NULL; cur = ast->next_sibling[cur]) {
             CALL_EVAL(cur);
-            cur = cur->next;
           }
           return NULL;
-        } else if (l->cmp_symbol("add_node")) {
+        }
+        case Eval_Builtins.index("add_node"): {
           EVAL_SMB(name, 1);
           EVAL_SMB(type, 2);
-          u32    id      = scene->nodedb.add_node(name->str, type->str);
+          u32    id      = scene->nodedb.add_node(get_atom(name), get_atom(type));
           Value *new_val = ALLOC_VAL();
           new_val->i     = id;
           new_val->type  = Value::Value_t::I32;
           return new_val;
-        } else if (l->cmp_symbol("set_node_position")) {
+        }
+        case Eval_Builtins.index("set_node_position"): {
           EVAL_I32(id, 1);
           EVAL_F32(x, 2);
           EVAL_F32(y, 3);
           scene->nodedb.set_node_position(id->i, x->f, y->f);
           return NULL;
-        } else if (l->cmp_symbol("get_node_id")) {
+        }
+        case Eval_Builtins.index("get_node_id"): {
           EVAL_SMB(name, 1);
-          u32    id      = scene->nodedb.get_id(name->str);
+          u32    id      = scene->nodedb.get_id(get_atom(name));
           Value *new_val = ALLOC_VAL();
           new_val->i     = id;
           new_val->type  = Value::Value_t::I32;
           return new_val;
-        } else if (l->cmp_symbol("set_node_size")) {
+        }
+        case Eval_Builtins.index("remove_node"): {
+          EVAL_I32(id, 1);
+          scene->nodedb.remove_node(scene->nodedb.get_name_atom((u32)id->i));
+          return NULL;
+        }
+        case Eval_Builtins.index("set_node_size"): {
           EVAL_I32(id, 1);
           EVAL_F32(x, 2);
           EVAL_F32(y, 3);
           scene->nodedb.set_node_size(id->i, x->f, y->f);
           return NULL;
-        } else if (l->cmp_symbol("add_input_slot")) {
+        }
+        case Eval_Builtins.index("add_input_slot"): {
           EVAL_I32(id, 1);
           EVAL_SMB(name, 2);
-          u32    sid     = scene->nodedb.add_input_slot(id->i, name->str);
+          u32    sid     = scene->nodedb.add_input_slot(id->i, get_atom(name));
           Value *new_val = ALLOC_VAL();
           new_val->i     = sid;
           new_val->type  = Value::Value_t::I32;
           return new_val;
-        } else if (l->cmp_symbol("add_link")) {
+        }
+        case Eval_Builtins.index("add_link"): {
           EVAL_I32(src_node_id, 1);
           EVAL_I32(src_slot_id, 2);
           EVAL_I32(dst_node_id, 3);
@@ -636,24 +708,27 @@ struct _Scene : public Scene {
           new_val->i     = sid;
           new_val->type  = Value::Value_t::I32;
           return new_val;
-        } else if (l->cmp_symbol("add_output_slot")) {
+        }
+        case Eval_Builtins.index("add_output_slot"): {
           EVAL_I32(id, 1);
           EVAL_SMB(name, 2);
-          u32    sid     = scene->nodedb.add_output_slot(id->i, name->str);
+          u32    sid     = scene->nodedb.add_output_slot(id->i, get_atom(name));
           Value *new_val = ALLOC_VAL();
           new_val->i     = sid;
           new_val->type  = Value::Value_t::I32;
           return new_val;
-        } else if (l->cmp_symbol("itof")) {
+        }
+        case Eval_Builtins.index("itof"): {
           EVAL_I32(a, 1);
           Value *new_val = ALLOC_VAL();
           new_val->f     = (float)a->i;
           new_val->type  = Value::Value_t::F32;
           return new_val;
-        } else if (l->cmp_symbol("add")) {
-          Value *op1 = CALL_EVAL(l->get(1));
+        }
+        case Eval_Builtins.index("add"): {
+          Value *op1 = CALL_EVAL(ast->child(l, 1));
           EVAL_ASSERT(op1 != NULL);
-          Value *op2 = CALL_EVAL(l->get(2));
+          Value *op2 = CALL_EVAL(ast->child(l, 2));
           EVAL_ASSERT(op2 != NULL);
           EVAL_ASSERT(op1->type == op2->type);
           if (op1->type == Value::Value_t::I32) {
@@ -671,10 +746,11 @@ struct _Scene : public Scene {
             eval_error = true;
           }
           return NULL;
-        } else if (l->cmp_symbol("mul")) {
-          Value *op1 = CALL_EVAL(l->get(1));
+        }
+        case Eval_Builtins.index("mul"): {
+          Value *op1 = CALL_EVAL(ast->child(l, 1));
           EVAL_ASSERT(op1 != NULL);
-          Value *op2 = CALL_EVAL(l->get(2));
+          Value *op2 = CALL_EVAL(ast->child(l, 2));
           EVAL_ASSERT(op2 != NULL);
           EVAL_ASSERT(op1->type == op2->type);
           if (op1->type == Value::Value_t::I32) {
@@ -692,19 +768,21 @@ struct _Scene : public Scene {
             eval_error = true;
           }
           return NULL;
-        } else if (l->cmp_symbol("add_source")) {
-          Value *name = CALL_EVAL(l->get(1));
+        }
+        case Eval_Builtins.index("add_source"): {
+          Value *name = CALL_EVAL(ast->child(l, 1));
           EVAL_ASSERT(name != NULL && name->type == Value::Value_t::SYMBOL);
-          Value *text = CALL_EVAL(l->get(2));
+          Value *text = CALL_EVAL(ast->child(l, 2));
           EVAL_ASSERT(text != NULL && text->type == Value::Value_t::SYMBOL);
           scene->add_source(stref_to_tmp_cstr(name->str), stref_to_tmp_cstr(text->str));
           return NULL;
-        } else if (l->cmp_symbol("for")) {
-          Value *name = CALL_EVAL(l->get(1));
+        }
+        case Eval_Builtins.index("for"): {
+          Value *name = CALL_EVAL(ast->child(l, 1));
           EVAL_ASSERT(name != NULL && name->type == Value::Value_t::SYMBOL);
-          Value *lb = CALL_EVAL(l->get(2));
+          Value *lb = CALL_EVAL(ast->child(l, 2));
           EVAL_ASSERT(lb != NULL && lb->type == Value::Value_t::I32);
-          Value *ub = CALL_EVAL(l->get(3));
+          Value *ub = CALL_EVAL(ast->child(l, 3));
           EVAL_ASSERT(ub != NULL && ub->type == Value::Value_t::I32);
           Value *new_val = ALLOC_VAL();
           new_val->i     = 0;
@@ -712,63 +790,66 @@ struct _Scene : public Scene {
           for (i32 i = lb->i; i < ub->i; i++) {
             enter_scope();
             new_val->i = i;
-            add_symbol(name->str, new_val);
+            add_symbol(get_atom(name), new_val);
             defer(exit_scope());
-            List *cur = l->get(4);
-            while (cur != NULL) {
+            for (u32 cur = ast->child(l, 4); cur != AST_NULL; cur = ast->next_sibling[cur]) {
               CALL_EVAL(cur);
-              cur = cur->next;
             }
           }
           return NULL;
-        } else if (l->cmp_symbol("scope")) {
+        }
+        case Eval_Builtins.index("scope"): {
           enter_scope();
           defer(exit_scope());
-          List *cur = l->get(1);
-          while (cur != NULL) {
+          for (u32 cur = ast->child(l, 1); cur != AST_NULL; cur = ast->next_sibling[cur]) {
             CALL_EVAL(cur);
-            cur = cur->next;
           }
           return NULL;
-        } else if (l->cmp_symbol("get_num_nodes")) {
+        }
+        case Eval_Builtins.index("get_num_nodes"): {
           Value *new_val = ALLOC_VAL();
-          new_val->i     = (i32)scene->nodedb.nodes.size;
+          new_val->i     = (i32)scene->nodedb.nodes.get_size();
           new_val->type  = Value::Value_t::I32;
           return new_val;
-        } else if (l->cmp_symbol("is_node_alive")) {
+        }
+        case Eval_Builtins.index("is_node_alive"): {
           Value *new_val = ALLOC_VAL();
-          Value *index   = CALL_EVAL(l->get(1));
+          Value *index   = CALL_EVAL(ast->child(l, 1));
           EVAL_ASSERT(index != NULL && index->type == Value::Value_t::I32);
-          new_val->i    = (scene->nodedb.nodes[index->i - 1].is_alive() ? 1 : 0);
+          new_val->i    = (scene->nodedb.is_alive((u32)index->i) ? 1 : 0);
           new_val->type = Value::Value_t::I32;
           return new_val;
-        } else if (l->cmp_symbol("print")) {
-          Value *str = CALL_EVAL(l->get(1));
+        }
+        case Eval_Builtins.index("print"): {
+          Value *str = CALL_EVAL(ast->child(l, 1));
           EVAL_ASSERT(str != NULL && str->type == Value::Value_t::SYMBOL);
           scene->push_debug_message("%.*s", STRF(str->str));
           return NULL;
-        } else if (l->cmp_symbol("let")) {
-          Value *name = CALL_EVAL(l->get(1));
+        }
+        case Eval_Builtins.index("let"): {
+          Value *name = CALL_EVAL(ast->child(l, 1));
           EVAL_ASSERT(name != NULL && name->type == Value::Value_t::SYMBOL);
-          Value *val = CALL_EVAL(l->get(2));
+          Value *val = CALL_EVAL(ast->child(l, 2));
           EVAL_ASSERT(val != NULL);
-          add_symbol(name->str, val);
+          add_symbol(get_atom(name), val);
           return NULL;
-        } else if (l->cmp_symbol("move_camera")) {
-          Value *x = CALL_EVAL(l->get(1));
+        }
+        case Eval_Builtins.index("move_camera"): {
+          Value *x = CALL_EVAL(ast->child(l, 1));
           EVAL_ASSERT(x != NULL && x->type == Value::Value_t::F32);
-          Value *y = CALL_EVAL(l->get(2));
+          Value *y = CALL_EVAL(ast->child(l, 2));
           EVAL_ASSERT(y != NULL && y->type == Value::Value_t::F32);
-          Value *z = CALL_EVAL(l->get(3));
+          Value *z = CALL_EVAL(ast->child(l, 3));
           EVAL_ASSERT(z != NULL && z->type == Value::Value_t::F32);
           scene->c2d.camera.pos.x = x->f;
           scene->c2d.camera.pos.y = y->f;
           scene->c2d.camera.pos.z = z->f;
           return NULL;
-        } else if (l->cmp_symbol("format")) {
-          Value *fmt = CALL_EVAL(l->get(1));
+        }
+        case Eval_Builtins.index("format"): {
+          Value *fmt = CALL_EVAL(ast->child(l, 1));
           EVAL_ASSERT(fmt != NULL && fmt->type == Value::Value_t::SYMBOL);
-          List *cur = l->get(2);
+          u32 cur = ast->child(l, 2);
           {
             char *      tmp_buf = (char *)tl_alloc_tmp(0x100);
             u32         cursor  = 0;
@@ -782,7 +863,7 @@ struct _Scene : public Scene {
                   return NULL;
                 }
 
-                if (cur == NULL) {
+                if (cur == AST_NULL) {
                   eval_error = true;
                   scene->push_error("[format] Not enough arguments", c[1]);
                   return NULL;
@@ -815,7 +896,7 @@ struct _Scene : public Scene {
                   }
                   cursor += num_chars;
                 }
-                cur = cur->next;
+                cur = ast->next_sibling[cur];
                 c += 1;
               } else {
                 tmp_buf[cursor++] = c[0];
@@ -824,32 +905,54 @@ struct _Scene : public Scene {
             }
             Value *new_val = ALLOC_VAL();
             new_val->str   = stref_s(tmp_buf);
+            new_val->atom  = {};
             new_val->type  = Value::Value_t::SYMBOL;
             return new_val;
           }
-        } else {
-          EVAL_ASSERT(l->nonempty());
-          Value *sym = lookup_symbol(l->symbol);
-          if (sym != NULL) {
-            return sym;
-          }
+        }
+        default: break;
+        }
+        // Any other list evaluates to its head
+        Value *head_value = CALL_EVAL(head);
+        return head_value;
+      }
+      string_ref token = ast->token(l);
+      if (ast->kind(l) == Ast_Kind::NUMBER) {
+        i32 imm32;
+        f32 immf32;
+        if (parse_decimal_int(token.ptr, token.len, &imm32)) {
           Value *new_val = ALLOC_VAL();
-          new_val->str   = l->symbol;
-          new_val->type  = Value::Value_t::SYMBOL;
+          new_val->i     = imm32;
+          new_val->type  = Value::Value_t::I32;
+          return new_val;
+        } else if (parse_float(token.ptr, token.len, &immf32)) {
+          Value *new_val = ALLOC_VAL();
+          new_val->f     = immf32;
+          new_val->type  = Value::Value_t::F32;
           return new_val;
         }
-      } else {
-        EVAL_ASSERT(l->child != NULL);
-        Value *child_value = CALL_EVAL(l->child);
-        return child_value;
       }
-      TRAP;
+      // Quoted strings are values as written, "node_5" stays a string when node_5 is bound.
+      // They aren't interned by the parser, the atom is only found when the string already is one
+      Atom name = ast->atoms[l].is_null() ? atom_find(token) : ast->atoms[l];
+      if (ast->kind(l) != Ast_Kind::STRING) {
+        Value *sym = name.is_null() ? NULL : lookup_symbol(name);
+        if (sym != NULL) {
+          return sym;
+        }
+      }
+      Value *new_val = ALLOC_VAL();
+      new_val->str   = token;
+      new_val->atom  = name;
+      new_val->type  = Value::Value_t::SYMBOL;
+      return new_val;
 #undef EVAL_ASSERT
 #undef CHECK_ERROR
     }
   };
 
   void consume_event(SDL_Event event) {
+    PERF_HIST_SCOPE("consume_event_ns");
     static bool  ldown             = false;
     static int   old_mp_x          = 0;
     static int   old_mp_y          = 0;
@@ -858,7 +961,7 @@ struct _Scene : public Scene {
     static bool  lctrl             = false;
     static float old_mouse_world_x = 0.0f;
     static float old_mouse_world_y = 0.0f;
-    static i32   selected_node     = -1;
+    static u32   selected_node     = 0;
     switch (event.type) {
     case SDL_QUIT: {
       break;
@@ -889,19 +992,18 @@ struct _Scene : public Scene {
       if (m->button == 1) {
         ldown = true;
       }
-      if (selected_node >= 0) {
-        nodedb.nodes[selected_node].selected = false;
+      if (Node *node = nodedb.get_node(selected_node)) {
+        node->selected = false;
       }
-      ito(nodedb.nodes.size) {
-        Node &node = nodedb.nodes[i];
-        if (node.is_alive() && node.inside(c2d.camera.mouse_world_x, c2d.camera.mouse_world_y)) {
-
-          selected_node                        = i;
-          nodedb.nodes[selected_node].selected = true;
+      ito(nodedb.nodes.get_size()) {
+        Node &node = nodedb.nodes.items[i];
+        if (node.inside(c2d.camera.mouse_world_x, c2d.camera.mouse_world_y)) {
+          selected_node = node.id;
+          node.selected = true;
           return;
         }
       }
-      selected_node = -1;
+      selected_node = 0;
       if (c2d.hovered) c2d.consume_event(event);
       break;
     }
@@ -934,10 +1036,10 @@ struct _Scene : public Scene {
       old_mouse_world_x = c2d.camera.mouse_world_x;
       old_mouse_world_y = c2d.camera.mouse_world_y;
 
-      if (ldown && selected_node >= 0) {
-        Node &node = nodedb.nodes[selected_node];
-        node.pos.x += wmdx; // c2d.camera.pos.z * (float)dx / c2d.camera.viewport_height;
-        node.pos.y += wmdy; // c2d.camera.pos.z * (float)dy / c2d.camera.viewport_height;
+      Node *node = nodedb.get_node(selected_node);
+      if (ldown && node != NULL) {
+        node->pos.x += wmdx; // c2d.camera.pos.z * (float)dx / c2d.camera.viewport_height;
+        node->pos.y += wmdy; // c2d.camera.pos.z * (float)dy / c2d.camera.viewport_height;
       }
 
     } break;
@@ -949,6 +1051,7 @@ struct _Scene : public Scene {
 };
 
 void Scene::draw() {
+  PERF_SCOPE("Scene::draw");
   _Scene *scene = (_Scene *)this;
   scene->new_frame();
   line_storage.enter_scope();
@@ -1027,7 +1130,7 @@ void Scene::draw() {
                    .color = {.r = grid_color.x, .g = grid_color.y, .b = grid_color.z}});
   }
   auto get_slot_offset = [&](u32 node_id, u32 slot_id, bool in) {
-    Node &node = scene->nodedb.nodes[node_id - 1];
+    Node &node = scene->nodedb.nodes.get(node_id);
     if (in) {
       float x = SLOT_PADDING_X + node.pos.x;
       float y = -SLOT_PADDING_Y + node.pos.y - (SLOT_SIZE + SLOT_MARGIN) * (float)(slot_id - 1) -
@@ -1059,8 +1162,8 @@ void Scene::draw() {
                                   .width = c2d.camera.pos.z / c2d.viewport_height,
                                   .color = {.r = 1.0f, .g = 0.0f, .b = 0.0f}});
   }
-  ito(scene->nodedb.nodes.size) {
-    Node &                node  = scene->nodedb.nodes[i];
+  ito(scene->nodedb.nodes.get_size()) {
+    Node &                node  = scene->nodedb.nodes.items[i];
     NodeDB::Node_Wrapper &nodew = scene->nodedb.wrappers[i];
     if (node.is_alive()) {
       if (!c2d.camera.intersects(       //
@@ -1072,7 +1175,7 @@ void Scene::draw() {
         continue;
       if (c2d.camera.pos.z < 100.0f)
         c2d.draw_string({//
-                         .c_str = scene->nodedb.get_name(node.id).ptr,
+                         .c_str = atom_str(nodew.node_name).ptr,
                          .x     = node.pos.x,
                          .y     = node.pos.y,
                          .z     = NODE_NAME_LAYER,
@@ -1092,12 +1195,13 @@ void Scene::draw() {
                            node.pos.y - node.size.y - SELECTION_OFFSET, //
                            SELECTION_LAYER, {.r = 0.8f, .g = 0.4f, .b = 0.3f});
       }
+      Atom *input_slots = nodew.input_slots.data();
       jto(nodew.input_slots.size) {
         float x = SLOT_PADDING_X + node.pos.x;
         float y = -SLOT_PADDING_Y + node.pos.y - (SLOT_SIZE + SLOT_MARGIN) * (float)j;
         if (c2d.camera.pos.z < 100.0f)
           c2d.draw_string({//
-                           .c_str = nodew.input_slots[j].ptr,
+                           .c_str = atom_str(input_slots[j]).ptr,
                            .x     = x,
                            .y     = y - SLOT_SIZE,
                            .z     = SLOT_NAME_LAYER,
@@ -1110,12 +1214,13 @@ void Scene::draw() {
                        .height = SLOT_SIZE,
                        .color  = {.r = 0.6f, .g = 0.4f, .b = 0.3f}});
       }
+      Atom *output_slots = nodew.output_slots.data();
       jto(nodew.output_slots.size) {
         float x = -SLOT_PADDING_X + node.pos.x + node.size.x - SLOT_SIZE;
         float y = -SLOT_PADDING_Y + node.pos.y - (SLOT_SIZE + SLOT_MARGIN) * (float)j;
         if (c2d.camera.pos.z < 100.0f)
           c2d.draw_string({//
-                           .c_str = nodew.output_slots[j].ptr,
+                           .c_str = atom_str(output_slots[j]).ptr,
                            .x     = x,
                            .y     = y - SLOT_SIZE,
                            .z     = SLOT_NAME_LAYER,
@@ -1141,9 +1246,9 @@ void Scene::get_source_list(char const ***ptr, u32 *count) {
   _Scene *scene = (_Scene *)this;
   scene->get_source_list(ptr, count);
 }
-void Scene::get_node_type_list(char const ***ptr, u32 *count) {
+void Scene::get_node_type_list(char const *const **ptr, u32 *count) {
   *ptr   = Node_Type_Name_Table;
-  *count = ARRAY_SIZE(Node_Type_Name_Table) - 1;
+  *count = ARRAY_SIZE(Node_Type_Name_Table);
 }
 char const *Scene::get_source(char const *name) {
   _Scene *scene = (_Scene *)this;
@@ -1162,6 +1267,10 @@ void Scene::add_source(char const *name, char const *text) {
   _Scene *scene = (_Scene *)this;
   scene->add_source(name, text);
 }
+bool Scene::load_source(char const *name, char const *path) {
+  _Scene *scene = (_Scene *)this;
+  return scene->load_source(name, path);
+}
 void Scene::reset() {
   _Scene *scene = (_Scene *)this;
   scene->reset();
@@ -1389,6 +1498,8 @@ void Scene::consume_event(SDL_Event event) {
 }
 
 void Context2D::render_stuff() {
+  PERF_SCOPE("Context2D::render_stuff");
+  upload_bytes = 0;
   glViewport((float)viewport_x, (float)(screen_height - viewport_y - viewport_height),
              (float)viewport_width, (float)viewport_height);
   glScissor(viewport_x, screen_height - viewport_y - viewport_height, viewport_width,
@@ -1561,37 +1672,40 @@ void Context2D::render_stuff() {
       };
       static_assert(sizeof(Bezier_Instance_GL) == 56, "");
       uint32_t max_num_beziers = bezier_storage.cursor;
-      uint32_t num_beziers     = 0;
       TMP_STORAGE_SCOPE;
       Bezier_Instance_GL *qinstances =
           (Bezier_Instance_GL *)tl_alloc_tmp(sizeof(Bezier_Instance_GL) * max_num_beziers);
-      ito(max_num_beziers) {
-        CubicBezier2D b2d   = *bezier_storage.at(i);
-        float         min_x = MIN(b2d.x0, MIN(b2d.x1, MIN(b2d.x2, b2d.x3)));
-        float         min_y = MIN(b2d.y0, MIN(b2d.y1, MIN(b2d.y2, b2d.y3)));
-        float         max_x = MAX(b2d.x0, MAX(b2d.x1, MAX(b2d.x2, b2d.x3)));
-        float         max_y = MAX(b2d.y0, MAX(b2d.y1, MAX(b2d.y2, b2d.y3)));
-        if (!camera.intersects(min_x, min_y, max_x, max_y)) continue;
-
-        Bezier_Instance_GL b2dgl;
-        b2dgl.x0                  = b2d.x0;
-        b2dgl.x1                  = b2d.x1;
-        b2dgl.x2                  = b2d.x2;
-        b2dgl.x3                  = b2d.x3;
-        b2dgl.y0                  = b2d.y0;
-        b2dgl.y1                  = b2d.y1;
-        b2dgl.y2                  = b2d.y2;
-        b2dgl.y3                  = b2d.y3;
-        b2dgl.r                   = b2d.color.r;
-        b2dgl.g                   = b2d.color.g;
-        b2dgl.b                   = b2d.color.b;
-        b2dgl.width               = b2d.width;
-        b2dgl.z                   = b2d.z;
-        qinstances[num_beziers++] = b2dgl;
-      }
+      uint32_t num_beziers = parallel_compact(
+          qinstances, max_num_beziers, RENDER_JOB_GRAIN, [&](u32 i, Bezier_Instance_GL *dst) {
+            CubicBezier2D b2d   = *bezier_storage.at(i);
+            float         min_x = MIN(b2d.x0, MIN(b2d.x1, MIN(b2d.x2, b2d.x3)));
+            float         min_y = MIN(b2d.y0, MIN(b2d.y1, MIN(b2d.y2, b2d.y3)));
+            float         max_x = MAX(b2d.x0, MAX(b2d.x1, MAX(b2d.x2, b2d.x3)));
+            float         max_y = MAX(b2d.y0, MAX(b2d.y1, MAX(b2d.y2, b2d.y3)));
+            if (!camera.intersects(min_x, min_y, max_x, max_y)) return false;
+
+            Bezier_Instance_GL b2dgl;
+            b2dgl.x0    = b2d.x0;
+            b2dgl.x1    = b2d.x1;
+            b2dgl.x2    = b2d.x2;
+            b2dgl.x3    = b2d.x3;
+            b2dgl.y0    = b2d.y0;
+            b2dgl.y1    = b2d.y1;
+            b2dgl.y2    = b2d.y2;
+            b2dgl.y3    = b2d.y3;
+            b2dgl.r     = b2d.color.r;
+            b2dgl.g     = b2d.color.g;
+            b2dgl.b     = b2d.color.b;
+            b2dgl.width = b2d.width;
+            b2dgl.z     = b2d.z;
+            *dst        = b2dgl;
+            return true;
+          });
       if (num_beziers == 0) goto skip_bezier;
+      sort_front_to_back(qinstances, num_beziers);
       //      PUSH_DEBUG("Visible bezier curves: %i", num_beziers);
       //      PUSH_DEBUG("Vertices/Frame: %i", num_beziers * (BEZIER_LOD + 1) * 2);
+      upload_bytes += sizeof(Bezier_Instance_GL) * num_beziers;
       glBufferData(GL_ARRAY_BUFFER, sizeof(Bezier_Instance_GL) * num_beziers, qinstances,
                    GL_DYNAMIC_DRAW);
 
@@ -1649,38 +1763,42 @@ void Context2D::render_stuff() {
       static_assert(sizeof(Rect_Instance_GL) == 36, "");
       //      uint32_t max_num_quads = width * height;
       uint32_t max_num_quads = quad_storage.cursor;
-      uint32_t num_quads     = 0;
       TMP_STORAGE_SCOPE;
       Rect_Instance_GL *qinstances =
           (Rect_Instance_GL *)tl_alloc_tmp(sizeof(Rect_Instance_GL) * max_num_quads);
-      ito(max_num_quads) {
-        Rect2D quad2d = *quad_storage.at(i);
-        if (quad2d.world_space && !camera.intersects(quad2d.x, quad2d.y, quad2d.x + quad2d.width,
-                                                     quad2d.y + quad2d.height))
-          continue;
-        Rect_Instance_GL quadgl;
-        if (quad2d.world_space) {
-          quadgl.x      = quad2d.x;
-          quadgl.y      = quad2d.y;
-          quadgl.z      = quad2d.z;
-          quadgl.w      = 1.0f;
-          quadgl.width  = quad2d.width;
-          quadgl.height = quad2d.height;
-        } else {
-          quadgl.x      = 2.0f * quad2d.x / viewport_width - 1.0f;
-          quadgl.y      = -2.0f * quad2d.y / viewport_height + 1.0f;
-          quadgl.z      = quad2d.z;
-          quadgl.w      = 0.0f;
-          quadgl.width  = 2.0f * quad2d.width / viewport_width;
-          quadgl.height = -2.0f * quad2d.height / viewport_height;
-        }
+      uint32_t num_quads = parallel_compact(
+          qinstances, max_num_quads, RENDER_JOB_GRAIN, [&](u32 i, Rect_Instance_GL *dst) {
+            Rect2D quad2d = *quad_storage.at(i);
+            if (quad2d.world_space &&
+                !camera.intersects(quad2d.x, quad2d.y, quad2d.x + quad2d.width,
+                                   quad2d.y + quad2d.height))
+              return false;
+            Rect_Instance_GL quadgl;
+            if (quad2d.world_space) {
+              quadgl.x      = quad2d.x;
+              quadgl.y      = quad2d.y;
+              quadgl.z      = quad2d.z;
+              quadgl.w      = 1.0f;
+              quadgl.width  = quad2d.width;
+              quadgl.height = quad2d.height;
+            } else {
+              quadgl.x      = 2.0f * quad2d.x / viewport_width - 1.0f;
+              quadgl.y      = -2.0f * quad2d.y / viewport_height + 1.0f;
+              quadgl.z      = quad2d.z;
+              quadgl.w      = 0.0f;
+              quadgl.width  = 2.0f * quad2d.width / viewport_width;
+              quadgl.height = -2.0f * quad2d.height / viewport_height;
+            }
 
-        quadgl.r                = quad2d.color.r;
-        quadgl.g                = quad2d.color.g;
-        quadgl.b                = quad2d.color.b;
-        qinstances[num_quads++] = quadgl;
-      }
+            quadgl.r = quad2d.color.r;
+            quadgl.g = quad2d.color.g;
+            quadgl.b = quad2d.color.b;
+            *dst     = quadgl;
+            return true;
+          });
       if (num_quads == 0) goto skip_quads;
+      sort_front_to_back(qinstances, num_quads);
+      upload_bytes += sizeof(Rect_Instance_GL) * num_quads;
       glBufferData(GL_ARRAY_BUFFER, sizeof(Rect_Instance_GL) * num_quads, qinstances,
                    GL_DYNAMIC_DRAW);
 
@@ -1720,42 +1838,45 @@ void Context2D::render_stuff() {
       static_assert(sizeof(Line_GL) == 56, "");
       TMP_STORAGE_SCOPE;
       Line_GL *lines = (Line_GL *)tl_alloc_tmp(sizeof(Line_GL) * num_lines);
-      ito(num_lines) {
-        Line2D  l = *line_storage.at(i);
-        Line_GL lgl;
-        if (l.world_space) {
-          lgl.x0 = l.x0;
-          lgl.y0 = l.y0;
-          lgl.z0 = l.z;
-          lgl.w0 = 1.0f;
-          lgl.r0 = l.color.r;
-          lgl.g0 = l.color.g;
-          lgl.b0 = l.color.b;
-          lgl.x1 = l.x1;
-          lgl.y1 = l.y1;
-          lgl.z1 = l.z;
-          lgl.w1 = 1.0f;
-        } else {
-          lgl.x0 = 2.0f * l.x0 / viewport_width - 1.0f;
-          lgl.y0 = -2.0f * l.y0 / viewport_height + 1.0f;
-          lgl.z0 = l.z;
-          lgl.w0 = 0.0f;
-          lgl.r0 = l.color.r;
-          lgl.g0 = l.color.g;
-          lgl.b0 = l.color.b;
-          lgl.x1 = 2.0f * l.x1 / viewport_width - 1.0f;
-          lgl.y1 = -2.0f * l.y1 / viewport_height + 1.0f;
-          lgl.z1 = l.z;
-          lgl.w1 = 0.0f;
-        }
+      parallel_for(0, num_lines, RENDER_JOB_GRAIN, [&](u32 begin, u32 end) {
+        for (u32 i = begin; i < end; i++) {
+          Line2D  l = *line_storage.at(i);
+          Line_GL lgl;
+          if (l.world_space) {
+            lgl.x0 = l.x0;
+            lgl.y0 = l.y0;
+            lgl.z0 = l.z;
+            lgl.w0 = 1.0f;
+            lgl.r0 = l.color.r;
+            lgl.g0 = l.color.g;
+            lgl.b0 = l.color.b;
+            lgl.x1 = l.x1;
+            lgl.y1 = l.y1;
+            lgl.z1 = l.z;
+            lgl.w1 = 1.0f;
+          } else {
+            lgl.x0 = 2.0f * l.x0 / viewport_width - 1.0f;
+            lgl.y0 = -2.0f * l.y0 / viewport_height + 1.0f;
+            lgl.z0 = l.z;
+            lgl.w0 = 0.0f;
+            lgl.r0 = l.color.r;
+            lgl.g0 = l.color.g;
+            lgl.b0 = l.color.b;
+            lgl.x1 = 2.0f * l.x1 / viewport_width - 1.0f;
+            lgl.y1 = -2.0f * l.y1 / viewport_height + 1.0f;
+            lgl.z1 = l.z;
+            lgl.w1 = 0.0f;
+          }
 
-        lgl.r1   = l.color.r;
-        lgl.g1   = l.color.g;
-        lgl.b1   = l.color.b;
-        lines[i] = lgl;
-      }
+          lgl.r1   = l.color.r;
+          lgl.g1   = l.color.g;
+          lgl.b1   = l.color.b;
+          lines[i] = lgl;
+        }
+      });
       glBindVertexArray(line_vao);
       glBindBuffer(GL_ARRAY_BUFFER, line_vbo);
+      upload_bytes += sizeof(Line_GL) * num_lines;
       glBufferData(GL_ARRAY_BUFFER, sizeof(Line_GL) * num_lines, lines, GL_DYNAMIC_DRAW);
       glUseProgram(line_program);
       glUniformMatrix4fv(glGetUniformLocation(line_program, "projection"), 1, GL_FALSE,
@@ -1930,6 +2051,7 @@ void Context2D::render_stuff() {
       // glVertexAttribBinding(0, 0);
       glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
       glBindBuffer(GL_ARRAY_BUFFER, instance_vbo);
+      upload_bytes += sizeof(Glyph_Instance_GL) * num_glyphs;
       glBufferData(GL_ARRAY_BUFFER, sizeof(Glyph_Instance_GL) * num_glyphs, glyphs_gl,
                    GL_DYNAMIC_DRAW);
       glEnableVertexAttribArray(1);
@@ -1969,6 +2091,7 @@ void Context2D::render_stuff() {
   skip_strings:
     (void)0;
   }
+  PERF_HIST_ADD("upload_bytes", upload_bytes);
 }
 
 // void compile_shader(GLuint shader) {
@@ -29,6 +29,30 @@ void dump_scene()
 	dump_file("scene.lsp", dump.ptr, dump.len);
 }
 
+// Saves the back buffer, called after the frame is rendered
+void save_capture(int width, int height)
+{
+	size_t pitch = (size_t)width * 3;
+	u8 *pixels = (u8 *)tl_alloc(pitch * height + pitch);
+	u8 *tmp_row = pixels + pitch * height;
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+	// GL rows go bottom up
+	ito((u32)height / 2)
+	{
+		u8 *top = pixels + pitch * i;
+		u8 *bottom = pixels + pitch * (height - 1 - i);
+		memcpy(tmp_row, top, pitch);
+		memcpy(top, bottom, pitch);
+		memcpy(bottom, tmp_row, pitch);
+	}
+	if (write_image_2d_i24_png("capture.png", pixels, (u32)pitch, width, height))
+		Scene::get_scene()->push_debug_message("Capture saved to capture.png");
+	else
+		Scene::get_scene()->push_error("Failed to write capture.png");
+	tl_free(pixels);
+}
+
 SDL_Window *window = NULL;
 SDL_GLContext              glc;
 int                        SCREEN_WIDTH, SCREEN_HEIGHT;
@@ -89,8 +113,8 @@ void Context2D::imcanvas_start()
 		{
 			if (ImGui::BeginPopup("add_node_popup"))
 			{
-				char const **ptr = NULL;
-				u32          count = 0;
+				char const *const *ptr = NULL;
+				u32                count = 0;
 				Scene::get_scene()->get_node_type_list(&ptr, &count);
 				ito(count)
 				{
@@ -159,163 +183,207 @@ void Context2D::imcanvas_start()
 }
 void Context2D::imcanvas_end() { ImGui::End(); }
 
-// Usage:
-//  static ExampleAppLog my_log;
-//  my_log.AddLog("Hello %d world\n", 123);
-//  my_log.Draw("title");
-struct ExampleAppLog
+// Lines drained from the log ring, filtered by severity and text
+struct Log_Window
 {
-	ImGuiTextBuffer Buf;
-	ImGuiTextFilter Filter;
-	ImVector<int>   LineOffsets; // Index to lines offset. We maintain this with AddLog() calls.
-	bool            AutoScroll;  // Keep scrolling if already at the bottom.
-
-	ExampleAppLog()
-	{
-		AutoScroll = true;
-		Clear();
-	}
-
-	void Clear()
-	{
-		Buf.clear();
-		LineOffsets.clear();
-		LineOffsets.push_back(0);
-	}
-
-	void AddLog(const char *fmt, ...) IM_FMTARGS(2)
-	{
-		int     old_size = Buf.size();
-		va_list args;
-		va_start(args, fmt);
-		Buf.appendfv(fmt, args);
-		va_end(args);
-		for (int new_size = Buf.size(); old_size < new_size; old_size++)
-			if (Buf[old_size] == '\n') LineOffsets.push_back(old_size + 1);
-	}
+	ImGuiTextFilter filter;
+	bool            auto_scroll = true;
+	bool            show[LOG_NUM_SEVERITIES] = {true, true, true};
 
-	void AddLog(const char *fmt, va_list args)
+	void draw(const char *title)
 	{
-		int old_size = Buf.size();
-		Buf.appendfv(fmt, args);
-		for (int new_size = Buf.size(); old_size < new_size; old_size++)
-			if (Buf[old_size] == '\n') LineOffsets.push_back(old_size + 1);
-	}
-
-	void Draw(const char *title, bool *p_open = NULL)
-	{
-		if (!ImGui::Begin(title, p_open))
+		log_drain();
+		if (!ImGui::Begin(title))
 		{
 			ImGui::End();
 			return;
 		}
-
-		// Options menu
+		static char const *severity_names[LOG_NUM_SEVERITIES] = {"DEBUG", "WARNING", "ERROR"};
 		if (ImGui::BeginPopup("Options"))
 		{
-			ImGui::Checkbox("Auto-scroll", &AutoScroll);
+			ImGui::Checkbox("Auto-scroll", &auto_scroll);
 			ImGui::EndPopup();
 		}
-
-		// Main window
 		if (ImGui::Button("Options")) ImGui::OpenPopup("Options");
 		ImGui::SameLine();
 		bool clear = ImGui::Button("Clear");
 		ImGui::SameLine();
 		bool copy = ImGui::Button("Copy");
+		u32  mask = 0;
+		ito(LOG_NUM_SEVERITIES)
+		{
+			char label[0x40];
+			snprintf(label, sizeof(label), "%s (%u)", severity_names[i], log_view_size(1u << i));
+			ImGui::SameLine();
+			ImGui::Checkbox(label, &show[i]);
+			if (show[i]) mask |= 1u << i;
+		}
 		ImGui::SameLine();
-		Filter.Draw("Filter", -100.0f);
+		filter.Draw("Filter", -100.0f);
+		u64 dropped = log_get_dropped();
+		if (dropped != 0) ImGui::Text("%llu messages dropped", (unsigned long long)dropped);
 
 		ImGui::Separator();
 		ImGui::BeginChild("scrolling", ImVec2(0, 0), false, ImGuiWindowFlags_HorizontalScrollbar);
-
-		if (clear) Clear();
+		if (clear) log_clear();
 		if (copy) ImGui::LogToClipboard();
 
 		ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
-		const char *buf = Buf.begin();
-		const char *buf_end = Buf.end();
-		if (Filter.IsActive())
+		tl_alloc_tmp_enter();
+		defer(tl_alloc_tmp_exit());
+		// The clipper needs random access, so a text filter gathers the matching lines first
+		u32  num_lines = mask == 0 ? 0 : log_view_size(mask);
+		u32 *matches   = NULL;
+		if (filter.IsActive() && num_lines != 0)
 		{
-			// In this example we don't use the clipper when Filter is enabled.
-			// This is because we don't have a random access on the result on our filter.
-			// A real application processing logs with ten of thousands of entries may want to store the
-			// result of search/filter.. especially if the filtering function is not trivial (e.g.
-			// reg-exp).
-			for (int line_no = 0; line_no < LineOffsets.Size; line_no++)
+			matches  = (u32 *)tl_alloc_tmp(sizeof(u32) * num_lines);
+			u32 kept = 0;
+			ito(num_lines)
 			{
-				const char *line_start = buf + LineOffsets[line_no];
-				const char *line_end =
-					(line_no + 1 < LineOffsets.Size) ? (buf + LineOffsets[line_no + 1] - 1) : buf_end;
-				if (Filter.PassFilter(line_start, line_end)) ImGui::TextUnformatted(line_start, line_end);
+				Log_Record const *record = log_view_get(mask, i);
+				if (filter.PassFilter(record->text, record->text + record->len)) matches[kept++] = i;
 			}
-		} else
+			num_lines = kept;
+		}
+		ImGuiListClipper clipper;
+		clipper.Begin((int)num_lines);
+		while (clipper.Step())
 		{
-			// The simplest and easy way to display the entire buffer:
-			//   ImGui::TextUnformatted(buf_begin, buf_end);
-			// And it'll just work. TextUnformatted() has specialization for large blob of text and will
-			// fast-forward to skip non-visible lines. Here we instead demonstrate using the clipper to
-			// only process lines that are within the visible area. If you have tens of thousands of items
-			// and their processing cost is non-negligible, coarse clipping them on your side is
-			// recommended. Using ImGuiListClipper requires
-			// - A) random access into your data
-			// - B) items all being the  same height,
-			// both of which we can handle since we an array pointing to the beginning of each line of
-			// text. When using the filter (in the block of code above) we don't have random access into
-			// the data to display anymore, which is why we don't use the clipper. Storing or skimming
-			// through the search result would make it possible (and would be recommended if you want to
-			// search through tens of thousands of entries).
-			ImGuiListClipper clipper;
-			clipper.Begin(LineOffsets.Size);
-			while (clipper.Step())
+			for (int line_no = clipper.DisplayStart; line_no < clipper.DisplayEnd; line_no++)
 			{
-				for (int line_no = clipper.DisplayStart; line_no < clipper.DisplayEnd; line_no++)
-				{
-					const char *line_start = buf + LineOffsets[line_no];
-					const char *line_end =
-						(line_no + 1 < LineOffsets.Size) ? (buf + LineOffsets[line_no + 1] - 1) : buf_end;
-					ImGui::TextUnformatted(line_start, line_end);
-				}
+				Log_Record const *record =
+					log_view_get(mask, matches != NULL ? matches[line_no] : (u32)line_no);
+				ImGui::Text("%10.3f [%s] %.*s", (double)record->time_ns * 1.0e-9,
+					    severity_names[(u32)record->severity], (int)record->len, record->text);
 			}
-			clipper.End();
 		}
+		clipper.End();
 		ImGui::PopStyleVar();
 
-		if (AutoScroll && ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) ImGui::SetScrollHereY(1.0f);
+		if (auto_scroll && ImGui::GetScrollY() >= ImGui::GetScrollMaxY()) ImGui::SetScrollHereY(1.0f);
 
 		ImGui::EndChild();
 		ImGui::End();
 	}
 };
-ExampleAppLog debug_log;
-void          Scene::push_warning(char const *fmt, ...)
+Log_Window log_window;
+void       Scene::push_warning(char const *fmt, ...)
 {
-	debug_log.AddLog("[WARNING] ");
 	va_list args;
 	va_start(args, fmt);
-	debug_log.AddLog(fmt, args);
+	log_pushv(Log_Severity::SEV_WARNING, fmt, args);
 	va_end(args);
-	debug_log.AddLog("\n");
 }
 void Scene::push_debug_message(char const *fmt, ...)
 {
-	debug_log.AddLog("[DEBUG] ");
 	va_list args;
 	va_start(args, fmt);
-	debug_log.AddLog(fmt, args);
+	log_pushv(Log_Severity::SEV_DEBUG, fmt, args);
 	va_end(args);
-	debug_log.AddLog("\n");
 }
 void Scene::push_error(char const *fmt, ...)
 {
-	debug_log.AddLog("[ERROR] ");
 	va_list args;
 	va_start(args, fmt);
-	debug_log.AddLog(fmt, args);
+	log_pushv(Log_Severity::SEV_ERROR, fmt, args);
 	va_end(args);
-	debug_log.AddLog("\n");
 }
 TextEditor editor;
+// Tail latency of the PERF_HIST_ADD samples, *_ns histograms are shown in milliseconds
+void draw_histograms()
+{
+	char const *names[0x40];
+	u32         count = perf_get_histogram_names(names, ARRAY_SIZE(names));
+	if (count == 0)
+	{
+		ImGui::Text("No samples, build with PERF_ENABLE");
+		return;
+	}
+	if (ImGui::Button("Reset"))
+		perf_reset_histograms();
+	ImGui::Columns(7, "histograms");
+	char const *headers[] = {"name", "count", "p50", "p99", "p99.9", "max", "mean"};
+	ito(ARRAY_SIZE(headers))
+	{
+		ImGui::Text("%s", headers[i]);
+		ImGui::NextColumn();
+	}
+	ImGui::Separator();
+	ito(count)
+	{
+		static Hdr_Histogram hist;
+		if (!perf_get_histogram(names[i], &hist))
+			continue;
+		size_t len   = strlen(names[i]);
+		bool   is_ns = len > 3 && strcmp(names[i] + len - 3, "_ns") == 0;
+		f64    scale = is_ns ? 1.0e-6 : 1.0;
+		ImGui::Text("%s", names[i]);
+		ImGui::NextColumn();
+		ImGui::Text("%lu", (unsigned long)hist.total);
+		ImGui::NextColumn();
+		f64 values[] = {(f64)hist.get_percentile(50.0), (f64)hist.get_percentile(99.0),
+										(f64)hist.get_percentile(99.9), (f64)hist.max, hist.get_mean()};
+		jto(ARRAY_SIZE(values))
+		{
+			ImGui::Text(is_ns ? "%.3f ms" : "%.0f", values[j] * scale);
+			ImGui::NextColumn();
+		}
+	}
+	ImGui::Columns(1);
+}
+
+// Per site statistics of the containers that use Tracking_Allocator
+void draw_allocations()
+{
+	bool enabled = alloc_tracking_is_enabled();
+	if (ImGui::Checkbox("Track allocations", &enabled))
+		alloc_tracking_enable(enabled);
+	ImGui::SameLine();
+	if (ImGui::Button("Reset"))
+		alloc_tracking_reset();
+	static Alloc_Site_Summary sites[0x40];
+	static u32                selected = UINT32_MAX;
+	u32 count = MIN(alloc_tracking_get_summaries(sites, ARRAY_SIZE(sites)), ARRAY_SIZE(sites));
+	ImGui::Columns(7, "allocations");
+	char const *headers[] = {"site", "allocs", "reallocs", "frees",
+													 "live blocks", "live bytes", "peak bytes"};
+	ito(ARRAY_SIZE(headers))
+	{
+		ImGui::Text("%s", headers[i]);
+		ImGui::NextColumn();
+	}
+	ImGui::Separator();
+	ito(count)
+	{
+		Alloc_Site_Summary &site = sites[i];
+		if (ImGui::Selectable(site.name, selected == i, ImGuiSelectableFlags_SpanAllColumns))
+			selected = selected == i ? UINT32_MAX : i;
+		ImGui::NextColumn();
+		u64 values[] = {site.num_allocs, site.num_reallocs, site.num_frees,
+										site.live_blocks, site.live_bytes, site.peak_bytes};
+		jto(ARRAY_SIZE(values))
+		{
+			ImGui::Text("%lu", (unsigned long)values[j]);
+			ImGui::NextColumn();
+		}
+	}
+	ImGui::Columns(1);
+	ImGui::Separator();
+	// The lifetime histogram is only copied for the selected site
+	static Alloc_Site_Stats stats;
+	if (selected != UINT32_MAX && alloc_tracking_get_site(selected, &stats))
+	{
+		Hdr_Histogram &hist = stats.lifetime_ns;
+		f64            max  = hist.total != 0 ? (f64)hist.max : 0.0;
+		ImGui::Text("%s block lifetime: %lu frees, p50 %.3f ms, p99 %.3f ms, max %.3f ms", stats.name,
+								(unsigned long)hist.total, (f64)hist.get_percentile(50.0) * 1.0e-6,
+								(f64)hist.get_percentile(99.0) * 1.0e-6, max * 1.0e-6);
+	}
+	else
+	{
+		ImGui::Text("Select a site for its block lifetimes");
+	}
+}
 #if __EMSCRIPTEN__
 void main_tick()
 {
@@ -334,6 +402,7 @@ int main_tick()
 
 	auto poll_events = [&]()
 	{
+		PERF_HIST_SCOPE("frame_ns");
 	#if __EMSCRIPTEN__
 		int fs;
 		emscripten_get_canvas_size(&SCREEN_WIDTH, &SCREEN_HEIGHT, &fs);
@@ -378,10 +447,34 @@ int main_tick()
 		{
 			dump_scene();
 		}
+		ImGui::SameLine();
+		static bool capture_requested = false;
+		if (ImGui::Button("Save capture"))
+		{
+			capture_requested = true;
+		}
+#ifdef PERF_ENABLE
+		ImGui::SameLine();
+		if (ImGui::Button("Save trace"))
+		{
+			if (perf_write_chrome_trace("trace.json"))
+				Scene::get_scene()->push_debug_message("Trace saved to trace.json");
+			else
+				Scene::get_scene()->push_error("Failed to write trace.json");
+		}
+#endif
 		ImGui::End();
 
 		ImGui::Begin("Log");
-		debug_log.Draw("Log");
+		log_window.draw("Log");
+		ImGui::End();
+
+		ImGui::Begin("Histograms");
+		draw_histograms();
+		ImGui::End();
+
+		ImGui::Begin("Allocations");
+		draw_allocations();
 		ImGui::End();
 
 		ImGui::Begin("Text Editor");
@@ -444,6 +537,11 @@ int main_tick()
 		ImGui::Render();
 		Scene::get_scene()->c2d.flush_rendering();
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		if (capture_requested)
+		{
+			save_capture(SCREEN_WIDTH, SCREEN_HEIGHT);
+			capture_requested = false;
+		}
 
 		if (io.ConfigFlags & ImGuiConfigFlags_ViewportsEnable)
 		{
@@ -625,6 +723,7 @@ DockSpace         ID=0xA086D808 Pos=743,240 Size=591,840 CentralNode=1 Selected=
 #undef main
 int main()
 {
+	jobs_init();
 #if __EMSCRIPTEN__
 	{
 		char const *source = R"(
@@ -707,14 +806,17 @@ void main() {
       )
     )
   )
-  (for i 1 (add (get_num_nodes) 1)
+  (for i 0 100
+    (let node_id (get_node_id (format "auto_node_%i_%i" i i)))
+    (remove_node node_id)
     (print
       (format
         "node: %i is_alive: %i"
-                i            (is_node_alive i)
+                node_id      (is_node_alive node_id)
       )
     )
   )
+  (print (format "num nodes: %i" (get_num_nodes)))
 )
 
 """)
@@ -764,14 +866,9 @@ void main() {
 		Scene::get_scene()->run_script("init");
 	}
 #else
+	if (Scene::get_scene()->load_source("init", "scene.lsp"))
 	{
-		tl_alloc_tmp_enter();
-		defer(tl_alloc_tmp_exit());
-		if (char const *src = read_file_tmp("scene.lsp"))
-		{
-			Scene::get_scene()->add_source("init", src);
-			Scene::get_scene()->run_script("init");
-		}
+		Scene::get_scene()->run_script("init");
 	}
 #endif
 	TextEditor::LanguageDefinition::CPlusPlus();
@@ -806,6 +903,7 @@ void main() {
 	SDL_GL_DeleteContext(glc);
 	SDL_DestroyWindow(window);
 	SDL_Quit();
+	jobs_release();
 
 	return 0;
 }
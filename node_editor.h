@@ -191,7 +191,10 @@ struct Context2D {
   u32  screen_height;
   int2 old_mpos{};
   bool hovered;
-  void consume_event(SDL_Event event);
+
+  // Bytes sent with glBufferData by the last render_stuff
+  size_t upload_bytes;
+  void   consume_event(SDL_Event event);
 };
 
 struct Node;
@@ -203,13 +206,15 @@ struct Scene {
   void consume_event(SDL_Event event);
   // called per frame
   void get_source_list(char const ***ptr, u32 *count);
-  void get_node_type_list(char const ***ptr, u32 *count);
+  void get_node_type_list(char const *const **ptr, u32 *count);
   // return long-lived reference
   char const *get_source(char const *name);
   // new_src: short-lived reference
   void          set_source(char const *name, char const *new_src);
   void          remove_source(char const *name);
   void          add_source(char const *name, char const *text);
+  // Maps the file at `path` as a source, returns false if it can't be opened
+  bool          load_source(char const *name, char const *path);
   void          reset();
   void          run_script(char const *src_name);
   string_ref    get_save_script();
@@ -221,7 +226,7 @@ struct Scene {
 
 #define PUSH_WARNING(fmt, ...) Scene::get_scene()->push_warning(fmt, __VA_ARGS__)
 #define PUSH_ERROR(fmt, ...) Scene::get_scene()->push_error(fmt, __VA_ARGS__)
-#define PUSH_DEBUG(fmt, ...) Scene::get_scene()->push_debug(fmt, __VA_ARGS__)
+#define PUSH_DEBUG(fmt, ...) Scene::get_scene()->push_debug_message(fmt, __VA_ARGS__)
 #define ASSERT_RETNULL(x)                                                                          \
   do {                                                                                             \
     if (!(x)) {                                                                                    \
@@ -9,36 +9,27 @@ enum class Node_t {
   GFX_PASS,
 };
 
-static char const *Node_Type_Name_Table[]{
+// Indexed by Node_t - 1
+static constexpr char const *Node_Type_Name_Table[] = {
     "Gfx/DrawCall",
     "Gfx/Pass",
-    NULL,
-};
-
-static Node_t Node_Type_Table[]{
-    Node_t::GFX_DRAW_CALL,
-    Node_t::GFX_PASS,
-    Node_t::UNKNOWN,
 };
+static constexpr Perfect_Hash<ARRAY_SIZE(Node_Type_Name_Table)> Node_Type_Hash{
+    Node_Type_Name_Table};
 
 static Node_t str_to_node_type(string_ref str) {
-  ito(ARRAY_SIZE(Node_Type_Name_Table)) {
-    if (Node_Type_Name_Table[i] == NULL) return Node_t::UNKNOWN;
-    if (str == stref_s(Node_Type_Name_Table[i])) {
-      return Node_Type_Table[i];
-    }
-  }
-  return Node_t::UNKNOWN;
+  i32 i = Node_Type_Hash.find(str);
+  return i < 0 ? Node_t::UNKNOWN : (Node_t)(i + 1);
+}
+
+static Node_t str_to_node_type(Atom atom) {
+  if (atom.is_null()) return Node_t::UNKNOWN;
+  return str_to_node_type(atom_str(atom));
 }
 
 static char const *node_type_to_str(Node_t type) {
-  ito(ARRAY_SIZE(Node_Type_Table)) {
-    if (Node_Type_Table[i] == Node_t::UNKNOWN) return "UNKNOWN";
-    if (type == Node_Type_Table[i]) {
-      return Node_Type_Name_Table[i];
-    }
-  }
-  return "UNKNOWN";
+  u32 i = (u32)type - 1;
+  return i < ARRAY_SIZE(Node_Type_Name_Table) ? Node_Type_Name_Table[i] : "UNKNOWN";
 }
 
 struct Node {
@@ -54,6 +45,7 @@ struct Node {
   // <------->
   //   size.x
   //
+  // Handle in NodeDB, zero for a released node
   u32    id;
   u32    num_in_slots;
   u32    num_out_slots;
@@ -71,7 +63,6 @@ struct Node {
            y < pos.y;
   }
   bool is_alive() { return id > 0; }
-  u32  get_index() { return id - 1; }
   void release() {
     memset(this, 0, sizeof(Node));
   }
@@ -1,308 +1,704 @@
 #include "utils.hpp"
 
-struct List {
-  string_ref symbol = {};
-  u64        id     = 0;
-  List *     child  = NULL;
-  List *     next   = NULL;
-  string_ref get_symbol() {
-    ASSERT_ALWAYS(nonempty());
-    return symbol;
-  }
-  bool nonempty() { return symbol.ptr != 0 && symbol.len != 0; }
-  bool cmp_symbol(char const *str) {
-    if (symbol.ptr == NULL) return false;
-    return symbol == stref_s(str);
+/** Kind of an Ast node
+  Bare tokens that start like a number are NUMBER and aren't interned, whether they parse as one
+  is up to the evaluator.
+ */
+enum class Ast_Kind : u8 { LIST = 0, SYMBOL, STRING, NUMBER };
+
+static constexpr u32 AST_NULL = 0xffffffffu;
+
+/** Flat syntax tree of a script
+  Node n is the n-th entry of parallel arrays that share one growable block. Tokens are offsets
+  into the source text which has to outlive the tree, lists span their parentheses. Node 0 is a
+  list of the top level forms, nodes are in source order so a list is followed by its subtree.
+ */
+struct Ast {
+  static constexpr size_t NODE_SIZE = 4 * sizeof(u32) + sizeof(Atom) + sizeof(u8);
+
+  string_ref text;
+  // The block starts at `offsets`
+  u32 * offsets;
+  u32 * lens;
+  u32 * first_child;
+  u32 * next_sibling;
+  // Set for SYMBOL nodes
+  Atom *atoms;
+  u8 *  kinds;
+  u32   size;
+  u32   capacity;
+
+  void init() { memset(this, 0, sizeof(*this)); }
+  void release() {
+    if (offsets != NULL) tl_free(offsets);
+    memset(this, 0, sizeof(*this));
   }
-  bool has_child(char const *name) { return child != NULL && child->cmp_symbol(name); }
-  template <typename T> void match_children(char const *name, T on_match) {
-    if (child != NULL) {
-      if (child->cmp_symbol(name)) {
-        on_match(child);
-      }
-      child->match_children(name, on_match);
-    }
-    if (next != NULL) {
-      next->match_children(name, on_match);
+  void reserve(u32 new_capacity) {
+    if (new_capacity <= capacity) return;
+    Ast old      = *this;
+    u8 *block    = (u8 *)tl_alloc((size_t)new_capacity * NODE_SIZE);
+    offsets      = (u32 *)block;
+    lens         = offsets + new_capacity;
+    first_child  = lens + new_capacity;
+    next_sibling = first_child + new_capacity;
+    atoms        = (Atom *)(next_sibling + new_capacity);
+    kinds        = (u8 *)(atoms + new_capacity);
+    capacity     = new_capacity;
+    if (old.offsets != NULL) {
+      memcpy(offsets, old.offsets, sizeof(u32) * size);
+      memcpy(lens, old.lens, sizeof(u32) * size);
+      memcpy(first_child, old.first_child, sizeof(u32) * size);
+      memcpy(next_sibling, old.next_sibling, sizeof(u32) * size);
+      memcpy(atoms, old.atoms, sizeof(Atom) * size);
+      memcpy(kinds, old.kinds, size);
+      tl_free(old.offsets);
     }
   }
-  List *get(u32 i) {
-    List *cur = this;
-    while (i != 0) {
-      if (cur == NULL) return NULL;
-      cur = cur->next;
+  u32 add(Ast_Kind kind, u32 offset, u32 len) {
+    if (size == capacity) reserve(MAX(capacity + (capacity >> 1), 0x100u));
+    u32 n           = size++;
+    offsets[n]      = offset;
+    lens[n]         = len;
+    first_child[n]  = AST_NULL;
+    next_sibling[n] = AST_NULL;
+    atoms[n]        = {};
+    kinds[n]        = (u8)kind;
+    return n;
+  }
+  Ast_Kind   kind(u32 n) const { return (Ast_Kind)kinds[n]; }
+  string_ref token(u32 n) const { return string_ref{text.ptr + offsets[n], lens[n]}; }
+  bool       cmp_symbol(u32 n, Atom a) const {
+    return n != AST_NULL && !atoms[n].is_null() && atoms[n] == a;
+  }
+  /** I-th child of `n` or AST_NULL
+   */
+  u32 child(u32 n, u32 i) const {
+    u32 cur = first_child[n];
+    while (i != 0 && cur != AST_NULL) {
+      cur = next_sibling[cur];
       i -= 1;
     }
     return cur;
   }
 
-  int ATTR_USED dump(u32 indent = 0) const {
+  int ATTR_USED dump(u32 n = 0, u32 indent = 0) const {
     ito(indent) fprintf(stdout, " ");
-    if (symbol.ptr != NULL) {
-      fprintf(stdout, "%.*s\n", (i32)symbol.len, symbol.ptr);
-    } else {
+    if (kind(n) == Ast_Kind::LIST) {
       fprintf(stdout, "$\n");
+    } else {
+      fprintf(stdout, "%.*s\n", (i32)lens[n], text.ptr + offsets[n]);
     }
-    if (child != NULL) {
-      child->dump(indent + 2);
-    }
-    if (next != NULL) {
-      next->dump(indent);
-    }
+    for (u32 cur = first_child[n]; cur != AST_NULL; cur = next_sibling[cur]) dump(cur, indent + 2);
     fflush(stdout);
     return 0;
   }
-  void dump_list_graph() {
-    List *root     = this;
-    FILE *dotgraph = fopen("list.dot", "wb");
+  void dump_graph(char const *path = "ast.dot") const {
+    FILE *dotgraph = fopen(path, "wb");
+    if (dotgraph == NULL) return;
     fprintf(dotgraph, "digraph {\n");
     fprintf(dotgraph, "node [shape=record];\n");
-    tl_alloc_tmp_enter();
-    defer(tl_alloc_tmp_exit());
-    List **stack        = (List **)tl_alloc_tmp(sizeof(List *) * (1 << 10));
-    u32    stack_cursor = 0;
-    List * cur          = root;
-    u64    null_id      = 0xffffffffull;
-    while (cur != NULL || stack_cursor != 0) {
-      if (cur == NULL) {
-        cur = stack[--stack_cursor];
-      }
-      ASSERT_ALWAYS(cur != NULL);
-      if (cur->symbol.ptr != NULL) {
-        ASSERT_ALWAYS(cur->symbol.len != 0);
-        fprintf(dotgraph, "%lu [label = \"%.*s\", shape = record];\n", cur->id,
-                (int)cur->symbol.len, cur->symbol.ptr);
-      } else {
-        fprintf(dotgraph, "%lu [label = \"$\", shape = record, color=red];\n", cur->id);
-      }
-      if (cur->next == NULL) {
-        fprintf(dotgraph, "%lu [label = \"nil\", shape = record, color=blue];\n", null_id);
-        fprintf(dotgraph, "%lu -> %lu [label = \"next\"];\n", cur->id, null_id);
-        null_id++;
-      } else
-        fprintf(dotgraph, "%lu -> %lu [label = \"next\"];\n", cur->id, cur->next->id);
-
-      if (cur->child != NULL) {
-        if (cur->next != NULL) stack[stack_cursor++] = cur->next;
-        fprintf(dotgraph, "%lu -> %lu [label = \"child\"];\n", cur->id, cur->child->id);
-        cur = cur->child;
+    ito(size) {
+      if (kinds[i] == (u8)Ast_Kind::LIST) {
+        fprintf(dotgraph, "%u [label = \"$\", shape = record, color=red];\n", (u32)i);
       } else {
-        cur = cur->next;
+        fprintf(dotgraph, "%u [label = \"%.*s\", shape = record];\n", (u32)i, (int)lens[i],
+                text.ptr + offsets[i]);
       }
+      if (first_child[i] != AST_NULL)
+        fprintf(dotgraph, "%u -> %u [label = \"child\"];\n", (u32)i, first_child[i]);
+      if (next_sibling[i] != AST_NULL)
+        fprintf(dotgraph, "%u -> %u [label = \"next\"];\n", (u32)i, next_sibling[i]);
     }
     fprintf(dotgraph, "}\n");
     fflush(dotgraph);
     fclose(dotgraph);
   }
-  template <typename T> static List *parse(string_ref text, T allocator) {
-    List *root = allocator.alloc();
-    List *cur  = root;
-    TMP_STORAGE_SCOPE;
-    List **stack        = (List **)tl_alloc_tmp(sizeof(List *) * (1 << 8));
-    u32    stack_cursor = 0;
-    enum class State : char {
-      UNDEFINED = 0,
-      SAW_QUOTE,
-      SAW_LPAREN,
-      SAW_RPAREN,
-      SAW_PRINTABLE,
-      SAW_SEPARATOR,
-    };
-    u32   i  = 0;
-    u64   id = 1;
-    State state_table[0x100];
-    memset(state_table, 0, sizeof(state_table));
-    for (u8 j = 0x20; j <= 0x7f; j++) state_table[j] = State::SAW_PRINTABLE;
-    state_table[(u32)'(']  = State::SAW_LPAREN;
-    state_table[(u32)')']  = State::SAW_RPAREN;
-    state_table[(u32)'"']  = State::SAW_QUOTE;
-    state_table[(u32)' ']  = State::SAW_SEPARATOR;
-    state_table[(u32)'\n'] = State::SAW_SEPARATOR;
-    state_table[(u32)'\t'] = State::SAW_SEPARATOR;
-    state_table[(u32)'\r'] = State::SAW_SEPARATOR;
 
-    auto next_item = [&]() {
-      List *next = allocator.alloc();
-      next->id   = id++;
-      if (cur != NULL) cur->next = next;
-      cur = next;
+  /** Replaces the tree with the one of `text`, false on a syntax error
+    Unbalanced parentheses, unterminated strings and bytes outside of printable ASCII are
+    errors, the tree is empty after one. Nesting depth is only limited by the text.
+   */
+  bool parse(string_ref text) {
+    PERF_SCOPE("Ast::parse");
+    ASSERT_ALWAYS(text.len < AST_NULL);
+    this->text = text;
+    size       = 0;
+    u32 len    = (u32)text.len;
+    // Open lists hold their parent in next_sibling until the ')', the root's is AST_NULL
+    u32  open   = add(Ast_Kind::LIST, 0, len);
+    u32  last   = AST_NULL;
+    auto append = [&](u32 n) {
+      if (last == AST_NULL)
+        first_child[open] = n;
+      else
+        next_sibling[last] = n;
+      last = n;
     };
-
-    auto push_item = [&]() {
-      List *new_head = allocator.alloc();
-      new_head->id   = id++;
-      if (cur != NULL) {
-        stack[stack_cursor++] = cur;
-        cur->child            = new_head;
+    u32 i = 0;
+    while (i < len) {
+      u8 c = (u8)text.ptr[i];
+      if (c == ' ' || c == '\n' || c == '\t' || c == '\r') {
+        i += 1;
+      } else if (c == '(') {
+        u32 n = add(Ast_Kind::LIST, i, 0);
+        append(n);
+        next_sibling[n] = open;
+        open            = n;
+        last            = AST_NULL;
+        i += 1;
+      } else if (c == ')') {
+        if (open == 0) goto error_parsing;
+        lens[open]         = i + 1 - offsets[open];
+        u32 parent         = next_sibling[open];
+        next_sibling[open] = AST_NULL;
+        last               = open;
+        open               = parent;
+        i += 1;
+      } else if (c == '"') {
+        // Triple quoted strings hold whole shaders, their end is found with a single search
+        bool triple = i + 2 < len && text.ptr[i + 1] == '"' && text.ptr[i + 2] == '"';
+        u32  begin  = triple ? i + 3 : i + 1;
+        i32  end    = triple ? stref_find(text, stref_s("\"\"\""), begin)
+                             : stref_find_char(text, '"', begin);
+        if (end < 0) goto error_parsing;
+        append(add(Ast_Kind::STRING, begin, (u32)end - begin));
+        i = (u32)end + (triple ? 3 : 1);
+      } else if (c > ' ' && c <= 0x7f) {
+        u32 begin = i;
+        // Anything else ends a bare token, bytes that aren't allowed fail on the next iteration
+        while (i < len) {
+          u8 next = (u8)text.ptr[i];
+          if (next <= ' ' || next > 0x7f || next == '(' || next == ')' || next == '"') break;
+          i += 1;
+        }
+        bool     number = (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.';
+        Ast_Kind kind   = number ? Ast_Kind::NUMBER : Ast_Kind::SYMBOL;
+        u32      n      = add(kind, begin, i - begin);
+        if (!number) atoms[n] = intern(token(n));
+        append(n);
+      } else {
+        goto error_parsing;
       }
-      cur = new_head;
-    };
+    }
+    if (open != 0) goto error_parsing;
+    return true;
+  error_parsing:
+    size = 0;
+    return false;
+  }
+};
 
-    auto pop_item = [&]() -> bool {
-      if (stack_cursor == 0) {
-        return false;
-      }
-      cur = stack[--stack_cursor];
-      return true;
-    };
+// Numbers
 
-    auto append_char = [&]() {
-      if (cur->symbol.ptr == NULL) { // first character for that item
-        cur->symbol.ptr = text.ptr + i;
-      }
-      cur->symbol.len++;
-    };
+// Eight ASCII digits loaded as a little endian u64
+static inline bool is_eight_digits(u64 chunk) {
+  return (((chunk & 0xf0f0f0f0f0f0f0f0ull) |
+           (((chunk + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4)) ==
+          0x3333333333333333ull);
+}
 
-    auto cur_non_empty = [&]() { return cur != NULL && cur->symbol.len != 0; };
-    auto cur_has_child = [&]() { return cur != NULL && cur->child != NULL; };
+// SWAR: pairs of digits, then pairs of pairs, then the two halves
+static inline u32 parse_eight_digits(u64 chunk) {
+  u64 const mask = 0x000000ff000000ffull;
+  u64 const mul1 = 100 + (1000000ull << 32);
+  u64 const mul2 = 1 + (10000ull << 32);
+  chunk -= 0x3030303030303030ull;
+  chunk = (chunk * 10) + (chunk >> 8);
+  chunk = (((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32;
+  return (u32)chunk;
+}
 
-    i                = 0;
-    State prev_state = State::UNDEFINED;
-    while (i < text.len) {
-      char  c     = text.ptr[i];
-      State state = state_table[(u8)c];
-      switch (state) {
-      case State::UNDEFINED: {
-        goto error_parsing;
-      }
-      case State::SAW_QUOTE: {
-        if (cur_non_empty() || cur_has_child()) next_item();
-        if (text.ptr[i + 1] == '"' && text.ptr[i + 2] == '"') {
-          i += 3;
-          while (
-            text.ptr[i + 0] != '"' || //
-            text.ptr[i + 1] != '"' || //
-            text.ptr[i + 2] != '"'
-          ) {
-            append_char();
-            i += 1;
-          }
-          i += 2;
-        } else {
-          i += 1;
-          while (text.ptr[i] != '"') {
-            append_char();
-            i += 1;
-          }
+/** [+-]digits, false on anything else or when the value doesn't fit into i32
+ */
+static inline bool parse_decimal_int(char const *str, size_t len, int32_t *result) {
+  size_t i        = 0;
+  bool   negative = false;
+  if (len != 0 && (str[0] == '-' || str[0] == '+')) {
+    negative = str[0] == '-';
+    i        = 1;
+  }
+  if (i == len) return false;
+  // Leading zeros don't count towards the 10 digits
+  while (i + 1 < len && str[i] == '0') i++;
+  if (len - i > 10) return false;
+  u64 value = 0;
+  if (len - i >= 8) {
+    u64 chunk;
+    memcpy(&chunk, str + i, 8);
+    if (!is_eight_digits(chunk)) return false;
+    value = parse_eight_digits(chunk);
+    i += 8;
+  }
+  for (; i < len; i++) {
+    u32 digit = (u32)(u8)str[i] - '0';
+    if (digit > 9) return false;
+    value = value * 10 + digit;
+  }
+  if (value > (u64)INT32_MAX + (negative ? 1 : 0)) return false;
+  *result = (int32_t)(negative ? -(i64)value : (i64)value);
+  return true;
+}
+
+// 128 bit truncated significands of 5^q for q in [-64, 38], high word first
+static u64 const F32_POW5_128[206] = {
+    0xa87fea27a539e9a5ull, 0x3f2398d747b36224ull,
+    0xd29fe4b18e88640eull, 0x8eec7f0d19a03aadull,
+    0x83a3eeeef9153e89ull, 0x1953cf68300424acull,
+    0xa48ceaaab75a8e2bull, 0x5fa8c3423c052dd7ull,
+    0xcdb02555653131b6ull, 0x3792f412cb06794dull,
+    0x808e17555f3ebf11ull, 0xe2bbd88bbee40bd0ull,
+    0xa0b19d2ab70e6ed6ull, 0x5b6aceaeae9d0ec4ull,
+    0xc8de047564d20a8bull, 0xf245825a5a445275ull,
+    0xfb158592be068d2eull, 0xeed6e2f0f0d56712ull,
+    0x9ced737bb6c4183dull, 0x55464dd69685606bull,
+    0xc428d05aa4751e4cull, 0xaa97e14c3c26b886ull,
+    0xf53304714d9265dfull, 0xd53dd99f4b3066a8ull,
+    0x993fe2c6d07b7fabull, 0xe546a8038efe4029ull,
+    0xbf8fdb78849a5f96ull, 0xde98520472bdd033ull,
+    0xef73d256a5c0f77cull, 0x963e66858f6d4440ull,
+    0x95a8637627989aadull, 0xdde7001379a44aa8ull,
+    0xbb127c53b17ec159ull, 0x5560c018580d5d52ull,
+    0xe9d71b689dde71afull, 0xaab8f01e6e10b4a6ull,
+    0x9226712162ab070dull, 0xcab3961304ca70e8ull,
+    0xb6b00d69bb55c8d1ull, 0x3d607b97c5fd0d22ull,
+    0xe45c10c42a2b3b05ull, 0x8cb89a7db77c506aull,
+    0x8eb98a7a9a5b04e3ull, 0x77f3608e92adb242ull,
+    0xb267ed1940f1c61cull, 0x55f038b237591ed3ull,
+    0xdf01e85f912e37a3ull, 0x6b6c46dec52f6688ull,
+    0x8b61313bbabce2c6ull, 0x2323ac4b3b3da015ull,
+    0xae397d8aa96c1b77ull, 0xabec975e0a0d081aull,
+    0xd9c7dced53c72255ull, 0x96e7bd358c904a21ull,
+    0x881cea14545c7575ull, 0x7e50d64177da2e54ull,
+    0xaa242499697392d2ull, 0xdde50bd1d5d0b9e9ull,
+    0xd4ad2dbfc3d07787ull, 0x955e4ec64b44e864ull,
+    0x84ec3c97da624ab4ull, 0xbd5af13bef0b113eull,
+    0xa6274bbdd0fadd61ull, 0xecb1ad8aeacdd58eull,
+    0xcfb11ead453994baull, 0x67de18eda5814af2ull,
+    0x81ceb32c4b43fcf4ull, 0x80eacf948770ced7ull,
+    0xa2425ff75e14fc31ull, 0xa1258379a94d028dull,
+    0xcad2f7f5359a3b3eull, 0x096ee45813a04330ull,
+    0xfd87b5f28300ca0dull, 0x8bca9d6e188853fcull,
+    0x9e74d1b791e07e48ull, 0x775ea264cf55347eull,
+    0xc612062576589ddaull, 0x95364afe032a819eull,
+    0xf79687aed3eec551ull, 0x3a83ddbd83f52205ull,
+    0x9abe14cd44753b52ull, 0xc4926a9672793543ull,
+    0xc16d9a0095928a27ull, 0x75b7053c0f178294ull,
+    0xf1c90080baf72cb1ull, 0x5324c68b12dd6339ull,
+    0x971da05074da7beeull, 0xd3f6fc16ebca5e04ull,
+    0xbce5086492111aeaull, 0x88f4bb1ca6bcf585ull,
+    0xec1e4a7db69561a5ull, 0x2b31e9e3d06c32e6ull,
+    0x9392ee8e921d5d07ull, 0x3aff322e62439fd0ull,
+    0xb877aa3236a4b449ull, 0x09befeb9fad487c3ull,
+    0xe69594bec44de15bull, 0x4c2ebe687989a9b4ull,
+    0x901d7cf73ab0acd9ull, 0x0f9d37014bf60a11ull,
+    0xb424dc35095cd80full, 0x538484c19ef38c95ull,
+    0xe12e13424bb40e13ull, 0x2865a5f206b06fbaull,
+    0x8cbccc096f5088cbull, 0xf93f87b7442e45d4ull,
+    0xafebff0bcb24aafeull, 0xf78f69a51539d749ull,
+    0xdbe6fecebdedd5beull, 0xb573440e5a884d1cull,
+    0x89705f4136b4a597ull, 0x31680a88f8953031ull,
+    0xabcc77118461cefcull, 0xfdc20d2b36ba7c3eull,
+    0xd6bf94d5e57a42bcull, 0x3d32907604691b4dull,
+    0x8637bd05af6c69b5ull, 0xa63f9a49c2c1b110ull,
+    0xa7c5ac471b478423ull, 0x0fcf80dc33721d54ull,
+    0xd1b71758e219652bull, 0xd3c36113404ea4a9ull,
+    0x83126e978d4fdf3bull, 0x645a1cac083126eaull,
+    0xa3d70a3d70a3d70aull, 0x3d70a3d70a3d70a4ull,
+    0xccccccccccccccccull, 0xcccccccccccccccdull,
+    0x8000000000000000ull, 0x0000000000000000ull,
+    0xa000000000000000ull, 0x0000000000000000ull,
+    0xc800000000000000ull, 0x0000000000000000ull,
+    0xfa00000000000000ull, 0x0000000000000000ull,
+    0x9c40000000000000ull, 0x0000000000000000ull,
+    0xc350000000000000ull, 0x0000000000000000ull,
+    0xf424000000000000ull, 0x0000000000000000ull,
+    0x9896800000000000ull, 0x0000000000000000ull,
+    0xbebc200000000000ull, 0x0000000000000000ull,
+    0xee6b280000000000ull, 0x0000000000000000ull,
+    0x9502f90000000000ull, 0x0000000000000000ull,
+    0xba43b74000000000ull, 0x0000000000000000ull,
+    0xe8d4a51000000000ull, 0x0000000000000000ull,
+    0x9184e72a00000000ull, 0x0000000000000000ull,
+    0xb5e620f480000000ull, 0x0000000000000000ull,
+    0xe35fa931a0000000ull, 0x0000000000000000ull,
+    0x8e1bc9bf04000000ull, 0x0000000000000000ull,
+    0xb1a2bc2ec5000000ull, 0x0000000000000000ull,
+    0xde0b6b3a76400000ull, 0x0000000000000000ull,
+    0x8ac7230489e80000ull, 0x0000000000000000ull,
+    0xad78ebc5ac620000ull, 0x0000000000000000ull,
+    0xd8d726b7177a8000ull, 0x0000000000000000ull,
+    0x878678326eac9000ull, 0x0000000000000000ull,
+    0xa968163f0a57b400ull, 0x0000000000000000ull,
+    0xd3c21bcecceda100ull, 0x0000000000000000ull,
+    0x84595161401484a0ull, 0x0000000000000000ull,
+    0xa56fa5b99019a5c8ull, 0x0000000000000000ull,
+    0xcecb8f27f4200f3aull, 0x0000000000000000ull,
+    0x813f3978f8940984ull, 0x4000000000000000ull,
+    0xa18f07d736b90be5ull, 0x5000000000000000ull,
+    0xc9f2c9cd04674edeull, 0xa400000000000000ull,
+    0xfc6f7c4045812296ull, 0x4d00000000000000ull,
+    0x9dc5ada82b70b59dull, 0xf020000000000000ull,
+    0xc5371912364ce305ull, 0x6c28000000000000ull,
+    0xf684df56c3e01bc6ull, 0xc732000000000000ull,
+    0x9a130b963a6c115cull, 0x3c7f400000000000ull,
+    0xc097ce7bc90715b3ull, 0x4b9f100000000000ull,
+    0xf0bdc21abb48db20ull, 0x1e86d40000000000ull,
+    0x96769950b50d88f4ull, 0x1314448000000000ull,
+};
+
+/** Eisel-Lemire: bits of the float closest to w * 10^q, sign excluded
+  The product with the 128 bit power of five is always precise enough for a u64 `w`.
+ */
+static inline u32 f32_from_decimal(u64 w, i64 q) {
+  if (w == 0 || q < -64) return 0;
+  if (q > 38) return 0x7f800000;
+  u32 lz = clz64(w);
+  w <<= lz;
+  u64 const *pow5 = F32_POW5_128 + 2 * (q + 64);
+  u64        lo, hi;
+  hash_mul128(w, pow5[0], &lo, &hi);
+  // Only the top 26 bits are used, the low word matters when they're followed by all ones
+  u64 const precision_mask = ~0ull >> 26;
+  if ((hi & precision_mask) == precision_mask) {
+    u64 lo2, hi2;
+    hash_mul128(w, pow5[1], &lo2, &hi2);
+    lo += hi2;
+    if (hi2 > lo) hi++;
+  }
+  u32 upperbit = (u32)(hi >> 63);
+  u32 shift    = upperbit + 64 - 23 - 3;
+  u64 mantissa = hi >> shift;
+  // floor(log2(10^q)) + 63, then the float bias
+  i32 power2 = (i32)((((152170 + 65536) * (i32)q) >> 16) + 63) + (i32)upperbit - (i32)lz + 127;
+  if (power2 <= 0) {
+    // Subnormal, may round up to the smallest normal
+    if (-power2 + 1 >= 64) return 0;
+    mantissa >>= -power2 + 1;
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    power2 = mantissa < (1u << 23) ? 0 : 1;
+    return ((u32)power2 << 23) | (u32)(mantissa & ((1u << 23) - 1));
+  }
+  // Exactly halfway between two floats, round to even
+  if (lo <= 1 && q >= -17 && q <= 10 && (mantissa & 3) == 1 && (mantissa << shift) == hi)
+    mantissa &= ~1ull;
+  mantissa += mantissa & 1;
+  mantissa >>= 1;
+  if (mantissa >= (2ull << 23)) {
+    mantissa = 1ull << 23;
+    power2++;
+  }
+  if (power2 >= 0xff) return 0x7f800000;
+  return ((u32)power2 << 23) | (u32)(mantissa & ((1u << 23) - 1));
+}
+
+/** [+-]digits[.digits][(e|E)[+-]digits], correctly rounded
+  Up to 19 significant digits are kept, small ones go through exact float arithmetic, the rest
+  through f32_from_decimal. Longer inputs that land between two floats fall back to strtof.
+ */
+static inline bool parse_float(char const *str, size_t len, float *result) {
+  size_t i        = 0;
+  bool   negative = false;
+  if (len != 0 && (str[0] == '-' || str[0] == '+')) {
+    negative = str[0] == '-';
+    i        = 1;
+  }
+  u64  w          = 0;
+  i64  exp10      = 0;
+  u32  num_digits = 0;
+  bool truncated  = false;
+  auto consume_digits = [&](bool fraction) {
+    size_t begin = i;
+    while (i < len) {
+      // Eight at a time once past the leading zeros
+      if (w != 0 && num_digits + 8 <= 19 && i + 8 <= len) {
+        u64 chunk;
+        memcpy(&chunk, str + i, 8);
+        if (is_eight_digits(chunk)) {
+          w = w * 100000000 + parse_eight_digits(chunk);
+          num_digits += 8;
+          if (fraction) exp10 -= 8;
+          i += 8;
+          continue;
         }
-        next_item();
-        break;
-      }
-      case State::SAW_LPAREN: {
-        if (cur_has_child() || cur_non_empty()) next_item();
-        push_item();
-        break;
-      }
-      case State::SAW_RPAREN: {
-        if (pop_item() == false) goto exit_loop;
-        break;
-      }
-      case State::SAW_SEPARATOR: {
-        //      if (cur_non_empty()) next_item();
-        break;
-      }
-      case State::SAW_PRINTABLE: {
-        if (cur_has_child()) next_item();
-        if (cur_non_empty() && prev_state != State::SAW_PRINTABLE) next_item();
-        append_char();
-        break;
       }
+      u32 digit = (u32)(u8)str[i] - '0';
+      if (digit > 9) break;
+      if (num_digits < 19) {
+        w = w * 10 + digit;
+        if (w != 0) num_digits++;
+        if (fraction) exp10--;
+      } else {
+        if (!fraction) exp10++;
+        if (digit != 0) truncated = true;
       }
-      prev_state = state;
-      i += 1;
+      i++;
     }
-  exit_loop:
-    (void)0;
-    return root;
-  error_parsing:
-    allocator.reset();
-    return NULL;
+    return i != begin;
+  };
+  bool has_digits = consume_digits(false);
+  if (i < len && str[i] == '.') {
+    i++;
+    has_digits |= consume_digits(true);
   }
+  if (!has_digits) return false;
+  if (i < len && (str[i] == 'e' || str[i] == 'E')) {
+    i++;
+    bool negative_exp = false;
+    if (i < len && (str[i] == '-' || str[i] == '+')) {
+      negative_exp = str[i] == '-';
+      i++;
+    }
+    size_t begin = i;
+    i64    exp   = 0;
+    for (; i < len && (u32)(u8)str[i] - '0' <= 9; i++) {
+      if (exp < 100000) exp = exp * 10 + (str[i] - '0');
+    }
+    if (i == begin) return false;
+    exp10 += negative_exp ? -exp : exp;
+  }
+  if (i != len) return false;
+  float value;
+  // Both operands are exact, the single operation rounds correctly
+  static float const exact_pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+                                      1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+  if (!truncated && exp10 >= -10 && exp10 <= 10 && w <= (1u << 24)) {
+    value = (float)w;
+    value = exp10 < 0 ? value / exact_pow10[-exp10] : value * exact_pow10[exp10];
+  } else {
+    u32 bits = f32_from_decimal(w, exp10);
+    // The dropped digits lie between w and w + 1
+    if (truncated && bits != f32_from_decimal(w + 1, exp10)) {
+      TMP_STORAGE_SCOPE;
+      value = strtof(stref_to_tmp_cstr(string_ref{str, len}), NULL);
+      *result = value;
+      return true;
+    }
+    memcpy(&value, &bits, 4);
+  }
+  *result = negative ? -value : value;
+  return true;
+}
+
+// Ryu tables: 2^k / 5^q rounded up and 5^q, both normalized to 59 and 61 bits
+static u64 const F32_POW5_INV_SPLIT[31] = {
+    0x0800000000000001ull, 0x0666666666666667ull, 0x051eb851eb851eb9ull,
+    0x04189374bc6a7efaull, 0x068db8bac710cb2aull, 0x053e2d6238da3c22ull,
+    0x0431bde82d7b634eull, 0x06b5fca6af2bd216ull, 0x055e63b88c230e78ull,
+    0x044b82fa09b5a52dull, 0x06df37f675ef6eaeull, 0x057f5ff85e592558ull,
+    0x0465e6604b7a8447ull, 0x0709709a125da071ull, 0x05a126e1a84ae6c1ull,
+    0x0480ebe7b9d58567ull, 0x0734aca5f6226f0bull, 0x05c3bd5191b525a3ull,
+    0x049c97747490eae9ull, 0x0760f253edb4ab0eull, 0x05e72843249088d8ull,
+    0x04b8ed0283a6d3e0ull, 0x078e480405d7b966ull, 0x060b6cd004ac9452ull,
+    0x04d5f0a66a23a9dbull, 0x07bcb43d769f762bull, 0x063090312bb2c4efull,
+    0x04f3a68dbc8f03f3ull, 0x07ec3daf94180651ull, 0x065697bfa9acd1daull,
+    0x051212ffbaf0a7e2ull,
+};
+static u64 const F32_POW5_SPLIT[48] = {
+    0x1000000000000000ull, 0x1400000000000000ull, 0x1900000000000000ull,
+    0x1f40000000000000ull, 0x1388000000000000ull, 0x186a000000000000ull,
+    0x1e84800000000000ull, 0x1312d00000000000ull, 0x17d7840000000000ull,
+    0x1dcd650000000000ull, 0x12a05f2000000000ull, 0x174876e800000000ull,
+    0x1d1a94a200000000ull, 0x12309ce540000000ull, 0x16bcc41e90000000ull,
+    0x1c6bf52634000000ull, 0x11c37937e0800000ull, 0x16345785d8a00000ull,
+    0x1bc16d674ec80000ull, 0x1158e460913d0000ull, 0x15af1d78b58c4000ull,
+    0x1b1ae4d6e2ef5000ull, 0x10f0cf064dd59200ull, 0x152d02c7e14af680ull,
+    0x1a784379d99db420ull, 0x108b2a2c28029094ull, 0x14adf4b7320334b9ull,
+    0x19d971e4fe8401e7ull, 0x1027e72f1f128130ull, 0x1431e0fae6d7217cull,
+    0x193e5939a08ce9dbull, 0x1f8def8808b02452ull, 0x13b8b5b5056e16b3ull,
+    0x18a6e32246c99c60ull, 0x1ed09bead87c0378ull, 0x13426172c74d822bull,
+    0x1812f9cf7920e2b6ull, 0x1e17b84357691b64ull, 0x12ced32a16a1b11eull,
+    0x178287f49c4a1d66ull, 0x1d6329f1c35ca4bfull, 0x125dfa371a19e6f7ull,
+    0x16f578c4e0a060b5ull, 0x1cb2d6f618c878e3ull, 0x11efc659cf7d4b8dull,
+    0x166bb7f0435c9e71ull, 0x1c06a5ec5433c60dull, 0x118427b3b4a05bc8ull,
 };
 
-static inline bool parse_decimal_int(char const *str, size_t len, int32_t *result) {
-  int32_t  final = 0;
-  int32_t  pow   = 1;
-  int32_t  sign  = 1;
-  uint32_t i     = 0;
-  // parsing in reverse order
-  for (; i < len; ++i) {
-    switch (str[len - 1 - i]) {
-    case '0': break;
-    case '1': final += 1 * pow; break;
-    case '2': final += 2 * pow; break;
-    case '3': final += 3 * pow; break;
-    case '4': final += 4 * pow; break;
-    case '5': final += 5 * pow; break;
-    case '6': final += 6 * pow; break;
-    case '7': final += 7 * pow; break;
-    case '8': final += 8 * pow; break;
-    case '9': final += 9 * pow; break;
-    // it's ok to have '-'/'+' as the first char in a string
-    case '-': {
-      if (i == len - 1)
-        sign = -1;
+static inline u32 f32_pow5_factor(u32 value) {
+  u32 count = 0;
+  while (value % 5 == 0) {
+    value /= 5;
+    count++;
+  }
+  return count;
+}
+// ceil(log2(5^e)), 1 for e == 0
+static inline i32 f32_pow5_bits(i32 e) { return (i32)(((u32)e * 1217359) >> 19) + 1; }
+static inline u32 f32_log10_pow2(i32 e) { return ((u32)e * 78913) >> 18; }
+static inline u32 f32_log10_pow5(i32 e) { return ((u32)e * 732923) >> 20; }
+static inline u32 f32_mul_shift(u32 m, u64 factor, i32 shift) {
+  ASSERT_DEBUG(shift > 32);
+  u64 bits0 = (u64)m * (u32)factor;
+  u64 bits1 = (u64)m * (u32)(factor >> 32);
+  return (u32)(((bits0 >> 32) + bits1) >> (shift - 32));
+}
+
+/** Ryu: the shortest `digits` * 10^`exp` that rounds back to a finite positive float
+  Of several shortest candidates the one closest to the float wins.
+ */
+static inline void f32_to_decimal(u32 bits, u32 *out_digits, i32 *out_exp) {
+  u32 ieee_mantissa = bits & ((1u << 23) - 1);
+  u32 ieee_exponent = (bits >> 23) & 0xff;
+  i32 e2;
+  u32 m2;
+  if (ieee_exponent == 0) {
+    e2 = 1 - 127 - 23 - 2;
+    m2 = ieee_mantissa;
+  } else {
+    e2 = (i32)ieee_exponent - 127 - 23 - 2;
+    m2 = (1u << 23) | ieee_mantissa;
+  }
+  bool accept_bounds = (m2 & 1) == 0;
+  // The float and the halfway points to its neighbours, scaled by 4
+  u32  mv       = 4 * m2;
+  u32  mp       = 4 * m2 + 2;
+  u32  mm_shift = ieee_mantissa != 0 || ieee_exponent <= 1;
+  u32  mm       = 4 * m2 - 1 - mm_shift;
+  u32  vr, vp, vm;
+  i32  e10;
+  bool vm_trailing_zeros  = false;
+  bool vr_trailing_zeros  = false;
+  u32  last_removed_digit = 0;
+  if (e2 >= 0) {
+    u32 q = f32_log10_pow2(e2);
+    e10   = (i32)q;
+    i32 k = 59 + f32_pow5_bits((i32)q) - 1;
+    i32 i = -e2 + (i32)q + k;
+    vr    = f32_mul_shift(mv, F32_POW5_INV_SPLIT[q], i);
+    vp    = f32_mul_shift(mp, F32_POW5_INV_SPLIT[q], i);
+    vm    = f32_mul_shift(mm, F32_POW5_INV_SPLIT[q], i);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      i32 l              = 59 + f32_pow5_bits((i32)q - 1) - 1;
+      last_removed_digit = f32_mul_shift(mv, F32_POW5_INV_SPLIT[q - 1], -e2 + (i32)q - 1 + l) % 10;
+    }
+    if (q <= 9) {
+      if (mv % 5 == 0)
+        vr_trailing_zeros = f32_pow5_factor(mv) >= q;
+      else if (accept_bounds)
+        vm_trailing_zeros = f32_pow5_factor(mm) >= q;
       else
-        return false;
-      break;
+        vp -= f32_pow5_factor(mp) >= q;
+    }
+  } else {
+    u32 q = f32_log10_pow5(-e2);
+    e10   = (i32)q + e2;
+    i32 i = -e2 - (i32)q;
+    i32 k = f32_pow5_bits(i) - 61;
+    i32 j = (i32)q - k;
+    vr    = f32_mul_shift(mv, F32_POW5_SPLIT[i], j);
+    vp    = f32_mul_shift(mp, F32_POW5_SPLIT[i], j);
+    vm    = f32_mul_shift(mm, F32_POW5_SPLIT[i], j);
+    if (q != 0 && (vp - 1) / 10 <= vm / 10) {
+      j                  = (i32)q - 1 - (f32_pow5_bits(i + 1) - 61);
+      last_removed_digit = f32_mul_shift(mv, F32_POW5_SPLIT[i + 1], j) % 10;
     }
-    case '+': {
-      if (i == len - 1)
-        sign = 1;
+    if (q <= 1) {
+      vr_trailing_zeros = true;
+      if (accept_bounds)
+        vm_trailing_zeros = mm_shift == 1;
       else
-        return false;
-      break;
+        vp--;
+    } else if (q < 31) {
+      vr_trailing_zeros = (mv & ((1u << (q - 1)) - 1)) == 0;
     }
-    default: return false;
+  }
+  i32 removed = 0;
+  u32 output;
+  if (vm_trailing_zeros || vr_trailing_zeros) {
+    while (vp / 10 > vm / 10) {
+      vm_trailing_zeros &= vm % 10 == 0;
+      vr_trailing_zeros &= last_removed_digit == 0;
+      last_removed_digit = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    if (vm_trailing_zeros) {
+      while (vm % 10 == 0) {
+        vr_trailing_zeros &= last_removed_digit == 0;
+        last_removed_digit = vr % 10;
+        vr /= 10;
+        vp /= 10;
+        vm /= 10;
+        removed++;
+      }
     }
-    pow *= 10;
+    // Exactly halfway, round to even
+    if (vr_trailing_zeros && last_removed_digit == 5 && vr % 2 == 0) last_removed_digit = 4;
+    output = vr + ((vr == vm && (!accept_bounds || !vm_trailing_zeros)) || last_removed_digit >= 5);
+  } else {
+    while (vp / 10 > vm / 10) {
+      last_removed_digit = vr % 10;
+      vr /= 10;
+      vp /= 10;
+      vm /= 10;
+      removed++;
+    }
+    output = vr + (vr == vm || last_removed_digit >= 5);
   }
-  *result = sign * final;
-  return true;
+  *out_digits = output;
+  *out_exp    = e10 + removed;
 }
 
-static inline bool parse_float(char const *str, size_t len, float *result) {
-  float    final = 0.0f;
-  uint32_t i     = 0;
-  float    sign  = 1.0f;
-  if (str[0] == '-') {
-    sign = -1.0f;
-    i    = 1;
+static constexpr u32 F32_FORMAT_MAX = 24;
+
+/** Shortest text that parse_float reads back as the same float, returns the length
+  `dst` holds at least F32_FORMAT_MAX chars, the text is zero terminated. Numbers from 1e-5 up
+  to 1e9 are written in fixed notation with a '.' so scripts read them as floats, the rest as
+  1.5e-7.
+ */
+static inline u32 format_f32(char *dst, float value) {
+  u32 bits;
+  memcpy(&bits, &value, 4);
+  char *cur = dst;
+  if (bits >> 31) *cur++ = '-';
+  bits &= 0x7fffffff;
+  if (bits >= 0x7f800000) {
+    memcpy(cur, bits == 0x7f800000 ? "inf" : "nan", 4);
+    return (u32)(cur - dst) + 3;
   }
-  for (; i < len; ++i) {
-    if (str[i] == '.') break;
-    switch (str[i]) {
-    case '0': final = final * 10.0f; break;
-    case '1': final = final * 10.0f + 1.0f; break;
-    case '2': final = final * 10.0f + 2.0f; break;
-    case '3': final = final * 10.0f + 3.0f; break;
-    case '4': final = final * 10.0f + 4.0f; break;
-    case '5': final = final * 10.0f + 5.0f; break;
-    case '6': final = final * 10.0f + 6.0f; break;
-    case '7': final = final * 10.0f + 7.0f; break;
-    case '8': final = final * 10.0f + 8.0f; break;
-    case '9': final = final * 10.0f + 9.0f; break;
-    default: return false;
-    }
+  if (bits == 0) {
+    memcpy(cur, "0.0", 4);
+    return (u32)(cur - dst) + 3;
   }
-  i++;
-  float pow = 1.0e-1f;
-  for (; i < len; ++i) {
-    switch (str[i]) {
-    case '0': break;
-    case '1': final += 1.0f * pow; break;
-    case '2': final += 2.0f * pow; break;
-    case '3': final += 3.0f * pow; break;
-    case '4': final += 4.0f * pow; break;
-    case '5': final += 5.0f * pow; break;
-    case '6': final += 6.0f * pow; break;
-    case '7': final += 7.0f * pow; break;
-    case '8': final += 8.0f * pow; break;
-    case '9': final += 9.0f * pow; break;
-    default: return false;
+  u32 output;
+  i32 exp;
+  f32_to_decimal(bits, &output, &exp);
+  char digits[10] = {};
+  i32  num_digits = 0;
+  for (u32 v = output; v != 0; v /= 10) num_digits++;
+  for (i32 i = num_digits - 1, v = (i32)output; i >= 0; i--, v /= 10) digits[i] = '0' + v % 10;
+  // Exponent of the first digit
+  i32 sci_exp = exp + num_digits - 1;
+  if (sci_exp >= -5 && sci_exp < 9) {
+    if (sci_exp < 0) {
+      *cur++ = '0';
+      *cur++ = '.';
+      for (i32 i = 0; i < -sci_exp - 1; i++) *cur++ = '0';
+      memcpy(cur, digits, (size_t)num_digits);
+      cur += num_digits;
+    } else if (num_digits <= sci_exp + 1) {
+      memcpy(cur, digits, (size_t)num_digits);
+      cur += num_digits;
+      for (i32 i = num_digits; i <= sci_exp; i++) *cur++ = '0';
+      *cur++ = '.';
+      *cur++ = '0';
+    } else {
+      memcpy(cur, digits, (size_t)sci_exp + 1);
+      cur += sci_exp + 1;
+      *cur++ = '.';
+      memcpy(cur, digits + sci_exp + 1, (size_t)(num_digits - sci_exp - 1));
+      cur += num_digits - sci_exp - 1;
     }
-    pow *= 1.0e-1f;
+  } else {
+    *cur++ = digits[0];
+    if (num_digits > 1) {
+      *cur++ = '.';
+      memcpy(cur, digits + 1, (size_t)num_digits - 1);
+      cur += num_digits - 1;
+    }
+    cur += sprintf(cur, "e%i", sci_exp);
   }
-  *result = sign * final;
-  return true;
+  *cur = '\0';
+  return (u32)(cur - dst);
 }
@@ -1,7 +1,9 @@
 #define UTILS_IMPL
+#define PERF_ENABLE
 #include "../script.hpp"
 #include "../utils.hpp"
 #include <stdio.h>
+#include <thread>
 
 struct Test_Allocator {
   static size_t total_alloced;
@@ -47,6 +49,35 @@ int main() {
     ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
   }
   ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
+  {
+    Array<u32, 0x10, Test_Allocator, Linear_Growth<0x10>> arr;
+    arr.init();
+    ito(N) { arr.push(i); }
+    ASSERT_ALWAYS(arr.capacity == 0x70);
+    ito(N) { ASSERT_ALWAYS(arr.pop() == (N - 1 - i)); }
+    ASSERT_ALWAYS(arr.capacity == 0);
+    arr.release();
+    ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
+  }
+  {
+    Array<u32, 0x10, Test_Allocator> arr;
+    arr.init();
+    arr.reserve(N);
+    ASSERT_ALWAYS(arr.capacity == N);
+    u32 *ptr = arr.ptr;
+    ito(N) { arr.push(i); }
+    ASSERT_ALWAYS(arr.ptr == ptr);
+    u32 tail[0x100];
+    ASSERT_ALWAYS(N <= ARRAY_SIZE(tail));
+    ito(N) { tail[i] = N + i; }
+    arr.push_n(tail, N);
+    ASSERT_ALWAYS(arr.size == N * 2);
+    ito(N * 2) { ASSERT_ALWAYS(arr[i] == i); }
+    ito(N * 2) { ASSERT_ALWAYS(arr.pop() == (N * 2 - 1 - i)); }
+    ASSERT_ALWAYS(arr.size == 0);
+    arr.release();
+    ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
+  }
   char buf[0x100];
   ito(10) {
     Hash_Set<u32, Test_Allocator, 0x100> set;
@@ -128,6 +159,157 @@ int main() {
     tl_alloc_tmp_exit();
     ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
   }
+  {
+    Hash_Table<u64, u64, Test_Allocator, 0x10> table;
+    table.init();
+    // Sliding window of live keys, the capacity must not grow with the number of removals
+    ito(100000) {
+      bool found = false;
+      u64 *val   = table.get_or_insert(i, &found);
+      ASSERT_ALWAYS(!found);
+      *val = i;
+      if (i >= 8) table.remove(i - 8);
+    }
+    ASSERT_ALWAYS(table.set.item_count == 8);
+    ASSERT_ALWAYS(table.set.arr.capacity <= 0x40);
+    ito(8) {
+      bool found = false;
+      ASSERT_ALWAYS(*table.get_or_insert(100000 - 1 - i, &found) == 100000 - 1 - i);
+      ASSERT_ALWAYS(found);
+    }
+    ASSERT_ALWAYS(!table.contains(100000 - 9));
+    table.release();
+    ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
+  }
+  {
+    Hash_Table<u64, u64, Test_Allocator, 0x10> table;
+    table.init();
+    ito(10000) { table.insert(i, i * 2); }
+    size_t full_capacity = table.set.arr.capacity;
+    // Odd keys go in one pass, that's still above the low-water mark
+    ASSERT_ALWAYS(table.remove_if([](Map_Pair<u64, u64> &item) { return (item.key & 1) != 0; }) ==
+                  5000);
+    ASSERT_ALWAYS(table.set.arr.capacity == full_capacity);
+    u64 keys[0x1000];
+    ito(ARRAY_SIZE(keys)) { keys[i] = i * 2; }
+    ASSERT_ALWAYS(table.remove_many(keys, ARRAY_SIZE(keys)) == ARRAY_SIZE(keys));
+    ASSERT_ALWAYS(table.set.item_count == 5000 - ARRAY_SIZE(keys));
+    ASSERT_ALWAYS(table.set.arr.capacity < full_capacity);
+    size_t shrunk_capacity = table.set.arr.capacity;
+    // Hysteresis: a few more removals don't rehash again
+    ito(0x10) { table.remove(ARRAY_SIZE(keys) * 2 + i * 2); }
+    ASSERT_ALWAYS(table.set.arr.capacity == shrunk_capacity);
+    for (u64 i = ARRAY_SIZE(keys) * 2 + 0x20; i < 10000; i += 2) {
+      ASSERT_ALWAYS(table.get(i) == i * 2);
+    }
+    table.clear();
+    ASSERT_ALWAYS(table.set.item_count == 0);
+    ASSERT_ALWAYS(!table.contains(9998));
+    table.release();
+    ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
+  }
+  {
+    Dense_Hash_Table<u64, u64, Test_Allocator, 0x10> table;
+    table.init();
+    ito(1000) { table.insert(i, i); }
+    // Insertion order
+    ito(1000) { ASSERT_ALWAYS(table.items[i].key == i); }
+    ito(500) { table.remove(i * 2); }
+    ASSERT_ALWAYS(table.get_size() == 500);
+    u64 sum = 0;
+    table.iter([&](Map_Pair<u64, u64> &item) {
+      ASSERT_ALWAYS((item.key & 1) == 1);
+      ASSERT_ALWAYS(item.key == item.value);
+      sum += item.value;
+    });
+    ASSERT_ALWAYS(sum == 500 * 500);
+    ito(500) { ASSERT_ALWAYS(table.get(i * 2 + 1) == i * 2 + 1); }
+    table.insert(1, 42);
+    ASSERT_ALWAYS(table.get_size() == 500 && table.get(1) == 42);
+    bool found = false;
+    *table.get_or_insert(2, &found) = 7;
+    ASSERT_ALWAYS(!found && table.get(2) == 7 && table.items.back().key == 2);
+    table.release();
+    ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
+  }
+  {
+    SmallArray<u32, 4, Test_Allocator> arr;
+    arr.init();
+    ito(4) { arr.push(i); }
+    ASSERT_ALWAYS(arr.is_inline() && Test_Allocator::total_alloced == 0);
+    arr.push(4);
+    ASSERT_ALWAYS(!arr.is_inline() && arr.size == 5);
+    u32 more[100];
+    ito(100) { more[i] = i + 5; }
+    arr.push_n(more, 100);
+    ASSERT_ALWAYS(arr.size == 105);
+    // Contiguous after the spill
+    u32 *ptr = arr.data();
+    ito(105) { ASSERT_ALWAYS(ptr[i] == i && arr[i] == i); }
+    arr.erase(10, 20);
+    ASSERT_ALWAYS(arr.size == 85 && arr[9] == 9 && arr[10] == 30 && arr.back() == 104);
+    ASSERT_ALWAYS(arr.has(30) && !arr.has(20));
+    ASSERT_ALWAYS(arr.pop() == 104 && arr.size == 84);
+    u32 sum = 0;
+    for (u32 v : arr) sum += v;
+    ASSERT_ALWAYS(sum == 103 * 104 / 2 - (10 + 29) * 20 / 2);
+    arr.release();
+    ASSERT_ALWAYS(Test_Allocator::total_alloced == 0 && arr.is_inline() && arr.size == 0);
+  }
+  {
+    SlotMap<u64, 0x10, Test_Allocator> map;
+    map.init();
+    u32 handles[1000];
+    ito(1000) {
+      handles[i] = map.insert(i);
+      ASSERT_ALWAYS(handles[i] != 0);
+    }
+    ito(500) { ASSERT_ALWAYS(map.remove(handles[i * 2]) >= 0); }
+    ASSERT_ALWAYS(map.get_size() == 500);
+    ito(500) {
+      ASSERT_ALWAYS(!map.is_alive(handles[i * 2]));
+      ASSERT_ALWAYS(map.get_or_null(handles[i * 2]) == NULL);
+      ASSERT_ALWAYS(map.remove(handles[i * 2]) < 0);
+      ASSERT_ALWAYS(map.get(handles[i * 2 + 1]) == i * 2 + 1);
+    }
+    u64 sum = 0;
+    map.iter([&](u32 handle, u64 &item) {
+      ASSERT_ALWAYS(map.get(handle) == item);
+      sum += item;
+    });
+    ASSERT_ALWAYS(sum == 500 * 500);
+    // Freed slots are reused with a new generation, stale handles stay dead
+    ito(500) {
+      u32 handle = map.insert(1000 + i);
+      ASSERT_ALWAYS(SlotMap<u64>::handle_slot(handle) < 1000);
+      ASSERT_ALWAYS(map.get(handle) == 1000 + i);
+    }
+    ASSERT_ALWAYS(map.slots.size == 1000);
+    ito(500) { ASSERT_ALWAYS(!map.is_alive(handles[i * 2])); }
+    // Generations wrap around without ever producing the zero handle
+    u32 handle = map.insert(0);
+    ito(5000) {
+      map.remove(handle);
+      handle = map.insert(i);
+      ASSERT_ALWAYS(handle != 0 && handle < (1u << 31) && map.get(handle) == i);
+    }
+    // A handle forged from a free slot's current generation is rejected, its index is a free list
+    // link and not a position in `items`
+    ito(2) {
+      u32 removed = map.insert(7);
+      u32 slot    = SlotMap<u64>::handle_slot(removed);
+      ASSERT_ALWAYS(map.remove(removed) >= 0);
+      u32 forged = SlotMap<u64>::make_handle(slot, map.slots[slot].generation);
+      ASSERT_ALWAYS(map.find(forged) < 0 && !map.is_alive(forged));
+      ASSERT_ALWAYS(map.get_or_null(forged) == NULL);
+      ASSERT_ALWAYS(map.remove(forged) < 0);
+    }
+    size_t num_items = map.get_size();
+    u32    reused    = map.insert(8);
+    ASSERT_ALWAYS(map.get(reused) == 8 && map.get_size() == num_items + 1);
+    map.release();
+    ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
+  }
   {
     tl_alloc_tmp_enter();
     Hash_Set<string_ref, Test_Allocator, 0x10000> set;
@@ -143,6 +325,141 @@ int main() {
     tl_alloc_tmp_exit();
     ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
   }
+  {
+    Temporary_Storage<> ts = Temporary_Storage<>::create(1 << 30);
+    ito(10000) {
+      ts.enter_scope();
+      *(u32 *)ts.alloc(sizeof(u32)) = i;
+    }
+    Temporary_Storage_Stats stats;
+    ts.get_stats(&stats);
+    ASSERT_ALWAYS(stats.depth == 10000 && stats.max_depth == 10000);
+    ito(10000) { ts.exit_scope(); }
+    ASSERT_ALWAYS(ts.cursor == 0);
+    // A nested scope counts towards its parent's peak
+    ts.enter_scope();
+    ts.alloc(0x100);
+    ts.enter_scope();
+    u8 *big = ts.alloc(64 << 20);
+    memset(big, 1, 64 << 20);
+    ts.exit_scope();
+    ts.exit_scope();
+    ts.get_stats(&stats);
+    ASSERT_ALWAYS(stats.last_scope_peak >= (64 << 20) + 0x100);
+    ASSERT_ALWAYS(stats.committed >= (64 << 20));
+    // The spike is given back once two outermost scopes went by without it
+    ito(2) {
+      ts.enter_scope();
+      ts.alloc(0x1000);
+      ts.exit_scope();
+    }
+    ts.get_stats(&stats);
+    ASSERT_ALWAYS(stats.committed <= (1 << 20) && stats.peak >= (64 << 20));
+    ts.enter_scope();
+    big = ts.alloc(64 << 20);
+    ASSERT_ALWAYS(big[32 << 20] == 0);
+    ts.exit_scope();
+    ts.release();
+  }
+  {
+    Alloc_Stats before;
+    tl_alloc_get_stats(&before);
+    u8 *small = (u8 *)tl_alloc(24);
+    // Same size class, stays in place
+    ASSERT_ALWAYS(tl_realloc(small, 24, 32) == small);
+    u8 *large = (u8 *)tl_alloc(1 << 20);
+    memset(large, 0xab, 1 << 20);
+    Alloc_Stats stats;
+    tl_alloc_get_stats(&stats);
+    ASSERT_ALWAYS(stats.size_classes[1].block_size == 32);
+    ASSERT_ALWAYS(stats.size_classes[1].live_blocks == before.size_classes[1].live_blocks + 1);
+    ASSERT_ALWAYS(stats.large_live_blocks == before.large_live_blocks + 1);
+    ASSERT_ALWAYS(stats.live_bytes >= before.live_bytes + 32 + (1 << 20));
+    ASSERT_ALWAYS(stats.peak_bytes >= stats.live_bytes);
+    large = (u8 *)tl_realloc(large, 1 << 20, 4 << 20);
+    ito(1 << 20) { ASSERT_ALWAYS(large[i] == 0xab); }
+    large = (u8 *)tl_realloc(large, 4 << 20, 100);
+    ito(100) { ASSERT_ALWAYS(large[i] == 0xab); }
+    tl_free(large);
+    tl_free(small);
+    tl_alloc_get_stats(&stats);
+    ASSERT_ALWAYS(stats.live_bytes == before.live_bytes);
+    // Blocks cross threads both ways, the other thread exits with some of its blocks alive
+    u32 *ours[0x400];
+    u32 *theirs[0x400];
+    ito(0x400) {
+      ours[i]    = (u32 *)tl_alloc(16 + (i % 64) * 16);
+      ours[i][0] = i;
+    }
+    std::thread([&] {
+      ito(0x400) {
+        tl_free(ours[i]);
+        theirs[i]    = (u32 *)tl_alloc(16 + (i % 64) * 16);
+        theirs[i][0] = i;
+      }
+    }).join();
+    ito(0x400) {
+      ASSERT_ALWAYS(theirs[i][0] == i);
+      tl_free(theirs[i]);
+    }
+    // Enough churn to collect the remote frees
+    ito(0x10000) { tl_free(tl_alloc(16 + (i % 64) * 16)); }
+    tl_alloc_get_stats(&stats);
+    ASSERT_ALWAYS(stats.live_bytes == before.live_bytes);
+  }
+  {
+    // String hash quality on generated node names
+    Hash_Set<u64, Test_Allocator> hashes;
+    hashes.init();
+    static u32 buckets[0x1000];
+    u32        h2[0x80] = {};
+    ito(0x100) {
+      jto(0x100) {
+        snprintf(buf, sizeof(buf), "auto_node_%i_%i", i, j);
+        u64 hash = hash_of(stref_s(buf));
+        ASSERT_ALWAYS(!hashes.contains(hash));
+        hashes.insert(hash);
+        buckets[Hash_Ctrl::h1(hash) & 0xfff]++;
+        h2[Hash_Ctrl::h2(hash)]++;
+      }
+    }
+    // 16 names per bucket and 512 per h2 value on average
+    ito(ARRAY_SIZE(buckets)) { ASSERT_ALWAYS(buckets[i] > 0 && buckets[i] < 48); }
+    ito(ARRAY_SIZE(h2)) { ASSERT_ALWAYS(h2[i] > 384 && h2[i] < 640); }
+    // Every length goes through a different tail path
+    char text[0x100];
+    ito(ARRAY_SIZE(text)) { text[i] = 'a' + i % 26; }
+    ito(ARRAY_SIZE(text) + 1) {
+      u64 hash = hash_of(string_ref{text, i});
+      ASSERT_ALWAYS(!hashes.contains(hash));
+      hashes.insert(hash);
+    }
+    hashes.release();
+    ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
+  }
+  {
+    Atom a = intern(stref_s("node_1"));
+    snprintf(buf, sizeof(buf), "node_%i", 1);
+    ASSERT_ALWAYS(intern(stref_s(buf)) == a);
+    ASSERT_ALWAYS(atom_find(stref_s(buf)) == a);
+    ASSERT_ALWAYS(ATOM("node_1") == a);
+    ASSERT_ALWAYS(atom_find(stref_s("node_2")).is_null());
+    ASSERT_ALWAYS(intern(stref_s("")).is_null());
+    string_ref str = atom_str(a);
+    // Fill a few chunks, earlier strings must not move
+    ito(10000) {
+      snprintf(buf, sizeof(buf), "atom_%i", i);
+      Atom b = intern(stref_s(buf));
+      ASSERT_ALWAYS(b != a && atom_str(b) == stref_s(buf));
+    }
+    char big[0x8000];
+    memset(big, 'x', sizeof(big) - 1);
+    big[sizeof(big) - 1] = '\0';
+    Atom b               = intern(stref_s(big));
+    ASSERT_ALWAYS(atom_str(b).len == sizeof(big) - 1 && atom_str(b).ptr[sizeof(big) - 1] == '\0');
+    ASSERT_ALWAYS(atom_str(a).ptr == str.ptr && str.ptr[str.len] == '\0');
+    ASSERT_ALWAYS(atom_find(stref_s("atom_42")) == intern(stref_s("atom_42")));
+  }
   {
     char const *      source       = R"(
     (main
@@ -154,16 +471,839 @@ int main() {
       )
     )
     )";
-    static Pool<List> list_storage = Pool<List>::create((1 << 10));
-    list_storage.enter_scope();
-    defer(list_storage.exit_scope());
-    struct List_Allocator {
-      List *alloc() { return list_storage.alloc_zero(1); }
-      void  reset() {}
-    } list_allocator;
-    List *root = List::parse(stref_s(source), list_allocator);
-    NOTNULL(root);
-    root->dump();
+    Ast ast;
+    ast.init();
+    defer(ast.release());
+    ASSERT_ALWAYS(ast.parse(stref_s(source)));
+    u32 main_list = ast.child(0, 0);
+    ASSERT_ALWAYS(ast.cmp_symbol(ast.child(main_list, 0), ATOM("main")));
+    u32 add_node = ast.child(main_list, 1);
+    ASSERT_ALWAYS(ast.cmp_symbol(ast.child(add_node, 0), ATOM("add_node")));
+    // Quoted strings are left alone
+    ASSERT_ALWAYS(ast.kind(ast.child(add_node, 2)) == Ast_Kind::STRING);
+    ASSERT_ALWAYS(ast.atoms[ast.child(add_node, 2)].is_null());
+    ASSERT_ALWAYS(ast.kind(ast.child(add_node, 3)) == Ast_Kind::NUMBER);
+    ASSERT_ALWAYS(ast.token(ast.child(add_node, 1)).ptr[0] == '(');
+    ASSERT_ALWAYS(ast.child(add_node, 7) == AST_NULL);
+    ast.dump();
+    // Deeper than any fixed stack and far more nodes than the old pool held
+    char *deep = (char *)tl_alloc(2 * 100000 + 1);
+    ito(100000) deep[i] = '(';
+    ito(100000) deep[100000 + i] = ')';
+    deep[200000] = '\0';
+    ASSERT_ALWAYS(ast.parse(stref_s(deep)) && ast.size == 100001);
+    u32 depth = 0;
+    for (u32 cur = 0; ast.first_child[cur] != AST_NULL; cur = ast.first_child[cur]) depth++;
+    ASSERT_ALWAYS(depth == 100000);
+    tl_free(deep);
+    ASSERT_ALWAYS(!ast.parse(stref_s("(a (b)")) && ast.size == 0);
+    ASSERT_ALWAYS(!ast.parse(stref_s("(a))")));
+    ASSERT_ALWAYS(!ast.parse(stref_s("(a \x01)")));
+    // Top level forms are siblings under the root
+    ASSERT_ALWAYS(ast.parse(stref_s(" (a) b \"\" (c)")));
+    ASSERT_ALWAYS(ast.kind(ast.child(0, 1)) == Ast_Kind::SYMBOL);
+    ASSERT_ALWAYS(ast.kind(ast.child(0, 2)) == Ast_Kind::STRING && ast.lens[ast.child(0, 2)] == 0);
+    ASSERT_ALWAYS(ast.child(0, 3) != AST_NULL && ast.child(0, 4) == AST_NULL);
+  }
+  {
+    auto count = [](char const *text, char const *patt) {
+      u32 n = 0;
+      for (char const *c = strstr(text, patt); c != NULL; c = strstr(c + 1, patt)) n++;
+      return n;
+    };
+    std::thread worker([] {
+      ito(10) {
+        PERF_SCOPE("worker");
+        PERF_HIST_ADD("worker_value", i);
+      }
+    });
+    worker.join();
+    {
+      PERF_SCOPE("outer");
+      ito(3) {
+        PERF_ENTER("inner");
+        PERF_EXIT("inner");
+      }
+    }
+    TMP_STORAGE_SCOPE;
+    ASSERT_ALWAYS(perf_write_chrome_trace("perf_test_trace.json"));
+    char *trace = read_file_tmp("perf_test_trace.json");
+    NOTNULL(trace);
+    ASSERT_ALWAYS(count(trace, "\"name\":\"worker\",\"ph\":\"B\"") == 10);
+    ASSERT_ALWAYS(count(trace, "\"name\":\"worker_value\",\"ph\":\"C\"") == 10);
+    ASSERT_ALWAYS(count(trace, "\"name\":\"inner\",\"ph\":\"E\"") == 3);
+    ASSERT_ALWAYS(count(trace, "\"name\":\"Ast::parse\",\"ph\":\"B\"") > 0);
+    ASSERT_ALWAYS(count(trace, "\"tid\":1") == 30);
+    // Wrap the ring, exits whose enters got overwritten are dropped
+    PERF_ENTER("long");
+    ito(100000) {
+      PERF_ENTER("short");
+      PERF_EXIT("short");
+    }
+    PERF_EXIT("long");
+    ASSERT_ALWAYS(perf_write_chrome_trace("perf_test_trace.json"));
+    trace = read_file_tmp("perf_test_trace.json");
+    NOTNULL(trace);
+    ASSERT_ALWAYS(count(trace, "\"name\":\"long\"") == 0);
+    ASSERT_ALWAYS(count(trace, "\"ph\":\"B\"") == count(trace, "\"ph\":\"E\""));
+    ASSERT_ALWAYS(count(trace, "\"ph\":\"B\"") > 30000);
+    remove("perf_test_trace.json");
+  }
+  {
+    static Hdr_Histogram hist;
+    hist.reset();
+    // Bucket bounds are monotonic and cover every value
+    u64 prev = 0;
+    ito(Hdr_Histogram::NUM_BUCKETS) {
+      u64 bound = Hdr_Histogram::get_bucket_max(i);
+      ASSERT_ALWAYS(i == 0 || bound > prev);
+      ASSERT_ALWAYS(Hdr_Histogram::get_bucket(bound) == i);
+      prev = bound;
+    }
+    ASSERT_ALWAYS(prev == UINT64_MAX);
+    ito(100000) { hist.record(i + 1); }
+    ASSERT_ALWAYS(hist.total == 100000 && hist.min == 1 && hist.max == 100000);
+    f64 percentiles[] = {50.0, 99.0, 99.9};
+    ito(ARRAY_SIZE(percentiles)) {
+      f64 exact = percentiles[i] * 1000.0;
+      f64 got   = (f64)hist.get_percentile(percentiles[i]);
+      ASSERT_ALWAYS(got >= exact && got <= exact * (1.0 + 1.0 / Hdr_Histogram::SUB_COUNT));
+    }
+    ASSERT_ALWAYS(hist.get_percentile(100.0) == 100000);
+    // A single slow sample shows up in the tail only
+    hist.reset();
+    ito(999) { hist.record(1000); }
+    hist.record(1000000);
+    ASSERT_ALWAYS(hist.get_percentile(99.0) < 1100);
+    ASSERT_ALWAYS(hist.get_percentile(99.95) == 1000000);
+    PERF_HIST_ADD("test_value", 10);
+    PERF_HIST_ADD("test_value", 20);
+    ASSERT_ALWAYS(perf_get_histogram("test_value", &hist));
+    ASSERT_ALWAYS(hist.total == 2 && hist.max == 20);
+    { PERF_HIST_SCOPE("test_scope_ns"); }
+    char const *names[0x10];
+    u32         num_names = perf_get_histogram_names(names, ARRAY_SIZE(names));
+    ASSERT_ALWAYS(num_names == 3 && strcmp(names[2], "test_scope_ns") == 0);
+    perf_reset_histograms();
+    ASSERT_ALWAYS(perf_get_histogram("worker_value", &hist) && hist.total == 0);
+  }
+  {
+    ALLOC_SITE(Test_Site);
+    using Tracked  = Tracking_Allocator<Test_Site>;
+    auto get_stats = [](Alloc_Site_Stats *out) {
+      Alloc_Site_Summary sites[0x10];
+      u32                count = alloc_tracking_get_summaries(sites, ARRAY_SIZE(sites));
+      ASSERT_ALWAYS(count <= ARRAY_SIZE(sites));
+      ito(count) {
+        if (strcmp(sites[i].name, "Test_Site") == 0) {
+          ASSERT_ALWAYS(alloc_tracking_get_site(i, out));
+          ASSERT_ALWAYS(out->num_allocs == sites[i].num_allocs);
+          return;
+        }
+      }
+      TRAP;
+    };
+    static Alloc_Site_Stats stats;
+    // Allocated while tracking is off, never counted
+    Array<u32, 0x10, Tracked> untracked;
+    untracked.init();
+    untracked.push(1);
+    alloc_tracking_enable(true);
+    Array<u32, 0x10, Tracked> arr;
+    arr.init();
+    ito(1000) { arr.push(i); }
+    ito(1000) { ASSERT_ALWAYS(arr[i] == i); }
+    Hash_Table<u64, u64, Tracked> table;
+    table.init();
+    ito(100) { table.insert(i, i); }
+    untracked.push_n(arr.ptr, 1000);
+    get_stats(&stats);
+    // Array storage, table slots and table control bytes
+    ASSERT_ALWAYS(stats.live_blocks == 3 && stats.num_frees == stats.num_allocs - 3);
+    ASSERT_ALWAYS(stats.num_reallocs > 0);
+    ASSERT_ALWAYS(stats.live_bytes > arr.capacity * sizeof(u32) +
+                                         table.set.arr.capacity * sizeof(table.set.arr.ptr[0]));
+    ASSERT_ALWAYS(stats.peak_bytes >= stats.live_bytes);
+    ASSERT_ALWAYS(alloc_tracking_report_leaks(stdout) == 3);
+    arr.release();
+    table.release();
+    untracked.release();
+    get_stats(&stats);
+    ASSERT_ALWAYS(stats.num_frees == stats.num_allocs);
+    ASSERT_ALWAYS(stats.live_blocks == 0 && stats.live_bytes == 0);
+    ASSERT_ALWAYS(stats.lifetime_ns.total == stats.num_frees);
+    ASSERT_ALWAYS(alloc_tracking_report_leaks(stdout) == 0);
+    alloc_tracking_reset();
+    get_stats(&stats);
+    ASSERT_ALWAYS(stats.num_allocs == 0 && stats.lifetime_ns.total == 0);
+    alloc_tracking_enable(false);
+  }
+  {
+    TMP_STORAGE_SCOPE;
+    auto naive_find = [](string_ref a, string_ref b, size_t start) -> i32 {
+      for (size_t i = start; i + b.len <= a.len; i++)
+        if (memcmp(a.ptr + i, b.ptr, b.len) == 0) return (i32)i;
+      return -1;
+    };
+    auto naive_find_last = [](string_ref a, string_ref b, size_t start) -> i32 {
+      for (size_t i = a.len - MIN(b.len, a.len) + 1; i-- > start;)
+        if (i + b.len <= a.len && memcmp(a.ptr + i, b.ptr, b.len) == 0) return (i32)i;
+      return -1;
+    };
+    // Small alphabet so candidates are common, lengths cross the block sizes
+    char text[0x200];
+    char needle[0x10];
+    u32  seed = 1;
+    auto rnd  = [&]() { return seed = seed * 1103515245 + 12345, (seed >> 16) & 0x7fff; };
+    ito(0x800) {
+      u32 text_len   = rnd() % ARRAY_SIZE(text);
+      u32 needle_len = 1 + rnd() % 6;
+      jto(text_len) text[j] = 'a' + rnd() % 3;
+      jto(needle_len) needle[j] = 'a' + rnd() % 3;
+      string_ref a     = string_ref{text, text_len};
+      string_ref b     = string_ref{needle, needle_len};
+      size_t     start = text_len == 0 ? 0 : rnd() % text_len;
+      ASSERT_ALWAYS(stref_find(a, b, start) == naive_find(a, b, start));
+      ASSERT_ALWAYS(stref_find_last(a, b, start) == naive_find_last(a, b, start));
+    }
+    ASSERT_ALWAYS(stref_find_last_char(stref_s("a/b/c"), '/') == 3);
+    ASSERT_ALWAYS(stref_find_last_char(stref_s("a/b/c"), '/', 4) == -1);
+    ASSERT_ALWAYS(stref_find(stref_s("abc"), string_ref{NULL, 0}, 1) == 1);
+    // Multi-megabyte sources, the runs of 'a' force the KMP fallback both ways
+    size_t big_len = 8 << 20;
+    char * big     = (char *)tl_alloc_tmp(big_len);
+    memset(big, 'a', big_len);
+    memcpy(big + 1000, "aaab", 4);
+    memcpy(big + big_len - 1000, "baaa", 4);
+    string_ref big_ref = string_ref{big, big_len};
+    ASSERT_ALWAYS(stref_find(big_ref, stref_s("aaaaaaaac"), 0) == -1);
+    ASSERT_ALWAYS(stref_find(big_ref, stref_s("aaaaacaaaa"), 0) == -1);
+    ASSERT_ALWAYS(stref_find(big_ref, stref_s("aaaaabaaaa"), 999) == (i32)(big_len - 1005));
+    ASSERT_ALWAYS(stref_find_last(big_ref, stref_s("aaaaacaaaa"), 0) == -1);
+    ASSERT_ALWAYS(stref_find_last(big_ref, stref_s("aaaaaaaaaaaaaaaab"), 0) == (i32)(big_len - 1016));
+    ASSERT_ALWAYS(stref_find(big_ref, stref_s("aaaaaaaab"), 1001) == (i32)(big_len - 1008));
+    ASSERT_ALWAYS(stref_find(big_ref, stref_s("aaab"), 0) == 1000);
+    ASSERT_ALWAYS(stref_find(big_ref, stref_s("baaa"), 1004) == (i32)(big_len - 1000));
+    ASSERT_ALWAYS(stref_find_last(big_ref, stref_s("aaab")) == (i32)(big_len - 1003));
+    ASSERT_ALWAYS(stref_find_last(big_ref, stref_s("caaaaaaaa"), 0) == -1);
+    ASSERT_ALWAYS(stref_find_last(big_ref, stref_s("baaaaaaaa"), 0) == (i32)(big_len - 1000));
+    ASSERT_ALWAYS(stref_find_last(big_ref, stref_s("aaaaa")) == (i32)(big_len - 5));
+    string_ref needles[] = {stref_s("void"), stref_s("main"), stref_s("ma")};
+    u32        which     = 0;
+    string_ref shader    = stref_s("#version 450\nvoid main() {}");
+    ASSERT_ALWAYS(stref_find_any(shader, needles, 3, 0, &which) == 13 && which == 0);
+    ASSERT_ALWAYS(stref_find_any(shader, needles, 3, 14, &which) == 18 && which == 1);
+    ASSERT_ALWAYS(stref_find_any(shader, needles + 2, 1, 20, &which) == -1);
+    // Quoted strings in scripts are found by search
+    Ast ast;
+    ast.init();
+    defer(ast.release());
+    ASSERT_ALWAYS(ast.parse(stref_s("(add_source \"a\" \"\"\"void main() { \"x\"; }\"\"\")")));
+    u32 list = ast.child(0, 0);
+    ASSERT_ALWAYS(list != AST_NULL && ast.first_child[list] != AST_NULL);
+    ASSERT_ALWAYS(ast.token(ast.child(list, 1)) == stref_s("a"));
+    ASSERT_ALWAYS(ast.token(ast.child(list, 2)) == stref_s("void main() { \"x\"; }"));
+    ASSERT_ALWAYS(!ast.parse(stref_s("(a \"\"\"unterminated\")")));
+  }
+  {
+    // Page sized file, the terminator comes from the reservation after it
+    size_t page = get_page_size();
+    char * data = (char *)tl_alloc(page);
+    ito(page) data[i] = 'a' + i % 26;
+    dump_file("mapped_file_test.txt", data, page);
+    string_ref  expected = string_ref{data, page};
+    Mapped_File file;
+    ASSERT_ALWAYS(file.init("mapped_file_test.txt"));
+    ASSERT_ALWAYS(file.size == page && file.ptr[page] == '\0');
+    ASSERT_ALWAYS(file.get_view() == expected);
+    // Rewriting the file doesn't touch the mapped contents
+    dump_file("mapped_file_test.txt", "short", 5);
+    ASSERT_ALWAYS(file.get_view() == expected);
+    file.release();
+    ASSERT_ALWAYS(file.init("mapped_file_test.txt"));
+    ASSERT_ALWAYS(file.get_view() == stref_s("short") && file.ptr[5] == '\0');
+    file.release();
+    // Bigger than the temporary storage
+    size_t big_size = 20 << 20;
+    char * big      = (char *)tl_alloc(big_size);
+    memset(big, 'x', big_size);
+    big[big_size - 1] = 'y';
+    dump_file("mapped_file_test.txt", big, big_size);
+    ASSERT_ALWAYS(file.init("mapped_file_test.txt"));
+    ASSERT_ALWAYS(file.size == big_size && file.ptr[big_size - 1] == 'y');
+    ASSERT_ALWAYS(stref_find_char(file.get_view(), 'y') == (i32)(big_size - 1));
+    file.release();
+    tl_free(big);
+    tl_free(data);
+    dump_file("mapped_file_test.txt", NULL, 0);
+    ASSERT_ALWAYS(file.init("mapped_file_test.txt"));
+    ASSERT_ALWAYS(file.is_open() && file.size == 0 && file.ptr[0] == '\0');
+    file.release();
+    ASSERT_ALWAYS(!file.init("mapped_file_test_missing.txt") && !file.is_open());
+    remove("mapped_file_test.txt");
+  }
+  {
+    // Odd sizes so the SIMD loops have tails, several strips per image
+    u32  width = 613, height = 1517, pitch = width * 4 + 12;
+    u8 * image = (u8 *)tl_alloc((size_t)pitch * height);
+    ito(height) {
+      jto(width) {
+        u8 *px = image + (size_t)i * pitch + j * 4;
+        px[0]  = (u8)(i + j);
+        px[1]  = (u8)(i * 3);
+        px[2]  = (u8)((i * j) >> 4);
+        px[3]  = (j % 7) == 0 ? 0 : 255;
+      }
+    }
+    auto read_file = [](char const *path, size_t *size) {
+      Mapped_File file;
+      ASSERT_ALWAYS(file.init(path));
+      u8 *data = (u8 *)tl_alloc(file.size);
+      memcpy(data, file.ptr, file.size);
+      *size = file.size;
+      file.release();
+      return data;
+    };
+    // PPM against a per pixel reference
+    write_image_2d_i32_ppm("image_test.ppm", image, pitch, width, height);
+    size_t ppm_size = 0;
+    u8 *   ppm      = read_file("image_test.ppm", &ppm_size);
+    char   header[0x40];
+    size_t header_len = (size_t)snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+    ASSERT_ALWAYS(ppm_size == header_len + (size_t)width * height * 3);
+    ASSERT_ALWAYS(memcmp(ppm, header, header_len) == 0);
+    ito(height) {
+      jto(width) {
+        u8 const *px  = image + (size_t)i * pitch + j * 4;
+        u8 const *out = ppm + header_len + ((size_t)i * width + j) * 3;
+        u8        c   = ((i & 1) ^ (j & 1)) * 127;
+        ASSERT_ALWAYS(out[0] == (px[3] == 0 ? c : px[0]));
+        ASSERT_ALWAYS(out[1] == (px[3] == 0 ? c : px[1]));
+        ASSERT_ALWAYS(out[2] == (px[3] == 0 ? c : px[2]));
+      }
+    }
+    tl_free(ppm);
+    // PNG decoded back with zlib, checks the chunk CRCs, the stream's adler and every filter
+    u32 const channel_counts[] = {4, 3, 1};
+    for (u32 channels : channel_counts) {
+      ASSERT_ALWAYS(write_image_2d_png("image_test.png", image, pitch, width, height, channels,
+                                       6, 4));
+      size_t png_size = 0;
+      u8 *   png      = read_file("image_test.png", &png_size);
+      auto   read_u32 = [](u8 const *p) {
+        return ((u32)p[0] << 24) | ((u32)p[1] << 16) | ((u32)p[2] << 8) | (u32)p[3];
+      };
+      ASSERT_ALWAYS(memcmp(png, "\x89PNG\r\n\x1a\n", 8) == 0);
+      size_t row_size = (size_t)width * channels;
+      u8 *   zdata    = (u8 *)tl_alloc(png_size);
+      size_t zsize    = 0;
+      size_t cursor   = 8;
+      bool   saw_end  = false;
+      while (cursor < png_size) {
+        u32       len  = read_u32(png + cursor);
+        u8 const *type = png + cursor + 4;
+        ASSERT_ALWAYS(read_u32(type + 4 + len) == (u32)crc32(0, type, len + 4));
+        if (memcmp(type, "IHDR", 4) == 0) {
+          ASSERT_ALWAYS(read_u32(type + 4) == width && read_u32(type + 8) == height);
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+          memcpy(zdata + zsize, type + 4, len);
+          zsize += len;
+        } else if (memcmp(type, "IEND", 4) == 0) {
+          saw_end = true;
+        }
+        cursor += 12 + len;
+      }
+      ASSERT_ALWAYS(saw_end && cursor == png_size);
+      uLongf raw_size = (uLongf)((row_size + 1) * height);
+      u8 *   raw      = (u8 *)tl_alloc(raw_size);
+      ASSERT_ALWAYS(uncompress(raw, &raw_size, zdata, zsize) == Z_OK);
+      ASSERT_ALWAYS(raw_size == (row_size + 1) * height);
+      u32 filters_used = 0;
+      ito(height) {
+        u8 *row    = raw + (row_size + 1) * i + 1;
+        u8 *prev   = i == 0 ? NULL : row - (row_size + 1);
+        u8  filter = row[-1];
+        ASSERT_ALWAYS(filter <= 4);
+        filters_used |= 1 << filter;
+        for (size_t k = 0; k < row_size; k++) {
+          u8 a = k >= channels ? row[k - channels] : 0;
+          u8 b = prev != NULL ? prev[k] : 0;
+          u8 c = k >= channels && prev != NULL ? prev[k - channels] : 0;
+          i32 p = (i32)a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+          u8  predictors[] = {0, a, b, (u8)((a + b) >> 1),
+                             pa <= pb && pa <= pc ? a : pb <= pc ? b : c};
+          row[k] += predictors[filter];
+        }
+        // Fewer channels read the same rows as packed bytes
+        ASSERT_ALWAYS(memcmp(row, image + (size_t)i * pitch, row_size) == 0);
+      }
+      ASSERT_ALWAYS(filters_used > 1);
+      tl_free(raw);
+      tl_free(zdata);
+      tl_free(png);
+    }
+    tl_free(image);
+    remove("image_test.ppm");
+    remove("image_test.png");
+  }
+  {
+    auto parse_i32 = [](char const *str, i32 *out) { return parse_decimal_int(str, strlen(str), out); };
+    i32  ival      = 0;
+    ASSERT_ALWAYS(parse_i32("2147483647", &ival) && ival == INT32_MAX);
+    ASSERT_ALWAYS(parse_i32("-2147483648", &ival) && ival == INT32_MIN);
+    ASSERT_ALWAYS(parse_i32("+000000000000012345678", &ival) && ival == 12345678);
+    ASSERT_ALWAYS(!parse_i32("2147483648", &ival) && !parse_i32("-2147483649", &ival));
+    ASSERT_ALWAYS(!parse_i32("99999999999", &ival) && !parse_i32("-", &ival));
+    ASSERT_ALWAYS(!parse_i32("1234567a", &ival) && !parse_i32("12-3", &ival));
+    ASSERT_ALWAYS(!parse_i32("1.0", &ival) && !parse_i32("", &ival));
+    auto parse_f32 = [](char const *str, float *out) { return parse_float(str, strlen(str), out); };
+    float fval     = 0.0f;
+    ASSERT_ALWAYS(parse_f32("17.778940", &fval) && fval == 17.77894f);
+    ASSERT_ALWAYS(parse_f32("-1.5e-7", &fval) && fval == -1.5e-7f);
+    ASSERT_ALWAYS(parse_f32(".5", &fval) && fval == 0.5f && parse_f32("5.", &fval) && fval == 5.0f);
+    ASSERT_ALWAYS(parse_f32("3.4028235e38", &fval) && fval == 3.4028235e38f);
+    ASSERT_ALWAYS(parse_f32("1e39", &fval) && fval > 3.4028235e38f);
+    ASSERT_ALWAYS(parse_f32("1.4e-45", &fval) && fval == 1.4e-45f);
+    ASSERT_ALWAYS(parse_f32("1e-46", &fval) && fval == 0.0f);
+    ASSERT_ALWAYS(!parse_f32(".", &fval) && !parse_f32("1e", &fval) && !parse_f32("1.0f", &fval));
+    ASSERT_ALWAYS(!parse_f32("-", &fval) && !parse_f32("e5", &fval) && !parse_f32("1..0", &fval));
+    char fbuf[F32_FORMAT_MAX];
+    auto format    = [&](float v) { return format_f32(fbuf, v), (char const *)fbuf; };
+    ASSERT_ALWAYS(strcmp(format(1.0f), "1.0") == 0 && strcmp(format(-0.0f), "-0.0") == 0);
+    ASSERT_ALWAYS(strcmp(format(17.77894f), "17.77894") == 0);
+    ASSERT_ALWAYS(strcmp(format(0.1f), "0.1") == 0 && strcmp(format(1.0e-5f), "0.00001") == 0);
+    ASSERT_ALWAYS(strcmp(format(1.5e-7f), "1.5e-7") == 0 && strcmp(format(1.0e9f), "1e9") == 0);
+    ASSERT_ALWAYS(strcmp(format(123456780.0f), "123456780.0") == 0);
+    ASSERT_ALWAYS(strcmp(format(3.4028235e38f), "3.4028235e38") == 0);
+    ASSERT_ALWAYS(strcmp(format(1.4e-45f), "1e-45") == 0);
+    // Round trip fuzz over random bit patterns, every few checked for shortness against printf
+    u64 seed = 0x9e3779b97f4a7c15ull;
+    auto rnd = [&]() {
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+      return seed;
+    };
+    ito(1 << 20) {
+      u32 bits = (u32)rnd();
+      if ((bits & 0x7f800000) == 0x7f800000) continue;
+      float v;
+      memcpy(&v, &bits, 4);
+      u32   len = format_f32(fbuf, v);
+      float back;
+      ASSERT_ALWAYS(parse_float(fbuf, len, &back));
+      u32 back_bits;
+      memcpy(&back_bits, &back, 4);
+      ASSERT_ALWAYS(back_bits == bits);
+      if (i % 16 == 0) {
+        u32 num_digits = 0;
+        for (char const *c = fbuf; *c != '\0' && *c != 'e'; c++) {
+          if (*c >= '1' && *c <= '9') num_digits = (u32)(c - fbuf) + 1;
+        }
+        // Digits up to the last non zero one, not counting the sign, point and leading zeros
+        u32 shortest = 0;
+        for (char const *c = fbuf; c < fbuf + num_digits; c++) {
+          if (*c >= '0' && *c <= '9' && (shortest != 0 || *c != '0')) shortest++;
+        }
+        char ref[0x40];
+        for (u32 precision = 1; precision <= 9; precision++) {
+          snprintf(ref, sizeof(ref), "%.*e", precision - 1, v);
+          if (strtof(ref, NULL) == v) {
+            ASSERT_ALWAYS(shortest <= precision);
+            break;
+          }
+        }
+      }
+    }
+    // Parsing against strtof on random decimal strings, including ones past 19 digits
+    ito(1 << 18) {
+      char str[0x40];
+      u32  len        = 0;
+      u32  num_digits = 1 + (u32)(rnd() % 24);
+      u32  point      = (u32)(rnd() % (num_digits + 1));
+      if (rnd() % 2) str[len++] = '-';
+      jto(num_digits) {
+        if (j == point) str[len++] = '.';
+        str[len++] = '0' + (char)(rnd() % 10);
+      }
+      if (rnd() % 2) len += (u32)sprintf(str + len, "e%i", (i32)(rnd() % 100) - 55);
+      str[len] = '\0';
+      float ours;
+      ASSERT_ALWAYS(parse_float(str, len, &ours));
+      float theirs = strtof(str, NULL);
+      ASSERT_ALWAYS(memcmp(&ours, &theirs, 4) == 0);
+    }
+  }
+  {
+    // Job system
+    ASSERT_ALWAYS(jobs_num_workers() == 1 && jobs_worker_index() == -1);
+    // Inline before jobs_init
+    u32 calls = 0;
+    parallel_for(0, 1000, 10, [&](u32 begin, u32 end) {
+      ASSERT_ALWAYS(begin == 0 && end == 1000);
+      calls++;
+    });
+    ASSERT_ALWAYS(calls == 1);
+    jobs_init(4);
+    ASSERT_ALWAYS(jobs_num_workers() == 4 && jobs_worker_index() == 0);
+    u32  N    = 1 << 20;
+    u32 *hits = (u32 *)tl_alloc(sizeof(u32) * N);
+    memset(hits, 0, sizeof(u32) * N);
+    std::atomic<u32> max_range{0};
+    parallel_for(0, N, 1000, [&](u32 begin, u32 end) {
+      u32 range = end - begin;
+      u32 prev  = max_range.load();
+      while (range > prev && !max_range.compare_exchange_weak(prev, range)) {
+      }
+      // Every job gets its own temporary storage scope
+      u32 *tmp = (u32 *)tl_alloc_tmp(sizeof(u32) * range);
+      for (u32 i = begin; i < end; i++) tmp[i - begin] = i;
+      for (u32 i = begin; i < end; i++) hits[tmp[i - begin]]++;
+    });
+    ito(N) ASSERT_ALWAYS(hits[i] == 1);
+    ASSERT_ALWAYS(max_range.load() <= 1000);
+    // Nested loops from inside jobs
+    std::atomic<u64> sum{0};
+    parallel_for(0, 64, 1, [&](u32 begin, u32 end) {
+      for (u32 i = begin; i < end; i++) {
+        parallel_for(0, 1000, 7, [&](u32 b, u32 e) {
+          u64 local = 0;
+          for (u32 j = b; j < e; j++) local += j;
+          sum += local;
+        });
+      }
+    });
+    ASSERT_ALWAYS(sum.load() == 64ull * (999ull * 1000ull / 2ull));
+    // Task groups
+    {
+      Job_Group        group;
+      std::atomic<u32> counter{0};
+      auto             add_one = [&]() { counter++; };
+      auto             add_ten = [&]() { counter += 10; };
+      ito(100) jobs_run(&group, add_one);
+      ito(10) jobs_run(&group, add_ten);
+      jobs_wait(&group);
+      ASSERT_ALWAYS(counter.load() == 200);
+      ASSERT_ALWAYS(group.pending.load() == 0);
+    }
+    // Stable compaction in place
+    ito(N) hits[i] = (u32)i;
+    u32 kept = parallel_compact(hits, N, 4096, [&](u32 i, u32 *dst) {
+      u32 v = hits[i];
+      if (v % 3 == 0) return false;
+      *dst = v;
+      return true;
+    });
+    ASSERT_ALWAYS(kept == N - (N + 2) / 3);
+    ito(kept) ASSERT_ALWAYS(hits[i] == (u32)(i + i / 2 + 1));
+    tl_free(hits);
+    jobs_release();
+    ASSERT_ALWAYS(jobs_num_workers() == 1 && jobs_worker_index() == -1);
+    // Restarts with a different worker count
+    jobs_init(2);
+    std::atomic<u32> count{0};
+    parallel_for(0, 100000, 100, [&](u32 begin, u32 end) { count += end - begin; });
+    ASSERT_ALWAYS(count.load() == 100000);
+    jobs_release();
+  }
+  {
+    // Concurrent_Hash_Table from one thread
+    Concurrent_Hash_Table<u64, u64, Test_Allocator, 0x10> table;
+    table.init();
+    u32 N = 100000;
+    ito(N) ASSERT_ALWAYS(table.insert((u64)i * 7919, (u64)i));
+    ASSERT_ALWAYS(table.get_size() == N);
+    ito(N) ASSERT_ALWAYS(*table.get_or_null((u64)i * 7919) == (u64)i);
+    ASSERT_ALWAYS(table.get_or_null(3) == NULL);
+    // Existing values are kept
+    bool found = false;
+    ASSERT_ALWAYS(!table.insert(7919, 42));
+    ASSERT_ALWAYS(*table.get_or_insert(7919, 42, &found) == 1 && found);
+    ASSERT_ALWAYS(*table.get_or_insert(3, 42, &found) == 42 && !found);
+    // Value pointers survive resizes
+    u64 *stable = table.get_or_null(3);
+    ito(N) table.insert((u64)i * 7919 + 1, 0);
+    ASSERT_ALWAYS(table.get_or_null(3) == stable && *stable == 42);
+    u64 count = 0;
+    table.iter([&](u64 const &key, u64 &value) {
+      (void)key;
+      (void)value;
+      count++;
+    });
+    ASSERT_ALWAYS(count == table.get_size() && count == 2 * N + 1);
+    table.release();
+  }
+  {
+    // Concurrent_Hash_Table from many threads, resizes while others insert and look up
+    u32 const NUM_THREADS = 8;
+    u32 const N           = 1 << 17;
+    char *    storage     = (char *)tl_alloc(N * 16);
+    ito(N) snprintf(storage + i * 16, 16, "key_%u", (u32)i);
+    Concurrent_Hash_Table<string_ref, u32, Default_Allocator, 0x10> table;
+    table.init();
+    std::atomic<u32> mismatches{0};
+    std::thread      threads[NUM_THREADS];
+    ito(NUM_THREADS) {
+      threads[i] = std::thread([&, i] {
+        u32 step = 2 * (u32)i + 1;
+        jto(N) {
+          // Every thread walks all keys in its own order
+          u32        k   = (u32)((j * step + i * 977) % N);
+          string_ref key = stref_s(storage + k * 16);
+          bool       found;
+          if (*table.get_or_insert(key, k, &found) != k) mismatches++;
+          u32  probe_k = (u32)((j * 31) % N);
+          u32 *value   = table.get_or_null(stref_s(storage + probe_k * 16));
+          if (value != NULL && *value != probe_k) mismatches++;
+        }
+      });
+    }
+    ito(NUM_THREADS) threads[i].join();
+    ASSERT_ALWAYS(mismatches.load() == 0);
+    ASSERT_ALWAYS(table.get_size() == N);
+    ito(N) {
+      u32 *value = table.get_or_null(stref_s(storage + i * 16));
+      ASSERT_ALWAYS(value != NULL && *value == i);
+    }
+    u32 count = 0;
+    table.iter([&](string_ref const &, u32 &) { count++; });
+    ASSERT_ALWAYS(count == N);
+    table.release();
+    tl_free(storage);
+  }
+  {
+    // Interning from many threads gives one dense id per string
+    u32 const   NUM_THREADS = 8;
+    u32 const   N           = 20000;
+    Atom        atoms[NUM_THREADS][64];
+    Atom        first[N];
+    std::thread threads[NUM_THREADS];
+    ito(NUM_THREADS) {
+      threads[i] = std::thread([&, i] {
+        char buf[32];
+        jto(N) {
+          u32 k = (u32)((j * 7 + i * 1013) % N);
+          snprintf(buf, sizeof(buf), "mt_atom_%u", k);
+          Atom a = intern(stref_s(buf));
+          ASSERT_ALWAYS(atom_str(a) == stref_s(buf));
+          if (k < 64) atoms[i][k] = a;
+        }
+      });
+    }
+    ito(NUM_THREADS) threads[i].join();
+    u32 min_id = ~0u, max_id = 0;
+    ito(N) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "mt_atom_%u", (u32)i);
+      first[i] = atom_find(stref_s(buf));
+      ASSERT_ALWAYS(!first[i].is_null());
+      min_id = MIN(min_id, first[i].id);
+      max_id = MAX(max_id, first[i].id);
+    }
+    ASSERT_ALWAYS(max_id - min_id + 1 == N);
+    ito(NUM_THREADS) jto(64) ASSERT_ALWAYS(atoms[i][j] == first[j]);
+  }
+  {
+    // Log lines are split on newlines, truncated, and filtered by severity
+    log_drain();
+    log_clear();
+    u32 base[LOG_ALL_SEVERITIES + 1];
+    ito(LOG_ALL_SEVERITIES + 1) base[i] = log_view_size(i);
+    ASSERT_ALWAYS(base[LOG_ALL_SEVERITIES] == 0);
+    log_push(Log_Severity::SEV_WARNING, "first %d\nsecond\n", 1);
+    char long_line[LOG_LINE_MAX * 2];
+    memset(long_line, 'x', sizeof(long_line) - 1);
+    long_line[sizeof(long_line) - 1] = '\0';
+    log_push(Log_Severity::SEV_ERROR, "%s", long_line);
+    log_push(Log_Severity::SEV_DEBUG, "debug");
+    log_drain();
+    ASSERT_ALWAYS(log_view_size(LOG_ALL_SEVERITIES) == 4);
+    ASSERT_ALWAYS(log_view_size(1 << (u32)Log_Severity::SEV_WARNING) == 2);
+    ASSERT_ALWAYS(log_view_size(1 << (u32)Log_Severity::SEV_ERROR) == 1);
+    ASSERT_ALWAYS(log_view_size(1 << (u32)Log_Severity::SEV_DEBUG) == 1);
+    Log_Record const *r = log_view_get(LOG_ALL_SEVERITIES, 1);
+    ASSERT_ALWAYS((stref_s("second") == string_ref{r->text, r->len}));
+    r = log_view_get(1 << (u32)Log_Severity::SEV_ERROR, 0);
+    ASSERT_ALWAYS(r->len == LOG_LINE_MAX && r->text[LOG_LINE_MAX - 1] == 'x');
+    u32 mask = (1 << (u32)Log_Severity::SEV_WARNING) | (1 << (u32)Log_Severity::SEV_DEBUG);
+    ASSERT_ALWAYS(log_view_size(mask) == 3);
+    r = log_view_get(mask, 2);
+    ASSERT_ALWAYS((stref_s("debug") == string_ref{r->text, r->len}));
+    log_clear();
+    ito(LOG_ALL_SEVERITIES + 1) ASSERT_ALWAYS(log_view_size(i) == 0);
+  }
+  {
+    // Producers never block, every message is either kept in order or counted as dropped
+    u32 const         NUM_THREADS = 4;
+    u32 const         N           = 2000;
+    u64               dropped     = log_get_dropped();
+    std::atomic<u32>  finished{0};
+    std::thread       threads[NUM_THREADS];
+    ito(NUM_THREADS) {
+      threads[i] = std::thread([&, i] {
+        jto(N) log_push((Log_Severity)(j % LOG_NUM_SEVERITIES), "producer %u %u", i, j);
+        finished.fetch_add(1);
+      });
+    }
+    while (finished.load() != NUM_THREADS) log_drain();
+    ito(NUM_THREADS) threads[i].join();
+    log_drain();
+    u32 size = log_view_size(LOG_ALL_SEVERITIES);
+    ASSERT_ALWAYS(size + (log_get_dropped() - dropped) == NUM_THREADS * N);
+    u32 last[NUM_THREADS];
+    ito(NUM_THREADS) last[i] = ~0u;
+    ito(size) {
+      Log_Record const *r = log_view_get(LOG_ALL_SEVERITIES, i);
+      char              buf[LOG_LINE_MAX + 1];
+      memcpy(buf, r->text, r->len);
+      buf[r->len] = '\0';
+      u32 producer, line;
+      ASSERT_ALWAYS(sscanf(buf, "producer %u %u", &producer, &line) == 2);
+      ASSERT_ALWAYS(producer < NUM_THREADS && (u32)r->severity == line % LOG_NUM_SEVERITIES);
+      ASSERT_ALWAYS(last[producer] == ~0u || line > last[producer]);
+      last[producer] = line;
+    }
+    u32 per_severity = 0;
+    ito(LOG_NUM_SEVERITIES) per_severity += log_view_size(1 << i);
+    ASSERT_ALWAYS(per_severity == size);
+    log_clear();
+  }
+  {
+    // The draining thread never drops, the history keeps the newest lines
+    u32 const N       = 20000;
+    u64       dropped = log_get_dropped();
+    ito(N) log_push(Log_Severity::SEV_DEBUG, "%u", i);
+    log_drain();
+    ASSERT_ALWAYS(log_get_dropped() == dropped);
+    u32 size = log_view_size(LOG_ALL_SEVERITIES);
+    ASSERT_ALWAYS(size != 0 && size < N);
+    ASSERT_ALWAYS(log_view_size(1 << (u32)Log_Severity::SEV_DEBUG) == size);
+    ito(size) {
+      Log_Record const *r = log_view_get(1 << (u32)Log_Severity::SEV_DEBUG, i);
+      char              buf[0x20];
+      snprintf(buf, sizeof(buf), "%u", N - size + i);
+      ASSERT_ALWAYS((stref_s(buf) == string_ref{r->text, r->len}));
+    }
+    // Any other thread drops once the ring is full
+    std::thread([] { ito(1 << 16) log_push(Log_Severity::SEV_ERROR, "flood"); }).join();
+    ASSERT_ALWAYS(log_get_dropped() > dropped);
+    log_drain();
+    ASSERT_ALWAYS(log_view_size(1 << (u32)Log_Severity::SEV_ERROR) + log_get_dropped() - dropped ==
+                  1 << 16);
+    log_clear();
+  }
+  {
+    // Perfect hash lookups only match their own keys
+    static constexpr char const *keys[] = {
+        "add", "add_node", "add_link", "add_input_slot", "add_output_slot",
+        "set_node_position", "set_node_size", "a", "Gfx/DrawCall", "Gfx/Pass",
+    };
+    static constexpr Perfect_Hash<ARRAY_SIZE(keys)> hash{keys};
+    static_assert(hash.index("set_node_size") == 6, "");
+    ito(ARRAY_SIZE(keys)) ASSERT_ALWAYS(hash.find(stref_s(keys[i])) == (i32)i);
+    ASSERT_ALWAYS(hash.find(stref_s("ad")) == -1);
+    ASSERT_ALWAYS(hash.find(stref_s("add_nodf")) == -1);
+    ASSERT_ALWAYS(hash.find(stref_s("set_node_positiom")) == -1);
+    ASSERT_ALWAYS(hash.find(stref_s("")) == -1);
+    ASSERT_ALWAYS(hash.find(string_ref{}) == -1);
+    char buf[0x10];
+    ito(1000) {
+      snprintf(buf, sizeof(buf), "k%u", i);
+      ASSERT_ALWAYS(hash.find(stref_s(buf)) == -1);
+    }
+  }
+  {
+    // Radix sort matches a stable reference order, serially and across workers
+    u32 const N = 50000;
+    struct Item {
+      u64 key;
+      u32 index;
+    };
+    u32 * keys32     = (u32 *)tl_alloc(sizeof(u32) * N);
+    u64 * keys64     = (u64 *)tl_alloc(sizeof(u64) * N);
+    u32 * keys32_tmp = (u32 *)tl_alloc(sizeof(u32) * N);
+    u64 * keys64_tmp = (u64 *)tl_alloc(sizeof(u64) * N);
+    Item *items      = (Item *)tl_alloc(sizeof(Item) * N);
+    Item *items_tmp  = (Item *)tl_alloc(sizeof(Item) * N);
+    u32 * counts     = (u32 *)tl_alloc(sizeof(u32) * 0x10000);
+    ito(2) {
+      if (i == 1) jobs_init(4);
+      u64 state = 0x9e3779b97f4a7c15ull;
+      jto(N) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        // Few distinct low bytes so that stability is visible and some passes are skipped
+        keys64[j] = (state & 0xffff000000000000ull) | ((state >> 8) & 0x0f);
+        keys32[j] = (u32)(keys64[j] >> 48);
+        items[j]  = Item{keys64[j], (u32)j};
+      }
+      radix_sort(keys64, items, N, keys64_tmp, items_tmp, 1 << 10);
+      jto(N) ASSERT_ALWAYS(items[j].key == keys64[j]);
+      for (u32 j = 1; j < N; j++) {
+        ASSERT_ALWAYS(keys64[j - 1] <= keys64[j]);
+        if (keys64[j - 1] == keys64[j]) ASSERT_ALWAYS(items[j - 1].index < items[j].index);
+      }
+      // Counting sort reference for the 16 bit keys
+      memset(counts, 0, sizeof(u32) * 0x10000);
+      jto(N) counts[keys32[j]]++;
+      jto(N) items[j] = Item{keys32[j], (u32)j};
+      radix_sort(keys32, items, N, keys32_tmp, items_tmp, 1 << 10);
+      u32 cursor = 0;
+      jto(0x10000) {
+        for (u32 k = 0; k < counts[j]; k++, cursor++) {
+          ASSERT_ALWAYS(keys32[cursor] == j && items[cursor].key == j);
+          if (k != 0) ASSERT_ALWAYS(items[cursor - 1].index < items[cursor].index);
+        }
+      }
+      ASSERT_ALWAYS(cursor == N);
+      if (i == 1) jobs_release();
+    }
+    f32 floats[] = {3.0f, -1.0f, 0.0f, -0.0f, 1.0e-30f, -2.5e10f, 7.0f, -1.0e-30f};
+    u32 fkeys[ARRAY_SIZE(floats)], fkeys_tmp[ARRAY_SIZE(floats)];
+    f32 floats_tmp[ARRAY_SIZE(floats)];
+    ito(ARRAY_SIZE(floats)) fkeys[i] = radix_key_f32(floats[i]);
+    radix_sort(fkeys, floats, ARRAY_SIZE(floats), fkeys_tmp, floats_tmp);
+    for (u32 i = 1; i < ARRAY_SIZE(floats); i++) ASSERT_ALWAYS(floats[i - 1] <= floats[i]);
+    ASSERT_ALWAYS(floats[0] == -2.5e10f && floats[ARRAY_SIZE(floats) - 1] == 7.0f);
+
+    char const *names[] = {"new node #10", "new node #2", "b",  "new node #1", "",
+                           "new node #10", "a_long_name_past_16_bytes_b",
+                           "a_long_name_past_16_bytes_a", "new node"};
+    string_ref  strs[ARRAY_SIZE(names)];
+    u32         order[ARRAY_SIZE(names)];
+    ito(ARRAY_SIZE(names)) strs[i] = stref_s(names[i]);
+    radix_sort_strings(strs, ARRAY_SIZE(names), order);
+    for (u32 i = 1; i < ARRAY_SIZE(names); i++) {
+      i32 cmp = strcmp(names[order[i - 1]], names[order[i]]);
+      ASSERT_ALWAYS(cmp < 0 || (cmp == 0 && order[i - 1] < order[i]));
+    }
+    tl_free(keys32);
+    tl_free(keys64);
+    tl_free(keys32_tmp);
+    tl_free(keys64_tmp);
+    tl_free(items);
+    tl_free(items_tmp);
+    tl_free(counts);
+  }
+  {
+    u32 policies[] = {0, POOL_BACKING_PREFAULT, POOL_BACKING_HUGE_PAGES,
+                      POOL_BACKING_HUGE_PAGES | POOL_BACKING_PREFAULT};
+    for (u32 backing : policies) {
+      for (i32 numa_node = -1; numa_node <= 0; numa_node++) {
+        Pool<u32> pool = Pool<u32>::create((3 << 18) + 1, backing, numa_node);
+        if ((backing & POOL_BACKING_HUGE_PAGES) != 0) {
+          ASSERT_ALWAYS(((size_t)pool.ptr & (HUGE_PAGE_SIZE - 1)) == 0);
+          ASSERT_ALWAYS((pool.mem_length & (HUGE_PAGE_SIZE - 1)) == 0);
+        }
+        pool.enter_scope();
+        u32 *vals = pool.alloc(3 << 18);
+        ito(3 << 18) vals[i] = (u32)i;
+        ito(3 << 18) ASSERT_ALWAYS(*pool.at((u32)i) == (u32)i);
+        pool.exit_scope();
+        pool.release();
+      }
+    }
   }
   ASSERT_ALWAYS(Test_Allocator::total_alloced == 0);
   fprintf(stdout, "[SUCCESS]\n");
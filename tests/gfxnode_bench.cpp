@@ -0,0 +1,426 @@
+#define UTILS_IMPL
+#include "../node_editor.h"
+#include "../script.hpp"
+#include "../utils.hpp"
+#include <chrono>
+#include <stdio.h>
+
+// Micro benchmarks of the containers, the parser and the evaluator
+// Usage: gfxnode_bench [--filter substr] [--runs n] [--json out.json] [--compare baseline.json]
+//                      [--threshold percent]
+// Every case runs a warm-up and then `runs` timed samples, statistics are over the per-operation
+// time of the samples. --compare reads a file written by --json and exits with 1 when a median
+// got slower by more than the threshold.
+
+#ifndef GFXNODE_SOURCE_DIR
+#define GFXNODE_SOURCE_DIR "."
+#endif
+
+// The evaluator reports through the Scene, main.cpp isn't linked in
+static u32 g_num_script_errors;
+void       Scene::push_warning(char const *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  log_pushv(Log_Severity::SEV_WARNING, fmt, args);
+  va_end(args);
+}
+void Scene::push_debug_message(char const *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  log_pushv(Log_Severity::SEV_DEBUG, fmt, args);
+  va_end(args);
+}
+void Scene::push_error(char const *fmt, ...) {
+  g_num_script_errors++;
+  va_list args;
+  va_start(args, fmt);
+  log_pushv(Log_Severity::SEV_ERROR, fmt, args);
+  va_end(args);
+}
+void Context2D::imcanvas_start() {}
+void Context2D::imcanvas_end() {}
+
+static u64 bench_now_ns() {
+  return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Keeps results alive so the timed loops aren't optimized out
+static volatile u64 g_sink;
+
+static constexpr u32 NUM_KEYS = 1 << 16;
+static u64 *         g_u64_keys;
+static string_ref *  g_str_keys;
+static char *        g_str_storage;
+static char *        g_float_text;
+static char *        g_script_text;
+static char *        g_loop_text;
+
+// A case returns the nanoseconds spent in its timed part and sets the number of operations
+typedef u64 (*Bench_Fn)(u32 *num_ops);
+
+static u64 bench_array_push_pop(u32 *num_ops) {
+  Array<u32> arr;
+  arr.init();
+  u64 start = bench_now_ns();
+  ito(NUM_KEYS) arr.push(i);
+  u64 sum = 0;
+  ito(NUM_KEYS) sum += arr.pop();
+  u64 ns = bench_now_ns() - start;
+  arr.release();
+  g_sink   = sum;
+  *num_ops = NUM_KEYS * 2;
+  return ns;
+}
+
+template <typename K> static u64 bench_set_insert(K const *keys, u32 *num_ops) {
+  Hash_Set<K> set;
+  set.init();
+  u64 start = bench_now_ns();
+  ito(NUM_KEYS) set.insert(keys[i]);
+  u64 ns = bench_now_ns() - start;
+  set.release();
+  *num_ops = NUM_KEYS;
+  return ns;
+}
+
+// Half of the lookups miss
+template <typename K> static u64 bench_set_find(K const *keys, u32 *num_ops) {
+  Hash_Set<K> set;
+  set.init();
+  ito(NUM_KEYS / 2) set.insert(keys[i]);
+  u64 start = bench_now_ns();
+  u64 found = 0;
+  ito(NUM_KEYS) found += set.contains(keys[i]) ? 1 : 0;
+  u64 ns = bench_now_ns() - start;
+  ASSERT_ALWAYS(found == NUM_KEYS / 2);
+  set.release();
+  *num_ops = NUM_KEYS;
+  return ns;
+}
+
+template <typename K> static u64 bench_set_remove(K const *keys, u32 *num_ops) {
+  Hash_Set<K> set;
+  set.init();
+  ito(NUM_KEYS) set.insert(keys[i]);
+  u64 start = bench_now_ns();
+  ito(NUM_KEYS) set.remove(keys[i]);
+  u64 ns = bench_now_ns() - start;
+  ASSERT_ALWAYS(set.item_count == 0);
+  set.release();
+  *num_ops = NUM_KEYS;
+  return ns;
+}
+
+static u64 bench_u64_insert(u32 *num_ops) { return bench_set_insert(g_u64_keys, num_ops); }
+static u64 bench_u64_find(u32 *num_ops) { return bench_set_find(g_u64_keys, num_ops); }
+static u64 bench_u64_remove(u32 *num_ops) { return bench_set_remove(g_u64_keys, num_ops); }
+static u64 bench_str_insert(u32 *num_ops) { return bench_set_insert(g_str_keys, num_ops); }
+static u64 bench_str_find(u32 *num_ops) { return bench_set_find(g_str_keys, num_ops); }
+static u64 bench_str_remove(u32 *num_ops) { return bench_set_remove(g_str_keys, num_ops); }
+
+// Small allocations in nested scopes, the pattern of the render and list storages
+static u64 bench_pool_alloc(u32 *num_ops) {
+  static Pool<u8> pool = Pool<u8>::create(1 << 24);
+  u64             sum  = 0;
+  u64             start = bench_now_ns();
+  ito(NUM_KEYS / 0x40) {
+    pool.enter_scope();
+    jto(0x40) {
+      u8 *ptr = pool.alloc(0x10 + ((i + j) & 0x3f));
+      ptr[0]  = (u8)j;
+      sum += ptr[0];
+    }
+    pool.exit_scope();
+  }
+  u64 ns = bench_now_ns() - start;
+  ASSERT_ALWAYS(pool.cursor == 0);
+  g_sink   = sum;
+  *num_ops = NUM_KEYS;
+  return ns;
+}
+
+// One operation is one node of the parsed script
+static u64 bench_list_parse(u32 *num_ops) {
+  // Kept between runs like the pools it replaced, parsing reuses the capacity
+  static Ast ast;
+  u64        start = bench_now_ns();
+  bool       ok    = ast.parse(stref_s(g_script_text));
+  u64        ns    = bench_now_ns() - start;
+  ASSERT_ALWAYS(ok);
+  *num_ops = ast.size;
+  return ns;
+}
+
+static u64 bench_parse_float(u32 *num_ops) {
+  u64         start = bench_now_ns();
+  f32         sum   = 0.0f;
+  char const *cur   = g_float_text;
+  ito(NUM_KEYS) {
+    size_t len = strlen(cur);
+    f32    val;
+    ASSERT_ALWAYS(parse_float(cur, len, &val));
+    sum += val;
+    cur += len + 1;
+  }
+  u64 ns = bench_now_ns() - start;
+  g_sink = (u64)sum;
+  *num_ops = NUM_KEYS;
+  return ns;
+}
+
+// One operation is one whole script run on a fresh scene
+static u64 bench_run_script(char const *name, char const *text, u32 *num_ops) {
+  Scene *scene = Scene::get_scene();
+  scene->reset();
+  scene->add_source(name, text);
+  u32 num_errors = g_num_script_errors;
+  u64 start      = bench_now_ns();
+  scene->run_script(name);
+  u64 ns = bench_now_ns() - start;
+  ASSERT_ALWAYS(g_num_script_errors == num_errors);
+  *num_ops = 1;
+  return ns;
+}
+
+static u64 bench_eval_scene_lsp(u32 *num_ops) {
+  static Mapped_File file = [] {
+    Mapped_File f;
+    ASSERT_ALWAYS(f.init(GFXNODE_SOURCE_DIR "/scene.lsp"));
+    return f;
+  }();
+  // add_source copies, the text only needs to be terminated for stref_s
+  char *text = (char *)tl_alloc_tmp(file.size + 1);
+  memcpy(text, file.ptr, file.size);
+  text[file.size] = '\0';
+  return bench_run_script("scene", text, num_ops);
+}
+
+static u64 bench_eval_nodes(u32 *num_ops) {
+  return bench_run_script("nodes", g_script_text, num_ops);
+}
+static u64 bench_eval_loop(u32 *num_ops) { return bench_run_script("loop", g_loop_text, num_ops); }
+
+struct Bench_Case {
+  char const *name;
+  Bench_Fn    fn;
+};
+
+static Bench_Case g_cases[] = {
+    {"array_push_pop", bench_array_push_pop},
+    {"hash_set_u64_insert", bench_u64_insert},
+    {"hash_set_u64_find", bench_u64_find},
+    {"hash_set_u64_remove", bench_u64_remove},
+    {"hash_set_str_insert", bench_str_insert},
+    {"hash_set_str_find", bench_str_find},
+    {"hash_set_str_remove", bench_str_remove},
+    {"pool_alloc_scopes", bench_pool_alloc},
+    {"list_parse", bench_list_parse},
+    {"parse_float", bench_parse_float},
+    {"eval_scene_lsp", bench_eval_scene_lsp},
+    {"eval_nodes", bench_eval_nodes},
+    {"eval_loop", bench_eval_loop},
+};
+
+struct Bench_Stats {
+  char name[0x40];
+  u32  runs;
+  u32  ops;
+  f64  min_ns;
+  f64  median_ns;
+  f64  mean_ns;
+  f64  stddev_ns;
+  f64  p90_ns;
+};
+
+static Bench_Stats bench_run(Bench_Case const &c, u32 runs) {
+  TMP_STORAGE_SCOPE;
+  f64 *samples = (f64 *)tl_alloc_tmp(sizeof(f64) * runs);
+  u32  num_ops = 0;
+  c.fn(&num_ops);
+  ito(runs) {
+    u64 ns     = c.fn(&num_ops);
+    samples[i] = (f64)ns / (f64)MAX(num_ops, 1u);
+  }
+  // Insertion sort, there are only a few dozen samples
+  for (u32 i = 1; i < runs; i++) {
+    f64 val = samples[i];
+    u32 j   = i;
+    for (; j > 0 && samples[j - 1] > val; j--) samples[j] = samples[j - 1];
+    samples[j] = val;
+  }
+  Bench_Stats stats;
+  MEMZERO(stats);
+  snprintf(stats.name, sizeof(stats.name), "%s", c.name);
+  stats.runs      = runs;
+  stats.ops       = num_ops;
+  stats.min_ns    = samples[0];
+  stats.median_ns = runs % 2 == 1 ? samples[runs / 2]
+                                  : (samples[runs / 2 - 1] + samples[runs / 2]) * 0.5;
+  stats.p90_ns    = samples[MIN(runs - 1, (runs * 9) / 10)];
+  ito(runs) stats.mean_ns += samples[i];
+  stats.mean_ns /= (f64)runs;
+  ito(runs) stats.stddev_ns += (samples[i] - stats.mean_ns) * (samples[i] - stats.mean_ns);
+  stats.stddev_ns = runs > 1 ? sqrt(stats.stddev_ns / (f64)(runs - 1)) : 0.0;
+  return stats;
+}
+
+// One case per line, bench_read_json relies on that
+static bool bench_write_json(char const *path, Bench_Stats const *stats, u32 count) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) return false;
+  fprintf(file, "{\"cases\": [\n");
+  ito(count) {
+    Bench_Stats const &s = stats[i];
+    fprintf(file,
+            "{\"name\": \"%s\", \"runs\": %u, \"ops\": %u, \"min_ns\": %.4f, \"median_ns\": %.4f, "
+            "\"mean_ns\": %.4f, \"stddev_ns\": %.4f, \"p90_ns\": %.4f}%s\n",
+            s.name, s.runs, s.ops, s.min_ns, s.median_ns, s.mean_ns, s.stddev_ns, s.p90_ns,
+            i + 1 == count ? "" : ",");
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+  return true;
+}
+
+static u32 bench_read_json(char const *path, Bench_Stats *stats, u32 max_count) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return 0;
+  char line[0x200];
+  u32  count = 0;
+  while (count < max_count && fgets(line, sizeof(line), file) != NULL) {
+    Bench_Stats &s = stats[count];
+    if (sscanf(line,
+               "{\"name\": \"%63[^\"]\", \"runs\": %u, \"ops\": %u, \"min_ns\": %lf, "
+               "\"median_ns\": %lf, \"mean_ns\": %lf, \"stddev_ns\": %lf, \"p90_ns\": %lf",
+               s.name, &s.runs, &s.ops, &s.min_ns, &s.median_ns, &s.mean_ns, &s.stddev_ns,
+               &s.p90_ns) == 8)
+      count++;
+  }
+  fclose(file);
+  return count;
+}
+
+static void bench_init_data() {
+  g_u64_keys    = (u64 *)tl_alloc(sizeof(u64) * NUM_KEYS);
+  g_str_keys    = (string_ref *)tl_alloc(sizeof(string_ref) * NUM_KEYS);
+  g_str_storage = (char *)tl_alloc(NUM_KEYS * 0x20);
+  g_float_text  = (char *)tl_alloc(NUM_KEYS * 0x20);
+  u64   state   = 0x2545f4914f6cdd1dull;
+  char *cur     = g_str_storage;
+  char *fcur    = g_float_text;
+  ito(NUM_KEYS) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    g_u64_keys[i] = state;
+    i32 len       = snprintf(cur, 0x20, "node_%llx", (unsigned long long)(state & 0xffffffffff));
+    g_str_keys[i] = string_ref{cur, (size_t)len};
+    cur += len + 1;
+    fcur += snprintf(fcur, 0x20, "%.6f", (f64)(state & 0xfffff) / 1024.0 - 512.0) + 1;
+  }
+
+  // The shape of a saved scene with slots and links. Every node adds a let binding and the
+  // evaluator's symbol table holds 1K of them
+  u32 const NUM_NODES = 1 << 9;
+  g_script_text       = (char *)tl_alloc(NUM_NODES * 0x200);
+  cur                 = g_script_text;
+  cur += sprintf(cur, "(main\n");
+  ito(NUM_NODES) {
+    cur += sprintf(cur,
+                   "  (let node_%u (add_node \"node_%u\" \"Gfx/DrawCall\"))\n"
+                   "  (set_node_position node_%u %u.5 %u.25)\n"
+                   "  (set_node_size node_%u 1.000000 1.000000)\n"
+                   "  (add_input_slot node_%u \"in\")\n"
+                   "  (add_output_slot node_%u \"out\")\n",
+                   i, i, i, i, i * 3, i, i, i);
+    if (i != 0) cur += sprintf(cur, "  (add_link node_%u 1 node_%u 1)\n", i - 1, i);
+  }
+  cur += sprintf(cur, "  (move_camera 0.0 0.0 8.0)\n)\n");
+
+  g_loop_text = (char *)tl_alloc(0x200);
+  sprintf(g_loop_text, "(main\n"
+                       "  (for i 0 10000\n"
+                       "    (let x (add (mul i 3) 7))\n"
+                       "    (let y (add (mul (itof x) 0.5) 1.0))\n"
+                       "  )\n"
+                       ")\n");
+}
+
+int main(int argc, char **argv) {
+  char const *filter    = NULL;
+  char const *json_path = NULL;
+  char const *baseline  = NULL;
+  u32         runs      = 15;
+  f64         threshold = 5.0;
+  for (i32 i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = (u32)atoi(argv[++i]);
+      runs = MAX(runs, 1u);
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      json_path = argv[++i];
+    } else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc) {
+      baseline = argv[++i];
+    } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+      threshold = atof(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "usage: %s [--filter substr] [--runs n] [--json out.json] [--compare baseline.json] "
+              "[--threshold percent]\n",
+              argv[0]);
+      return 2;
+    }
+  }
+  bench_init_data();
+
+  u32 const   MAX_CASES = ARRAY_SIZE(g_cases);
+  Bench_Stats stats[MAX_CASES];
+  u32         num_stats = 0;
+  fprintf(stdout, "%-24s %10s %12s %12s %12s %12s %8s\n", "case", "ops", "min ns/op",
+          "median", "mean", "p90", "cv %");
+  for (Bench_Case const &c : g_cases) {
+    if (filter != NULL && strstr(c.name, filter) == NULL) continue;
+    Bench_Stats s        = bench_run(c, runs);
+    stats[num_stats++] = s;
+    fprintf(stdout, "%-24s %10u %12.3f %12.3f %12.3f %12.3f %8.2f\n", s.name, s.ops, s.min_ns,
+            s.median_ns, s.mean_ns, s.p90_ns,
+            s.mean_ns > 0.0 ? 100.0 * s.stddev_ns / s.mean_ns : 0.0);
+  }
+  if (json_path != NULL && !bench_write_json(json_path, stats, num_stats)) {
+    fprintf(stderr, "Can't write %s\n", json_path);
+    return 2;
+  }
+
+  i32 result = 0;
+  if (baseline != NULL) {
+    Bench_Stats base[MAX_CASES];
+    u32         num_base = bench_read_json(baseline, base, MAX_CASES);
+    if (num_base == 0) {
+      fprintf(stderr, "Can't read %s\n", baseline);
+      return 2;
+    }
+    fprintf(stdout, "\n%-24s %12s %12s %9s\n", "case", "baseline", "median", "delta");
+    ito(num_stats) {
+      Bench_Stats const *b = NULL;
+      jto(num_base) if (strcmp(base[j].name, stats[i].name) == 0) b = &base[j];
+      if (b == NULL) {
+        fprintf(stdout, "%-24s %12s %12.3f\n", stats[i].name, "-", stats[i].median_ns);
+        continue;
+      }
+      f64         delta   = 100.0 * (stats[i].median_ns - b->median_ns) / b->median_ns;
+      char const *verdict = "";
+      if (delta > threshold) {
+        verdict = "slower";
+        result  = 1;
+      } else if (delta < -threshold) {
+        verdict = "faster";
+      }
+      fprintf(stdout, "%-24s %12.3f %12.3f %+8.2f%% %s\n", stats[i].name, b->median_ns,
+              stats[i].median_ns, delta, verdict);
+    }
+  }
+  return result;
+}
@@ -0,0 +1,111 @@
+#define UTILS_IMPL
+#include "../utils.hpp"
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+
+// Runs the same workloads with 1 to N workers and prints the speedup over one worker
+
+struct Bench_Item {
+  float x0, y0, x1, y1;
+  float r, g, b;
+  u32   flags;
+};
+
+static f64 bench_ms(void (*fn)(), u32 num_runs) {
+  f64 best = 1.0e30;
+  ito(num_runs) {
+    auto start = std::chrono::high_resolution_clock::now();
+    fn();
+    auto end = std::chrono::high_resolution_clock::now();
+    f64  ms  = std::chrono::duration<f64, std::milli>(end - start).count();
+    best     = MIN(best, ms);
+  }
+  return best;
+}
+
+static constexpr u32 NUM_FLOATS = 1 << 24;
+static constexpr u32 NUM_ITEMS  = 1 << 20;
+static float *       g_floats;
+static Bench_Item *  g_items;
+static Bench_Item *  g_out;
+
+// Compute bound, a few dozen flops per element. Blocks of 16 have a constant trip count so the
+// loop vectorizes at -O2 whether or not the range is known
+static void bench_compute() {
+  parallel_for(0, NUM_FLOATS / 16, 1 << 10, [](u32 begin, u32 end) {
+    for (u32 block = begin; block < end; block++) {
+      float *floats = g_floats + block * 16;
+      jto(8) {
+        for (u32 k = 0; k < 16; k++) floats[k] = floats[k] * (floats[k] * 0.25f + 0.5f) + 0.125f;
+      }
+      for (u32 k = 0; k < 16; k++) floats[k] = floats[k] / (1.0f + floats[k] * floats[k]);
+    }
+  });
+}
+
+// Memory bound, the cull and convert pass of the renderer
+static void bench_compact() {
+  u32 kept = parallel_compact(g_out, NUM_ITEMS, 1 << 12, [](u32 i, Bench_Item *dst) {
+    Bench_Item item = g_items[i];
+    if (item.x1 < 0.0f || item.y1 < 0.0f) return false;
+    item.x0 = 2.0f * item.x0 - 1.0f;
+    item.y0 = -2.0f * item.y0 + 1.0f;
+    *dst    = item;
+    return true;
+  });
+  ASSERT_ALWAYS(kept != 0);
+}
+
+// 64K single item jobs, measures the scheduling overhead. Goes through the deques even with one
+// worker, parallel_for would run it inline
+static std::atomic<u32> g_tiny_sum;
+static void bench_tiny() {
+  g_tiny_sum = 0;
+  Job_Group group;
+  jobs_run(
+      &group, [](void *, u32 begin, u32 end) { g_tiny_sum += end - begin; }, NULL, 0, 1 << 16, 1);
+  jobs_wait(&group);
+  ASSERT_ALWAYS(g_tiny_sum.load() == 1 << 16);
+}
+
+int main(int argc, char **argv) {
+  u32 max_workers = argc > 1 ? (u32)atoi(argv[1]) : std::thread::hardware_concurrency();
+  max_workers     = MAX(max_workers, 1u);
+  g_floats        = (float *)tl_alloc(sizeof(float) * NUM_FLOATS);
+  g_items         = (Bench_Item *)tl_alloc(sizeof(Bench_Item) * NUM_ITEMS);
+  g_out           = (Bench_Item *)tl_alloc(sizeof(Bench_Item) * NUM_ITEMS);
+  ito(NUM_FLOATS) g_floats[i] = (float)(i & 0xff) / 256.0f;
+  ito(NUM_ITEMS) {
+    g_items[i] = Bench_Item{(float)i, (float)i, (float)((i * 7) % 13) - 4.0f, 1.0f,
+                            0.5f,     0.5f,     0.5f, (u32)i};
+  }
+  struct Bench {
+    char const *name;
+    void (*fn)();
+    f64 base_ms;
+  } benches[] = {
+      {"compute", bench_compute, 0.0},
+      {"compact", bench_compact, 0.0},
+      {"tiny", bench_tiny, 0.0},
+  };
+  fprintf(stdout, "workers");
+  for (Bench &b : benches) fprintf(stdout, " %20s", b.name);
+  fprintf(stdout, "\n");
+  for (u32 num_workers = 1; num_workers <= max_workers; num_workers++) {
+    jobs_init(num_workers);
+    fprintf(stdout, "%7u", num_workers);
+    for (Bench &b : benches) {
+      b.fn();
+      f64 ms = bench_ms(b.fn, 7);
+      if (num_workers == 1) b.base_ms = ms;
+      fprintf(stdout, " %9.3fms (%5.2fx)", ms, b.base_ms / ms);
+    }
+    fprintf(stdout, "\n");
+    jobs_release();
+  }
+  tl_free(g_floats);
+  tl_free(g_items);
+  tl_free(g_out);
+  return 0;
+}
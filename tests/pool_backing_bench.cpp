@@ -0,0 +1,156 @@
+#define UTILS_IMPL
+#include "../utils.hpp"
+#include <chrono>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+
+// Frame of 1M primitives on pools with each backing policy: creation time, the first frame that
+// touches fresh pages, the best of the following frames, page faults and dTLB misses per frame.
+// Usage: pool_backing_bench [numa_node]
+
+struct Bench_Rect {
+  float x, y, z, width, height;
+  float r, g, b;
+  bool  world_space;
+};
+
+struct Bench_Instance {
+  float x, y, z, w;
+  float r, g, b;
+  float width, height;
+};
+
+static constexpr u32 NUM_PRIMITIVES = 1 << 20;
+
+static f64 bench_now_ms() {
+  return std::chrono::duration<f64, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static u64 bench_minor_faults() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (u64)usage.ru_minflt;
+}
+
+// -1 when the kernel doesn't expose the counter, e.g. in containers and VMs
+static int bench_open_dtlb_counter() {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type           = PERF_TYPE_HW_CACHE;
+  attr.size           = sizeof(attr);
+  attr.config         = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  attr.disabled       = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv     = 1;
+  attr.inherit        = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+struct Bench_Frame {
+  f64 ms;
+  u64 faults;
+  i64 dtlb_misses;
+};
+
+// Fills the primitive pool and runs the cull and convert pass of the renderer into the instance
+// pool, like Context2D does every frame
+static Bench_Frame bench_frame(Pool<Bench_Rect> *rects, Pool<Bench_Instance> *instances,
+                               int dtlb_fd) {
+  Bench_Frame frame;
+  u64         faults = bench_minor_faults();
+  if (dtlb_fd >= 0) {
+    ioctl(dtlb_fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(dtlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  f64 start = bench_now_ms();
+  rects->enter_scope();
+  instances->enter_scope();
+  ito(NUM_PRIMITIVES) {
+    f32 x = (f32)(i & 0x3ff);
+    f32 y = (f32)(i >> 10);
+    rects->push(Bench_Rect{x, y, (f32)(i & 7) / 256.0f, 1.0f, 1.0f, 0.5f, 0.5f, 0.5f, true});
+  }
+  Bench_Instance *dst = instances->alloc(NUM_PRIMITIVES);
+  u32 kept = parallel_compact(dst, NUM_PRIMITIVES, 1 << 12, [&](u32 i, Bench_Instance *out) {
+    Bench_Rect r = *rects->at(i);
+    if (r.x > 1000.0f) return false;
+    *out = Bench_Instance{r.x, r.y, r.z, 1.0f, r.r, r.g, r.b, r.width, r.height};
+    return true;
+  });
+  ASSERT_ALWAYS(kept != 0);
+  instances->exit_scope();
+  rects->exit_scope();
+  frame.ms          = bench_now_ms() - start;
+  frame.faults      = bench_minor_faults() - faults;
+  frame.dtlb_misses = -1;
+  if (dtlb_fd >= 0) {
+    ioctl(dtlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+    u64 count = 0;
+    if (read(dtlb_fd, &count, sizeof(count)) == sizeof(count)) frame.dtlb_misses = (i64)count;
+  }
+  return frame;
+}
+
+static void bench_print_counter(i64 val) {
+  if (val < 0)
+    fprintf(stdout, " %12s", "n/a");
+  else
+    fprintf(stdout, " %12lli", (long long)val);
+}
+
+int main(int argc, char **argv) {
+  i32 numa_node = argc > 1 ? atoi(argv[1]) : -1;
+  jobs_init();
+  char  thp[0x100] = "unknown";
+  FILE *file       = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "rb");
+  if (file != NULL) {
+    size_t len = fread(thp, 1, sizeof(thp) - 1, file);
+    thp[len]   = '\0';
+    if (len != 0 && thp[len - 1] == '\n') thp[len - 1] = '\0';
+    fclose(file);
+  }
+  fprintf(stdout, "transparent_hugepage: %s, numa node: %i, workers: %u\n", thp, numa_node,
+          jobs_num_workers());
+  int dtlb_fd = bench_open_dtlb_counter();
+  struct Policy {
+    char const *name;
+    u32         backing;
+  } policies[] = {
+      {"default", 0},
+      {"prefault", POOL_BACKING_PREFAULT},
+      {"huge_pages", POOL_BACKING_HUGE_PAGES},
+      {"huge_pages+prefault", POOL_BACKING_HUGE_PAGES | POOL_BACKING_PREFAULT},
+  };
+  fprintf(stdout, "%-20s %10s %10s %12s %12s %10s %12s %12s\n", "policy", "create ms", "first ms",
+          "faults", "dtlb misses", "steady ms", "faults", "dtlb misses");
+  for (Policy const &policy : policies) {
+    f64                  start     = bench_now_ms();
+    Pool<Bench_Rect>     rects     = Pool<Bench_Rect>::create(NUM_PRIMITIVES + 1, policy.backing,
+                                                      numa_node);
+    Pool<Bench_Instance> instances = Pool<Bench_Instance>::create(NUM_PRIMITIVES + 1,
+                                                                  policy.backing, numa_node);
+    f64                  create_ms = bench_now_ms() - start;
+    Bench_Frame          first     = bench_frame(&rects, &instances, dtlb_fd);
+    Bench_Frame          steady    = bench_frame(&rects, &instances, dtlb_fd);
+    ito(4) {
+      Bench_Frame frame = bench_frame(&rects, &instances, dtlb_fd);
+      if (frame.ms < steady.ms) steady = frame;
+    }
+    fprintf(stdout, "%-20s %10.3f %10.3f %12llu", policy.name, create_ms, first.ms,
+            (unsigned long long)first.faults);
+    bench_print_counter(first.dtlb_misses);
+    fprintf(stdout, " %10.3f %12llu", steady.ms, (unsigned long long)steady.faults);
+    bench_print_counter(steady.dtlb_misses);
+    fprintf(stdout, "\n");
+    rects.release();
+    instances.release();
+  }
+  if (dtlb_fd >= 0) close(dtlb_fd);
+  jobs_release();
+  return 0;
+}
@@ -1,16 +1,23 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <atomic>
 #include <cstdlib>
 #include <malloc.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #if __linux__
 // UNIX headers
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 #define DLL_EXPORT __attribute__((visibility("default")))
@@ -119,9 +126,150 @@ template <typename F> __Defer__<F> defer_func(F f) { return __Defer__<F>(f); }
 #define xto(N) for (uint32_t x = 0; x < N; ++x)
 #define yto(N) for (uint32_t y = 0; y < N; ++y)
 
+/** Log-linear histogram in the style of HdrHistogram
+  Values below SUB_COUNT get a bucket each, above that every power of two range is split into
+  SUB_COUNT buckets. A reported percentile is at most 1/SUB_COUNT above the recorded value.
+ */
+struct Hdr_Histogram {
+  static constexpr u32 SUB_BITS    = 5;
+  static constexpr u32 SUB_COUNT   = 1 << SUB_BITS;
+  static constexpr u32 NUM_BUCKETS = (64 - SUB_BITS + 1) * SUB_COUNT;
+  u64                  counts[NUM_BUCKETS];
+  u64                  total;
+  u64                  min;
+  u64                  max;
+  f64                  sum;
+
+  static u32 get_bucket(u64 val) {
+    if (val < SUB_COUNT) return (u32)val;
+#if defined(_MSC_VER)
+    unsigned long msb;
+    _BitScanReverse64(&msb, val);
+#else
+    u32 msb = 63 - (u32)__builtin_clzll(val);
+#endif
+    return ((msb - SUB_BITS + 1) << SUB_BITS) | (u32)((val >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+  }
+  // Highest value that falls into `bucket`
+  static u64 get_bucket_max(u32 bucket) {
+    if (bucket < SUB_COUNT) return bucket;
+    u32 shift = (bucket >> SUB_BITS) - 1;
+    return ((u64)(SUB_COUNT + (bucket & (SUB_COUNT - 1))) << shift) + (((u64)1 << shift) - 1);
+  }
+  void reset() {
+    memset(this, 0, sizeof(*this));
+    min = UINT64_MAX;
+  }
+  void record(u64 val, u64 count = 1) {
+    counts[get_bucket(val)] += count;
+    total += count;
+    sum += (f64)val * (f64)count;
+    min = MIN(min, val);
+    max = MAX(max, val);
+  }
+  void merge(Hdr_Histogram const &that) {
+    ito(NUM_BUCKETS) counts[i] += that.counts[i];
+    total += that.total;
+    sum += that.sum;
+    min = MIN(min, that.min);
+    max = MAX(max, that.max);
+  }
+  f64 get_mean() { return total == 0 ? 0.0 : sum / (f64)total; }
+  /** Smallest bucket bound at or above `percentile` (0..100) of the samples, clamped to max
+   */
+  u64 get_percentile(f64 percentile) {
+    if (total == 0) return 0;
+    u64 target = (u64)(percentile * 0.01 * (f64)total + 0.5);
+    target     = CLAMP(target, 1, total);
+    u64 seen   = 0;
+    ito(NUM_BUCKETS) {
+      seen += counts[i];
+      if (seen >= target) return MIN(get_bucket_max(i), max);
+    }
+    return max;
+  }
+};
+
+/** Scoped profiler
+  Zones are marked with PERF_ENTER/PERF_EXIT pairs or PERF_SCOPE, which closes the zone when the
+  enclosing scope ends. PERF_HIST_ADD records a sample of a named value, PERF_HIST_SCOPE records
+  the duration of the enclosing scope in nanoseconds. `name` must outlive the profiler, pass
+  string literals.
+  Events go into a per-thread ring buffer, the oldest ones are overwritten. Samples also go into
+  a Hdr_Histogram per name. Compiled out unless PERF_ENABLE is defined.
+ */
+#ifdef PERF_ENABLE
+void perf_enter(char const *name);
+void perf_exit(char const *name);
+void perf_hist_add(char const *name, f64 val);
+u64  perf_get_time_ns();
+struct Perf_Hist_Timer {
+  char const *name;
+  u64         start;
+  Perf_Hist_Timer(char const *name) : name(name), start(perf_get_time_ns()) {}
+  ~Perf_Hist_Timer() { perf_hist_add(name, (f64)(perf_get_time_ns() - start)); }
+};
+#define PERF_HIST_ADD(name, val) perf_hist_add(name, (f64)(val))
+#define PERF_HIST_SCOPE(name) Perf_Hist_Timer DEFER_3(_perf_hist_)(name)
+#define PERF_ENTER(name) perf_enter(name)
+#define PERF_EXIT(name) perf_exit(name)
+#define PERF_SCOPE(name)                                                                           \
+  perf_enter(name);                                                                                \
+  defer(perf_exit(name))
+#else
 #define PERF_HIST_ADD(name, val)
+#define PERF_HIST_SCOPE(name)
 #define PERF_ENTER(name)
 #define PERF_EXIT(name)
+#define PERF_SCOPE(name)
+#endif
+/** Writes the events still in the ring buffers of all threads in Chrome trace event format
+  Returns false when the file can't be opened or the profiler is compiled out.
+ */
+bool perf_write_chrome_trace(char const *path);
+/** Names of the histograms fed by PERF_HIST_ADD, in order of the first sample
+ */
+u32 perf_get_histogram_names(char const **names, u32 max_names);
+/** Copies the histogram of `name`, returns false if there are no samples
+ */
+bool perf_get_histogram(char const *name, Hdr_Histogram *out);
+void perf_reset_histograms();
+
+/** Message log writable from any thread
+  Producers format on their own stack, then claim a cell of a bounded ring with a CAS and never
+  block: when the ring is full the message is dropped and counted. The thread that drains the
+  ring, normally the UI thread, empties it itself instead of dropping.
+  log_drain moves pending messages into a bounded history, the oldest lines are evicted. The
+  history keeps a line index per combination of severities, so a filtered view has random access
+  like the unfiltered one. Multi-line messages become one record per line, long lines are
+  truncated.
+ */
+enum class Log_Severity : u8 { SEV_DEBUG = 0, SEV_WARNING, SEV_ERROR };
+static constexpr u32 LOG_NUM_SEVERITIES = 3;
+// Masks are bit sets of 1 << severity
+static constexpr u32 LOG_ALL_SEVERITIES = (1 << LOG_NUM_SEVERITIES) - 1;
+static constexpr u32 LOG_LINE_MAX       = 232;
+struct Log_Record {
+  // Since the first message
+  u64          time_ns;
+  Log_Severity severity;
+  u16          len;
+  char         text[LOG_LINE_MAX];
+};
+void log_push(Log_Severity severity, char const *fmt, ...);
+void log_pushv(Log_Severity severity, char const *fmt, va_list args);
+/** Moves pending messages into the history, only call from one thread
+ */
+void log_drain();
+void log_clear();
+/** Number of history lines whose severity is in `mask`
+ */
+u32 log_view_size(u32 mask);
+/** Line `i` of the view of `mask`, oldest first
+  Valid until the next log_drain.
+ */
+Log_Record const *log_view_get(u32 mask, u32 i);
+u64               log_get_dropped();
 #define OK_FALLTHROUGH (void)0;
 #define TMP_STORAGE_SCOPE                                                                          \
   tl_alloc_tmp_enter();                                                                            \
@@ -171,18 +319,84 @@ static inline void map_pages(void *ptr, size_t num_pages) {
       mmap(ptr, num_pages * get_page_size(), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
   ASSERT_ALWAYS((size_t)new_ptr == (size_t)ptr);
 }
+
+/** Gives the physical pages back, the range stays reserved and faults until unprotected
+ */
+static inline void decommit_pages(void *ptr, size_t num_pages) {
+  madvise(ptr, num_pages * get_page_size(), MADV_DONTNEED);
+  mprotect(ptr, num_pages * get_page_size(), PROT_NONE);
+}
 #elif WIN32
 // TODO
 static inline void protect_pages(void *ptr, size_t num_pages) {}
 static inline void unprotect_pages(void *ptr, size_t num_pages, bool exec = false) {}
 static inline void unmap_pages(void *ptr, size_t num_pages) {}
 static inline void map_pages(void *ptr, size_t num_pages) {}
+static inline void decommit_pages(void *ptr, size_t num_pages) {}
 #else
 // Noops
 static inline void protect_pages(void *ptr, size_t num_pages) {}
 static inline void unprotect_pages(void *ptr, size_t num_pages, bool exec = false) {}
 static inline void unmap_pages(void *ptr, size_t num_pages) {}
 static inline void map_pages(void *ptr, size_t num_pages) {}
+static inline void decommit_pages(void *ptr, size_t num_pages) {}
+#endif
+
+/** Backing flags of Pool::create
+  HUGE_PAGES asks for transparent huge pages, the range is rounded and aligned to whole 2MB pages
+  so a frame's worth of primitives takes a handful of TLB entries. PREFAULT commits every page at
+  creation instead of faulting on first touch.
+ */
+static constexpr u32    POOL_BACKING_HUGE_PAGES = 1 << 0;
+static constexpr u32    POOL_BACKING_PREFAULT   = 1 << 1;
+static constexpr size_t HUGE_PAGE_SIZE          = 1 << 21;
+
+#if __linux__
+#ifdef MADV_POPULATE_WRITE
+static constexpr int POOL_MADV_POPULATE_WRITE = MADV_POPULATE_WRITE;
+#else
+// Linux 5.14+, older headers don't define it and older kernels fail the call
+static constexpr int POOL_MADV_POPULATE_WRITE = 23;
+#endif
+
+/** Maps `size` bytes of anonymous memory with POOL_BACKING_* flags
+  `numa_node` >= 0 prefers that node for the pages, the kernel falls back to other nodes when it
+  is full. The preference is set before prefaulting so it applies to every page.
+ */
+static inline u8 *map_backed_pages(size_t size, u32 backing, i32 numa_node) {
+  bool huge     = (backing & POOL_BACKING_HUGE_PAGES) != 0;
+  bool prefault = (backing & POOL_BACKING_PREFAULT) != 0;
+  // MAP_POPULATE would commit small pages before the advice is in place
+  bool   populate_late = prefault && (huge || numa_node >= 0);
+  int    flags         = MAP_ANON | MAP_PRIVATE | (prefault && !populate_late ? MAP_POPULATE : 0);
+  size_t map_size      = huge ? size + HUGE_PAGE_SIZE : size;
+  u8 *   ptr           = (u8 *)mmap(NULL, map_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+  ASSERT_ALWAYS(ptr != MAP_FAILED);
+  if (huge) {
+    u8 *aligned = (u8 *)(((size_t)ptr + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+    if (aligned != ptr) munmap(ptr, (size_t)(aligned - ptr));
+    size_t tail = (size_t)((ptr + map_size) - (aligned + size));
+    if (tail != 0) munmap(aligned + size, tail);
+    ptr = aligned;
+#ifdef MADV_HUGEPAGE
+    madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+  }
+#ifdef SYS_mbind
+  if (numa_node >= 0 && numa_node < 64) {
+    // MPOL_PREFERRED through the raw syscall, no libnuma dependency
+    unsigned long mask = 1ul << numa_node;
+    syscall(SYS_mbind, ptr, size, 1, &mask, sizeof(mask) * 8 + 1, 0);
+  }
+#endif
+  if (populate_late) {
+    // Touching every page does the same on kernels without MADV_POPULATE_WRITE
+    if (madvise(ptr, size, POOL_MADV_POPULATE_WRITE) != 0) {
+      for (size_t i = 0; i < size; i += get_page_size()) ((u8 volatile *)ptr)[i] = 0;
+    }
+  }
+  return ptr;
+}
 #endif
 
 template <typename T, typename V> struct Pair {
@@ -200,16 +414,21 @@ template <typename T = uint8_t> struct Pool {
   size_t   stack_capacity;
   size_t   stack_cursor;
 
-  static Pool create(size_t capacity) {
+  /** `backing` takes POOL_BACKING_* flags, `numa_node` is a placement hint, -1 for none
+    Both only apply on linux.
+   */
+  static Pool create(size_t capacity, u32 backing = 0, i32 numa_node = -1) {
     ASSERT_DEBUG(capacity > 0);
     Pool   out;
     size_t STACK_CAPACITY = 0x20 * sizeof(size_t);
     out.mem_length        = get_num_pages(STACK_CAPACITY + capacity * sizeof(T)) * get_page_size();
 #if __linux__
-    out.ptr = (uint8_t *)mmap(NULL, out.mem_length, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE,
-                              -1, 0);
-    ASSERT_ALWAYS(out.ptr != MAP_FAILED);
+    if ((backing & POOL_BACKING_HUGE_PAGES) != 0)
+      out.mem_length = (out.mem_length + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    out.ptr = map_backed_pages(out.mem_length, backing, numa_node);
 #else
+    (void)backing;
+    (void)numa_node;
     out.ptr = (uint8_t *)malloc(out.mem_length);
     NOTNULL(out.ptr);
 #endif
@@ -319,7 +538,151 @@ template <typename T = uint8_t> struct Pool {
   bool has_space(size_t size) { return cursor + size <= capacity; }
 };
 
-template <typename T = u8> using Temporary_Storage = Pool<T>;
+struct Temporary_Storage_Stats {
+  size_t used;
+  size_t committed;
+  size_t reserved;
+  // Highest cursor so far
+  size_t peak;
+  // Bytes used by the most recently exited scope, nested scopes included
+  size_t last_scope_peak;
+  u32    depth;
+  u32    max_depth;
+};
+
+/** Growable stack allocator for short lived data
+  Reserves address space for `capacity` elements up front and commits pages as the cursor moves
+  past them. Scope records are stored in the arena itself so scopes nest without limit. When the
+  outermost scope exits, pages above the larger of the last two outermost peaks are decommitted:
+  a one-off spike is given back, a steady per-frame load stays committed.
+ */
+template <typename T = u8> struct Temporary_Storage {
+  static constexpr size_t COMMIT_GRANULARITY = 1 << 16;
+  static constexpr size_t ALIGNMENT          = 16;
+  static constexpr size_t NO_SCOPE           = ~(size_t)0;
+  struct Scope {
+    size_t parent;
+    // High-water mark of the enclosing scope at entry
+    size_t high_water;
+  };
+  u8 *   ptr;
+  size_t reserved;
+  size_t committed;
+  size_t cursor;
+  size_t scope;
+  size_t high_water;
+  size_t last_outer_peak;
+  size_t peak;
+  size_t last_scope_peak;
+  u32    depth;
+  u32    max_depth;
+
+  static Temporary_Storage create(size_t capacity) {
+    ASSERT_DEBUG(capacity > 0);
+    Temporary_Storage out;
+    memset(&out, 0, sizeof(out));
+    out.reserved =
+        (capacity * sizeof(T) + COMMIT_GRANULARITY - 1) & ~(COMMIT_GRANULARITY - 1);
+#if __linux__
+    out.ptr = (u8 *)mmap(NULL, out.reserved, PROT_NONE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE,
+                         -1, 0);
+    ASSERT_ALWAYS(out.ptr != MAP_FAILED);
+#else
+    out.ptr = (u8 *)malloc(out.reserved);
+    NOTNULL(out.ptr);
+#endif
+    out.scope = NO_SCOPE;
+    return out;
+  }
+
+  void release() {
+#if __linux__
+    if (this->ptr) munmap(this->ptr, reserved);
+#else
+    if (this->ptr) free(this->ptr);
+#endif
+    memset(this, 0, sizeof(*this));
+  }
+
+  void commit(size_t end) {
+    ASSERT_ALWAYS(end <= reserved);
+    size_t new_committed = (end + COMMIT_GRANULARITY - 1) & ~(COMMIT_GRANULARITY - 1);
+    unprotect_pages(ptr + committed, (new_committed - committed) / get_page_size());
+    committed = new_committed;
+  }
+
+  void decommit(size_t keep) {
+    size_t new_committed = (keep + COMMIT_GRANULARITY - 1) & ~(COMMIT_GRANULARITY - 1);
+    if (new_committed >= committed) return;
+    decommit_pages(ptr + new_committed, (committed - new_committed) / get_page_size());
+    committed = new_committed;
+  }
+
+  void *alloc_bytes(size_t size) {
+    size_t start = (cursor + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    size_t end   = start + size;
+    if (end > committed) commit(end);
+    cursor = end;
+    if (cursor > high_water) high_water = cursor;
+    return ptr + start;
+  }
+
+  T *alloc(size_t size) {
+    ASSERT_DEBUG(size != 0);
+    return (T *)alloc_bytes(size * sizeof(T));
+  }
+
+  T *alloc_zero(size_t size) {
+    T *mem = alloc(size);
+    memset(mem, 0, size * sizeof(T));
+    return mem;
+  }
+
+  void enter_scope() {
+    Scope *record      = (Scope *)alloc_bytes(sizeof(Scope));
+    record->parent     = scope;
+    record->high_water = high_water;
+    scope              = (size_t)((u8 *)record - ptr);
+    high_water         = cursor;
+    depth += 1;
+    if (depth > max_depth) max_depth = depth;
+  }
+
+  void exit_scope() {
+    ASSERT_DEBUG(depth > 0);
+    Scope *record     = (Scope *)(ptr + scope);
+    size_t scope_peak = high_water;
+    last_scope_peak   = scope_peak - scope;
+    if (scope_peak > peak) peak = scope_peak;
+    cursor = scope;
+    scope  = record->parent;
+    depth -= 1;
+    if (depth == 0) {
+      decommit(MAX(scope_peak, last_outer_peak));
+      last_outer_peak = scope_peak;
+      high_water      = cursor;
+    } else {
+      high_water = MAX(record->high_water, scope_peak);
+    }
+  }
+
+  void reset() {
+    cursor     = 0;
+    scope      = NO_SCOPE;
+    depth      = 0;
+    high_water = 0;
+  }
+
+  void get_stats(Temporary_Storage_Stats *stats) {
+    stats->used            = cursor;
+    stats->committed       = committed;
+    stats->reserved        = reserved;
+    stats->peak            = MAX(peak, high_water);
+    stats->last_scope_peak = last_scope_peak;
+    stats->depth           = depth;
+    stats->max_depth       = max_depth;
+  }
+};
 
 /** Allocates 'size' bytes using thread local allocator
  */
@@ -327,7 +690,30 @@ void *tl_alloc(size_t size);
 /** Reallocates deleting `ptr` as a result
  */
 void *tl_realloc(void *ptr, size_t oldsize, size_t newsize);
-void  tl_free(void *ptr);
+/** Any thread may free a block, not only the one that allocated it
+ */
+void tl_free(void *ptr);
+
+/** Statistics of the calling thread's heap
+  Collects the blocks other threads have freed first. Sizes are rounded up to the size class or
+  the page.
+ */
+struct Alloc_Stats {
+  static constexpr u32 NUM_SIZE_CLASSES = 48;
+  struct Size_Class {
+    u32    block_size;
+    size_t live_blocks;
+    size_t total_blocks;
+    size_t num_spans;
+  };
+  size_t     live_bytes;
+  size_t     peak_bytes;
+  size_t     mapped_bytes;
+  size_t     large_live_blocks;
+  size_t     large_live_bytes;
+  Size_Class size_classes[NUM_SIZE_CLASSES];
+};
+void tl_alloc_get_stats(Alloc_Stats *stats);
 /** Allocates 'size' bytes using thread local temporal storage
  */
 void *tl_alloc_tmp(size_t size);
@@ -337,6 +723,40 @@ void tl_alloc_tmp_enter();
 /** Restore the previous state of thread local temporal storage
  */
 void tl_alloc_tmp_exit();
+void tl_alloc_tmp_get_stats(Temporary_Storage_Stats *stats);
+
+static inline u32 ctz32(u32 v) {
+  ASSERT_DEBUG(v != 0);
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, v);
+  return (u32)index;
+#else
+  return (u32)__builtin_ctz(v);
+#endif
+}
+
+static inline u32 clz64(u64 v) {
+  ASSERT_DEBUG(v != 0);
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse64(&index, v);
+  return 63 - (u32)index;
+#else
+  return (u32)__builtin_clzll(v);
+#endif
+}
+
+static inline u32 msb32(u32 v) {
+  ASSERT_DEBUG(v != 0);
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse(&index, v);
+  return (u32)index;
+#else
+  return 31 - (u32)__builtin_clz(v);
+#endif
+}
 
 struct string_ref {
   const char *ptr;
@@ -390,16 +810,183 @@ static inline uint64_t hash_of(uint64_t u) {
 
 template <typename T> static uint64_t hash_of(T *ptr) { return hash_of((size_t)ptr); }
 
+// Full 64x64->128 multiply
+static inline void hash_mul128(u64 a, u64 b, u64 *lo, u64 *hi) {
+#if defined(__SIZEOF_INT128__)
+  __uint128_t r = (__uint128_t)a * b;
+  *lo           = (u64)r;
+  *hi           = (u64)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+  *lo = _umul128(a, b, hi);
+#else
+  u64 ha = a >> 32, hb = b >> 32, la = (u32)a, lb = (u32)b;
+  u64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32);
+  *lo = t + (rm1 << 32);
+  *hi = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (*lo < t);
+#endif
+}
+
+static inline u64 hash_mix(u64 a, u64 b) {
+  hash_mul128(a, b, &a, &b);
+  return a ^ b;
+}
+
+static inline u64 hash_read_u64(char const *p) {
+  u64 v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static inline u64 hash_read_u32(char const *p) {
+  u32 v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+/** wyhash style string hash
+  Consumes 16 bytes per round, 48 bytes in three independent lanes for long strings. Strings up
+  to 16 bytes are covered by two overlapping loads without a loop.
+ */
 static inline uint64_t hash_of(string_ref a) {
-  uint64_t hash = 5381;
-  for (size_t i = 0; i < a.len; i++) {
-    hash =
-        //(hash << 6) + (hash << 16) - hash + a.ptr[i];
-        ((hash << 5) + hash) + a.ptr[i];
+  u64 const   k0   = 0xa0761d6478bd642full;
+  u64 const   k1   = 0xe7037ed1a0b428dbull;
+  u64 const   k2   = 0x8ebc6af09c88c6e3ull;
+  u64 const   k3   = 0x589965cc75374cc3ull;
+  char const *p    = a.ptr;
+  size_t      len  = a.len;
+  u64         seed = hash_mix(k0, k1);
+  u64         x = 0, y = 0;
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t o = (len >> 3) << 2;
+      x        = (hash_read_u32(p) << 32) | hash_read_u32(p + o);
+      y        = (hash_read_u32(p + len - 4) << 32) | hash_read_u32(p + len - 4 - o);
+    } else if (len > 0) {
+      x = ((u64)(u8)p[0] << 16) | ((u64)(u8)p[len >> 1] << 8) | (u64)(u8)p[len - 1];
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      u64 seed1 = seed, seed2 = seed;
+      do {
+        seed  = hash_mix(hash_read_u64(p) ^ k1, hash_read_u64(p + 8) ^ seed);
+        seed1 = hash_mix(hash_read_u64(p + 16) ^ k2, hash_read_u64(p + 24) ^ seed1);
+        seed2 = hash_mix(hash_read_u64(p + 32) ^ k3, hash_read_u64(p + 40) ^ seed2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (i > 16) {
+      seed = hash_mix(hash_read_u64(p) ^ k1, hash_read_u64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    x = hash_read_u64(p + i - 16);
+    y = hash_read_u64(p + i - 8);
   }
-  return hash;
+  hash_mul128(x ^ k1, y ^ seed, &x, &y);
+  return hash_mix(x ^ k0 ^ len, y ^ k1);
+}
+
+/** Perfect hash over a fixed set of strings, built at compile time
+  The constant evaluator searches for a seed under which every key gets its own slot, a lookup
+  is one hash of the length and the first and last 8 bytes plus one compare. Keys that agree on
+  all of those can't be told apart and fail to compile, as do duplicates.
+  Usage:
+    static constexpr char const *Names[] = {"add", "mul"};
+    static constexpr Perfect_Hash<ARRAY_SIZE(Names)> Name_Hash{Names};
+    switch (Name_Hash.find(str)) {
+    case Name_Hash.index("add"): ...
+    default: // Not a key
+    }
+ */
+static constexpr u64 perfect_hash_load(char const *p, size_t n) {
+  // Folds into a single load when `n` is 8
+  u64 v = 0;
+  for (size_t i = 0; i < n; i++) v |= (u64)(u8)p[i] << (i * 8);
+  return v;
+}
+
+static constexpr u64 perfect_hash_of(char const *p, size_t len, u64 seed) {
+  u64 a = perfect_hash_load(p, len < 8 ? len : 8);
+  u64 b = len > 8 ? perfect_hash_load(p + len - 8, 8) : 0;
+  u64 h = (a ^ seed) * 0x9e3779b97f4a7c15ull;
+  h     = (h ^ (h >> 32) ^ b ^ len) * 0xc2b2ae3d27d4eb4full;
+  return h ^ (h >> 32);
+}
+
+static constexpr size_t perfect_hash_strlen(char const *str) {
+  size_t len = 0;
+  while (str[len] != '\0') len++;
+  return len;
 }
 
+// Not constexpr, reaching it in the constant evaluator is a compile error
+static inline void perfect_hash_fail() { ASSERT_ALWAYS(false && "Perfect_Hash: bad key set"); }
+
+template <size_t N> struct Perfect_Hash {
+  static_assert(N != 0 && N < 0x10000, "Perfect_Hash: unsupported key count");
+  static constexpr size_t table_size() {
+    size_t size = 1;
+    while (size < N * 4) size <<= 1;
+    return size;
+  }
+  static constexpr size_t TABLE_SIZE = table_size();
+  static constexpr u64    MAX_SEEDS  = 1 << 10;
+
+  char const *keys[N] = {};
+  u32         lens[N] = {};
+  // Key index + 1, 0 is empty
+  u16 slots[TABLE_SIZE] = {};
+  u64 seed              = 0;
+
+  constexpr Perfect_Hash(char const *const (&strs)[N]) {
+    for (size_t i = 0; i < N; i++) {
+      keys[i] = strs[i];
+      lens[i] = (u32)perfect_hash_strlen(strs[i]);
+    }
+    for (u64 s = 1; s < MAX_SEEDS; s++) {
+      for (size_t i = 0; i < TABLE_SIZE; i++) slots[i] = 0;
+      bool ok = true;
+      for (size_t i = 0; ok && i < N; i++) {
+        u64 h = perfect_hash_of(keys[i], lens[i], s) & (TABLE_SIZE - 1);
+        if (slots[h] != 0)
+          ok = false;
+        else
+          slots[h] = (u16)(i + 1);
+      }
+      if (ok) {
+        seed = s;
+        return;
+      }
+    }
+    perfect_hash_fail();
+  }
+  // Key index + 1 of the only key `str` can be, 0 if none
+  constexpr u32 candidate(char const *str, size_t len) const {
+    u32 i = slots[perfect_hash_of(str, len, seed) & (TABLE_SIZE - 1)];
+    return i != 0 && lens[i - 1] == len ? i : 0;
+  }
+  /** Index of `str` among the keys or -1
+   */
+  i32 find(string_ref str) const {
+    if (str.ptr == NULL) return -1;
+    u32 i = candidate(str.ptr, str.len);
+    return i != 0 && memcmp(keys[i - 1], str.ptr, str.len) == 0 ? (i32)(i - 1) : -1;
+  }
+  /** Index of a key known at compile time, for case labels
+   */
+  constexpr i32 index(char const *str) const {
+    size_t len = perfect_hash_strlen(str);
+    u32    i   = candidate(str, len);
+    for (size_t j = 0; i != 0 && j < len; j++)
+      if (keys[i - 1][j] != str[j]) i = 0;
+    if (i == 0) perfect_hash_fail();
+    return (i32)(i - 1);
+  }
+};
+
 /** String view of a static string
  */
 static inline string_ref stref_s(char const *static_string) {
@@ -459,35 +1046,206 @@ static inline char const *stref_to_tmp_cstr(string_ref a) {
   return ptr;
 }
 
-static inline int32_t stref_find(string_ref a, string_ref b, size_t start = 0) {
-  size_t cursor = 0;
+/** Substring search
+  Candidates are filtered a block at a time by comparing the first and the last byte of the
+  needle at every position (32 positions with AVX2, 16 with SSE2), only the survivors are
+  compared in full. Inputs that keep producing false candidates, like runs of one character,
+  switch over to KMP so the worst case stays linear.
+  All functions return the position relative to a.ptr, or -1.
+ */
+#if defined(__AVX2__)
+static constexpr size_t STREF_BLOCK = 32;
+// Bit i is set when p[i] == first and p[i + last_offset] == last
+static inline u32 stref_match_block(char const *p, size_t last_offset, char first, char last) {
+  __m256i a = _mm256_loadu_si256((__m256i const *)p);
+  __m256i b = _mm256_loadu_si256((__m256i const *)(p + last_offset));
+  __m256i m = _mm256_and_si256(_mm256_cmpeq_epi8(a, _mm256_set1_epi8(first)),
+                               _mm256_cmpeq_epi8(b, _mm256_set1_epi8(last)));
+  return (u32)_mm256_movemask_epi8(m);
+}
+#elif defined(__SSE2__)
+static constexpr size_t STREF_BLOCK = 16;
+static inline u32 stref_match_block(char const *p, size_t last_offset, char first, char last) {
+  __m128i a = _mm_loadu_si128((__m128i const *)p);
+  __m128i b = _mm_loadu_si128((__m128i const *)(p + last_offset));
+  __m128i m = _mm_and_si128(_mm_cmpeq_epi8(a, _mm_set1_epi8(first)),
+                            _mm_cmpeq_epi8(b, _mm_set1_epi8(last)));
+  return (u32)_mm_movemask_epi8(m);
+}
+#else
+static constexpr size_t STREF_BLOCK = 8;
+static inline u32 stref_match_block(char const *p, size_t last_offset, char first, char last) {
+  u32 mask = 0;
+  ito(STREF_BLOCK) mask |= (u32)(p[i] == first && p[i + last_offset] == last) << i;
+  return mask;
+}
+#endif
+
+// Filtering gives up after verifying this many bytes more than twice the scanned length
+static constexpr size_t STREF_VERIFY_SLACK = 1024;
+
+static inline i32 stref_find_char(string_ref a, char c, size_t start = 0) {
+  if (start >= a.len) return -1;
+  void const *found = memchr(a.ptr + start, c, a.len - start);
+  return found == NULL ? -1 : (i32)((char const *)found - a.ptr);
+}
+
+static inline i32 stref_find_last_char(string_ref a, char c, size_t start = 0) {
+  if (start >= a.len) return -1;
+  size_t end = a.len;
+  while (end >= start + STREF_BLOCK) {
+    size_t i    = end - STREF_BLOCK;
+    u32    mask = stref_match_block(a.ptr + i, 0, c, c);
+    if (mask != 0) return (i32)(i + msb32(mask));
+    end = i;
+  }
+  while (end > start) {
+    end -= 1;
+    if (a.ptr[end] == c) return (i32)end;
+  }
+  return -1;
+}
+
+// First occurrence of `b` at or after `start`, linear in a.len
+static inline i32 stref_find_kmp(string_ref a, string_ref b, size_t start) {
+  TMP_STORAGE_SCOPE;
+  u32 *border = (u32 *)tl_alloc_tmp(sizeof(u32) * b.len);
+  u32  k      = 0;
+  border[0]   = 0;
+  for (size_t q = 1; q < b.len; q++) {
+    while (k > 0 && b.ptr[q] != b.ptr[k]) k = border[k - 1];
+    if (b.ptr[q] == b.ptr[k]) k++;
+    border[q] = k;
+  }
+  k = 0;
   for (size_t i = start; i < a.len; i++) {
-    if (a.ptr[i] == b.ptr[cursor]) {
-      cursor += 1;
-    } else {
-      i -= cursor;
-      cursor = 0;
+    while (k > 0 && a.ptr[i] != b.ptr[k]) k = border[k - 1];
+    if (a.ptr[i] == b.ptr[k]) k++;
+    if (k == b.len) return (i32)(i + 1 - b.len);
+  }
+  return -1;
+}
+
+// Last occurrence of `b` at a position in [start, end), KMP over the reversed strings
+static inline i32 stref_find_last_kmp(string_ref a, string_ref b, size_t start, size_t end) {
+  TMP_STORAGE_SCOPE;
+  u32 *       border = (u32 *)tl_alloc_tmp(sizeof(u32) * b.len);
+  char const *rb     = b.ptr + b.len - 1;
+  u32         k      = 0;
+  border[0]          = 0;
+  for (size_t q = 1; q < b.len; q++) {
+    while (k > 0 && rb[-(i64)q] != rb[-(i64)k]) k = border[k - 1];
+    if (rb[-(i64)q] == rb[-(i64)k]) k++;
+    border[q] = k;
+  }
+  k = 0;
+  for (size_t i = end + b.len - 1; i-- > start;) {
+    while (k > 0 && a.ptr[i] != rb[-(i64)k]) k = border[k - 1];
+    if (a.ptr[i] == rb[-(i64)k]) k++;
+    if (k == b.len) return (i32)i;
+  }
+  return -1;
+}
+
+/** First occurrence of `b` at or after `start`
+  An empty needle matches at `start`.
+ */
+static inline i32 stref_find(string_ref a, string_ref b, size_t start = 0) {
+  if (b.len == 0) return start <= a.len ? (i32)start : -1;
+  if (start >= a.len || a.len - start < b.len) return -1;
+  if (b.len == 1) return stref_find_char(a, b.ptr[0], start);
+  char   first       = b.ptr[0];
+  size_t last_offset = b.len - 1;
+  char   last        = b.ptr[last_offset];
+  // Candidate positions are below `end`
+  size_t end      = a.len - b.len + 1;
+  size_t i        = start;
+  size_t verified = 0;
+  while (i + STREF_BLOCK <= end) {
+    u32 mask = stref_match_block(a.ptr + i, last_offset, first, last);
+    while (mask != 0) {
+      size_t pos = i + ctz32(mask);
+      if (memcmp(a.ptr + pos + 1, b.ptr + 1, b.len - 2) == 0) return (i32)pos;
+      verified += b.len;
+      mask &= mask - 1;
+    }
+    i += STREF_BLOCK;
+    if (verified > 2 * (i - start) + STREF_VERIFY_SLACK) return stref_find_kmp(a, b, i);
+  }
+  for (; i < end; i++) {
+    if (a.ptr[i] == first && a.ptr[i + last_offset] == last &&
+        memcmp(a.ptr + i + 1, b.ptr + 1, b.len - 2) == 0)
+      return (i32)i;
+  }
+  return -1;
+}
+
+/** Last occurrence of `b` at or after `start`
+  Scans backwards from the end, an empty needle matches at a.len.
+ */
+static inline i32 stref_find_last(string_ref a, string_ref b, size_t start = 0) {
+  if (b.len == 0) return start <= a.len ? (i32)a.len : -1;
+  if (start >= a.len || a.len - start < b.len) return -1;
+  if (b.len == 1) return stref_find_last_char(a, b.ptr[0], start);
+  char   first       = b.ptr[0];
+  size_t last_offset = b.len - 1;
+  char   last        = b.ptr[last_offset];
+  size_t end         = a.len - b.len + 1;
+  size_t verified    = 0;
+  while (end >= start + STREF_BLOCK) {
+    size_t i    = end - STREF_BLOCK;
+    u32    mask = stref_match_block(a.ptr + i, last_offset, first, last);
+    while (mask != 0) {
+      u32 bit = msb32(mask);
+      if (memcmp(a.ptr + i + bit + 1, b.ptr + 1, b.len - 2) == 0) return (i32)(i + bit);
+      verified += b.len;
+      mask &= ~(1u << bit);
     }
-    if (cursor == b.len) return (int32_t)(i - (cursor - 1));
+    end = i;
+    if (verified > 2 * (a.len - end) + STREF_VERIFY_SLACK)
+      return stref_find_last_kmp(a, b, start, end);
+  }
+  while (end > start) {
+    end -= 1;
+    if (a.ptr[end] == first && a.ptr[end + last_offset] == last &&
+        memcmp(a.ptr + end + 1, b.ptr + 1, b.len - 2) == 0)
+      return (i32)end;
   }
   return -1;
 }
 
-static inline int32_t stref_find_last(string_ref a, string_ref b, size_t start = 0) {
-  int32_t last_pos = -1;
-  int32_t cursor   = stref_find(a, b, start);
-  while (cursor >= 0) {
-    last_pos = cursor;
-    if ((size_t)cursor + 1 < a.len) cursor = stref_find_last(a, b, (size_t)(cursor + 1));
+/** First occurrence of any of the needles at or after `start`
+  Positions are filtered by a bitmap of the needles' first bytes. On a tie the needle listed
+  first wins, `which` receives its index. Empty needles are ignored.
+ */
+static inline i32 stref_find_any(string_ref a, string_ref const *needles, u32 num_needles,
+                                 size_t start = 0, u32 *which = NULL) {
+  u64 first_bytes[4] = {};
+  ito(num_needles) {
+    if (needles[i].len == 0) continue;
+    u8 c = (u8)needles[i].ptr[0];
+    first_bytes[c >> 6] |= (u64)1 << (c & 63);
+  }
+  for (size_t i = start; i < a.len; i++) {
+    u8 c = (u8)a.ptr[i];
+    if ((first_bytes[c >> 6] & ((u64)1 << (c & 63))) == 0) continue;
+    jto(num_needles) {
+      string_ref needle = needles[j];
+      if (needle.len == 0 || needle.len > a.len - i || needle.ptr[0] != (char)c) continue;
+      if (memcmp(a.ptr + i, needle.ptr, needle.len) == 0) {
+        if (which != NULL) *which = j;
+        return (i32)i;
+      }
+    }
   }
-  return last_pos;
+  return -1;
 }
 
 #if __linux__
 static inline void make_dir_recursive(string_ref path) {
   TMP_STORAGE_SCOPE;
   if (path.ptr[path.len - 1] == '/') path.len -= 1;
-  int32_t sep = stref_find_last(path, stref_s("/"));
+  i32 sep = stref_find_last_char(path, '/');
   if (sep >= 0) {
     make_dir_recursive(path.substr(0, sep));
   }
@@ -495,11 +1253,25 @@ static inline void make_dir_recursive(string_ref path) {
 }
 #endif
 
+/** Writes the whole file
+  On linux the data goes to `path`.tmp which is then renamed over `path`, so a Mapped_File of
+  the old contents stays valid.
+ */
 static inline void dump_file(char const *path, void const *data, size_t size) {
-  FILE *file = fopen(path, "wb");
+#if __linux__
+  TMP_STORAGE_SCOPE;
+  char const *tmp_path = stref_to_tmp_cstr(stref_concat(stref_s(path), stref_s(".tmp")));
+#else
+  char const *tmp_path = path;
+#endif
+  FILE *file = fopen(tmp_path, "wb");
   ASSERT_ALWAYS(file);
   fwrite(data, 1, size, file);
   fclose(file);
+#if __linux__
+  int err = rename(tmp_path, path);
+  ASSERT_ALWAYS(err == 0);
+#endif
 }
 
 static inline char *read_file_tmp(char const *filename) {
@@ -517,78 +1289,215 @@ static inline char *read_file_tmp(char const *filename) {
   return data;
 }
 
-static inline void ATTR_USED write_image_2d_i32_ppm(const char *file_name, void *data,
-                                                    uint32_t pitch, uint32_t width,
-                                                    uint32_t height) {
-  FILE *file = fopen(file_name, "wb");
-  ASSERT_ALWAYS(file);
-  fprintf(file, "P6\n");
-  fprintf(file, "%d %d\n", width, height);
-  fprintf(file, "255\n");
-  ito(height) {
-    jto(width) {
-      uint32_t pixel = *(uint32_t *)(void *)(((uint8_t *)data) + i * pitch + j * 4);
-      uint8_t  r     = ((pixel >> 0) & 0xff);
-      uint8_t  g     = ((pixel >> 8) & 0xff);
-      uint8_t  b     = ((pixel >> 16) & 0xff);
-      uint8_t  a     = ((pixel >> 24) & 0xff);
-      if (a == 0) {
-        r = ((i & 1) ^ (j & 1)) * 127;
-        g = ((i & 1) ^ (j & 1)) * 127;
-        b = ((i & 1) ^ (j & 1)) * 127;
+/** Read only view of a whole file, zero terminated
+  On linux the file is mapped with MAP_POPULATE and MADV_SEQUENTIAL, nothing is copied and the
+  size isn't bounded by the temporary storage. Elsewhere it's read into a tl_alloc block.
+ */
+struct Mapped_File {
+  char const *ptr;
+  size_t      size;
+  // Bytes mapped at ptr, 0 for heap blocks
+  size_t      map_size;
+  /** Returns false if the file can't be opened or mapped
+   */
+  bool       init(char const *path);
+  void       release();
+  bool       is_open() const { return ptr != NULL; }
+  string_ref get_view() const { return string_ref{ptr, size}; }
+};
+
+/** File output through a large buffer
+  Writes are collected so fwrite is called once per BUFFER_SIZE bytes. reserve()/commit() let
+  the caller convert straight into the buffer.
+ */
+struct Buffered_Writer {
+  static constexpr size_t BUFFER_SIZE = 1 << 20;
+  FILE *                  file;
+  u8 *                    buffer;
+  size_t                  cursor;
+  bool                    error;
+
+  bool init(char const *path) {
+    memset(this, 0, sizeof(*this));
+    file = fopen(path, "wb");
+    if (file == NULL) return false;
+    buffer = (u8 *)tl_alloc(BUFFER_SIZE);
+    return true;
+  }
+  void flush() {
+    if (cursor != 0 && fwrite(buffer, 1, cursor, file) != cursor) error = true;
+    cursor = 0;
+  }
+  // Returns space for at least `size` bytes, `size` is at most BUFFER_SIZE
+  u8 *reserve(size_t size) {
+    ASSERT_DEBUG(size <= BUFFER_SIZE);
+    if (cursor + size > BUFFER_SIZE) flush();
+    return buffer + cursor;
+  }
+  void commit(size_t size) {
+    ASSERT_DEBUG(cursor + size <= BUFFER_SIZE);
+    cursor += size;
+  }
+  void write(void const *data, size_t size) {
+    if (cursor + size > BUFFER_SIZE) {
+      flush();
+      // Big blocks skip the buffer
+      if (size >= BUFFER_SIZE) {
+        if (fwrite(data, 1, size, file) != size) error = true;
+        return;
       }
-      fputc(r, file);
-      fputc(g, file);
-      fputc(b, file);
     }
+    memcpy(buffer + cursor, data, size);
+    cursor += size;
+  }
+  void write_u32_be(u32 v) {
+    u8 bytes[] = {(u8)(v >> 24), (u8)(v >> 16), (u8)(v >> 8), (u8)v};
+    write(bytes, 4);
+  }
+  // Returns false if any write failed
+  bool release() {
+    flush();
+    if (fclose(file) != 0) error = true;
+    tl_free(buffer);
+    bool ok = !error;
+    memset(this, 0, sizeof(*this));
+    return ok;
+  }
+};
+
+/** RGBA row to RGB, pixels with zero alpha become a checkerboard
+  `row` picks the phase of the checkerboard. Writes up to 4 bytes past width * 3.
+ */
+static inline void image_row_rgba_to_rgb(u8 *dst, u8 const *src, u32 width, u32 row) {
+  u32 j = 0;
+#if defined(__SSSE3__)
+  // Lane k of a 4 pixel group gets ((row ^ k) & 1) * 127, the group always starts at an even j
+  u32     c0      = (row & 1) * 0x7f7f7f;
+  u32     c1      = ((row & 1) ^ 1) * 0x7f7f7f;
+  __m128i checker = _mm_setr_epi32(c0, c1, c0, c1);
+  __m128i alpha   = _mm_set1_epi32((i32)0xff000000);
+  __m128i pack    = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  for (; j + 4 <= width; j += 4) {
+    __m128i px          = _mm_loadu_si128((__m128i const *)(src + j * 4));
+    __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(px, alpha), _mm_setzero_si128());
+    px = _mm_or_si128(_mm_and_si128(transparent, checker), _mm_andnot_si128(transparent, px));
+    _mm_storeu_si128((__m128i *)(dst + j * 3), _mm_shuffle_epi8(px, pack));
+  }
+#endif
+  for (; j < width; j++) {
+    u8 r = src[j * 4 + 0];
+    u8 g = src[j * 4 + 1];
+    u8 b = src[j * 4 + 2];
+    if (src[j * 4 + 3] == 0) r = g = b = ((row & 1) ^ (j & 1)) * 127;
+    dst[j * 3 + 0] = r;
+    dst[j * 3 + 1] = g;
+    dst[j * 3 + 2] = b;
   }
-  fclose(file);
 }
 
-static inline void ATTR_USED write_image_2d_i24_ppm(const char *file_name, void *data,
-                                                    uint32_t pitch, uint32_t width,
-                                                    uint32_t height) {
-  FILE *file = fopen(file_name, "wb");
-  ASSERT_ALWAYS(file);
-  fprintf(file, "P6\n");
-  fprintf(file, "%d %d\n", width, height);
-  fprintf(file, "255\n");
-  ito(height) {
-    jto(width) {
-      uint8_t r = *(uint8_t *)(void *)(((uint8_t *)data) + i * pitch + j * 3 + 0);
-      uint8_t g = *(uint8_t *)(void *)(((uint8_t *)data) + i * pitch + j * 3 + 1);
-      uint8_t b = *(uint8_t *)(void *)(((uint8_t *)data) + i * pitch + j * 3 + 2);
-      fputc(r, file);
-      fputc(g, file);
-      fputc(b, file);
-    }
+/** Grey row to RGB
+ */
+static inline void image_row_grey_to_rgb(u8 *dst, u8 const *src, u32 width) {
+  u32 j = 0;
+#if defined(__SSSE3__)
+  __m128i lo  = _mm_setr_epi8(0, 0, 0, 1, 1, 1, 2, 2, 2, 3, 3, 3, 4, 4, 4, 5);
+  __m128i mid = _mm_setr_epi8(5, 5, 6, 6, 6, 7, 7, 7, 8, 8, 8, 9, 9, 9, 10, 10);
+  __m128i hi  = _mm_setr_epi8(10, 11, 11, 11, 12, 12, 12, 13, 13, 13, 14, 14, 14, 15, 15, 15);
+  for (; j + 16 <= width; j += 16) {
+    __m128i px = _mm_loadu_si128((__m128i const *)(src + j));
+    _mm_storeu_si128((__m128i *)(dst + j * 3 + 0), _mm_shuffle_epi8(px, lo));
+    _mm_storeu_si128((__m128i *)(dst + j * 3 + 16), _mm_shuffle_epi8(px, mid));
+    _mm_storeu_si128((__m128i *)(dst + j * 3 + 32), _mm_shuffle_epi8(px, hi));
   }
-  fclose(file);
+#endif
+  for (; j < width; j++) dst[j * 3 + 0] = dst[j * 3 + 1] = dst[j * 3 + 2] = src[j];
 }
 
-static inline void ATTR_USED write_image_2d_i8_ppm(const char *file_name, void *data,
-                                                   uint32_t pitch, uint32_t width,
-                                                   uint32_t height) {
-  FILE *file = fopen(file_name, "wb");
-  ASSERT_ALWAYS(file);
-  fprintf(file, "P6\n");
-  fprintf(file, "%d %d\n", width, height);
-  fprintf(file, "255\n");
+// Rows are converted into the writer's buffer, wider rows go through a temporary one
+template <typename F>
+static inline bool write_image_2d_ppm(const char *file_name, uint32_t width, uint32_t height,
+                                      F convert_row) {
+  Buffered_Writer writer;
+  if (!writer.init(file_name)) return false;
+  char header[0x40];
+  int  header_len = snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+  writer.write(header, (size_t)header_len);
+  size_t row_size = (size_t)width * 3;
+  size_t reserve  = row_size + 64;
+  u8 *   tmp_row  = reserve > Buffered_Writer::BUFFER_SIZE ? (u8 *)tl_alloc(reserve) : NULL;
   ito(height) {
-    jto(width) {
-      uint8_t r = *(uint8_t *)(void *)(((uint8_t *)data) + i * pitch + j);
-      fputc(r, file);
-      fputc(r, file);
-      fputc(r, file);
+    if (tmp_row != NULL) {
+      convert_row(tmp_row, i);
+      writer.write(tmp_row, row_size);
+    } else {
+      convert_row(writer.reserve(reserve), i);
+      writer.commit(row_size);
     }
   }
-  fclose(file);
+  if (tmp_row != NULL) tl_free(tmp_row);
+  return writer.release();
 }
 
-struct Allocator {
-  virtual void *    alloc(size_t)                                     = 0;
-  virtual void *    realloc(void *, size_t old_size, size_t new_size) = 0;
-  virtual void      free(void *)                                      = 0;
+static inline void ATTR_USED write_image_2d_i32_ppm(const char *file_name, void *data,
+                                                    uint32_t pitch, uint32_t width,
+                                                    uint32_t height) {
+  bool ok = write_image_2d_ppm(file_name, width, height, [&](u8 *dst, u32 i) {
+    image_row_rgba_to_rgb(dst, (u8 const *)data + (size_t)i * pitch, width, i);
+  });
+  ASSERT_ALWAYS(ok);
+}
+
+static inline void ATTR_USED write_image_2d_i24_ppm(const char *file_name, void *data,
+                                                    uint32_t pitch, uint32_t width,
+                                                    uint32_t height) {
+  bool ok = write_image_2d_ppm(file_name, width, height, [&](u8 *dst, u32 i) {
+    memcpy(dst, (u8 const *)data + (size_t)i * pitch, (size_t)width * 3);
+  });
+  ASSERT_ALWAYS(ok);
+}
+
+static inline void ATTR_USED write_image_2d_i8_ppm(const char *file_name, void *data,
+                                                   uint32_t pitch, uint32_t width,
+                                                   uint32_t height) {
+  bool ok = write_image_2d_ppm(file_name, width, height, [&](u8 *dst, u32 i) {
+    image_row_grey_to_rgb(dst, (u8 const *)data + (size_t)i * pitch, width);
+  });
+  ASSERT_ALWAYS(ok);
+}
+
+/** PNG output through zlib
+  `channels` is 1 (grey), 3 (RGB) or 4 (RGBA), 8 bits each. Every row gets the filter with the
+  smallest sum of absolute residuals. The rows are split into strips deflated in parallel, the
+  strips end on a sync flush so their outputs concatenate into one zlib stream.
+  `level` is the zlib level, the fastest by default. `num_threads` 0 picks the hardware
+  concurrency. Returns false if the file can't be written.
+ */
+bool write_image_2d_png(const char *file_name, void const *data, uint32_t pitch, uint32_t width,
+                        uint32_t height, uint32_t channels, int level = 1,
+                        uint32_t num_threads = 0);
+
+static inline bool ATTR_USED write_image_2d_i32_png(const char *file_name, void const *data,
+                                                    uint32_t pitch, uint32_t width,
+                                                    uint32_t height) {
+  return write_image_2d_png(file_name, data, pitch, width, height, 4);
+}
+
+static inline bool ATTR_USED write_image_2d_i24_png(const char *file_name, void const *data,
+                                                    uint32_t pitch, uint32_t width,
+                                                    uint32_t height) {
+  return write_image_2d_png(file_name, data, pitch, width, height, 3);
+}
+
+static inline bool ATTR_USED write_image_2d_i8_png(const char *file_name, void const *data,
+                                                   uint32_t pitch, uint32_t width,
+                                                   uint32_t height) {
+  return write_image_2d_png(file_name, data, pitch, width, height, 1);
+}
+
+struct Allocator {
+  virtual void *    alloc(size_t)                                     = 0;
+  virtual void *    realloc(void *, size_t old_size, size_t new_size) = 0;
+  virtual void      free(void *)                                      = 0;
   static Allocator *get_default() {
     struct _Allocator : public Allocator {
       virtual void *alloc(size_t size) override { return tl_alloc(size); }
@@ -610,7 +1519,96 @@ struct Default_Allocator {
   static void free(void *ptr) { tl_free(ptr); }
 };
 
-template <typename T, size_t grow_k = 0x100, typename Allcator_t = Default_Allocator> //
+/** Counters of one Tracking_Allocator site
+  Only blocks allocated while tracking is enabled are counted.
+ */
+struct Alloc_Site_Summary {
+  char const *name;
+  u64         num_allocs;
+  u64         num_reallocs;
+  u64         num_frees;
+  u64         live_blocks;
+  u64         live_bytes;
+  u64         peak_bytes;
+  u64         total_bytes;
+};
+/** Counters and block lifetimes of one site, the histogram makes it about 15KB
+  The lifetime is measured from the first allocation of a block to its free, reallocations
+  don't restart it.
+ */
+struct Alloc_Site_Stats : Alloc_Site_Summary {
+  Hdr_Histogram lifetime_ns;
+};
+u32   alloc_site_register(char const *name);
+void *tracking_alloc(u32 site, size_t size);
+void *tracking_realloc(u32 site, void *ptr, size_t old_size, size_t new_size);
+void  tracking_free(u32 site, void *ptr);
+/** Tracking is off by default, blocks allocated while it's off are never counted
+ */
+void alloc_tracking_enable(bool enable);
+bool alloc_tracking_is_enabled();
+/** Copies the counters of up to `max_sites` sites, returns the number of sites
+ */
+u32 alloc_tracking_get_summaries(Alloc_Site_Summary *out, u32 max_sites);
+/** Copies the counters and the histogram of the `index`-th site, false past the last one
+ */
+bool alloc_tracking_get_site(u32 index, Alloc_Site_Stats *out);
+/** Clears the counters and histograms, live blocks stay accounted
+ */
+void alloc_tracking_reset();
+/** Prints the sites with live blocks, returns the number of leaked blocks
+  Runs at exit as well.
+ */
+u64 alloc_tracking_report_leaks(FILE *file);
+
+/** Allocator policy that attributes allocations to `Site`
+  Blocks carry a 16 byte header. `Site` is any type with a static get_name(), declare one with
+  ALLOC_SITE:
+    ALLOC_SITE(NodeDB_links);
+    Array<Link, 0x100, Tracking_Allocator<NodeDB_links>> links;
+ */
+template <typename Site> struct Tracking_Allocator {
+  static u32 get_site() {
+    static u32 site = alloc_site_register(Site::get_name());
+    return site;
+  }
+  static void *alloc(size_t size) { return tracking_alloc(get_site(), size); }
+  static void *realloc(void *ptr, size_t old_size, size_t new_size) {
+    return tracking_realloc(get_site(), ptr, old_size, new_size);
+  }
+  static void free(void *ptr) { tracking_free(get_site(), ptr); }
+};
+
+#define ALLOC_SITE(site)                                                                           \
+  struct site {                                                                                    \
+    static char const *get_name() { return #site; }                                                \
+  }
+
+/** Growth policies for Array
+  grow() returns the new capacity that fits at least `required` elements
+  shrink() returns the capacity to shrink to after a pop, `capacity` means keep it
+ */
+template <size_t grow_k> struct Linear_Growth {
+  static size_t grow(size_t capacity, size_t required) {
+    return MAX(required, capacity + grow_k);
+  }
+  static size_t shrink(size_t capacity, size_t size) {
+    return size + grow_k < capacity ? capacity - grow_k : capacity;
+  }
+};
+
+template <size_t grow_k> struct Geometric_Growth {
+  static size_t grow(size_t capacity, size_t required) {
+    return MAX(required, MAX(capacity + (capacity >> 1), grow_k));
+  }
+  // Halve only when a quarter is in use so push/pop at the boundary doesn't thrash
+  static size_t shrink(size_t capacity, size_t size) {
+    return (size << 2) < capacity && capacity > grow_k ? MAX(capacity >> 1, grow_k) : capacity;
+  }
+};
+
+template <typename T, size_t grow_k = 0x100, typename Allcator_t = Default_Allocator,
+          typename Grow_Policy = Geometric_Growth<grow_k>> //
 struct Array {
   T *    ptr;
   size_t size;
@@ -631,12 +1629,17 @@ struct Array {
     }
     memset(this, 0, sizeof(*this));
   }
+  void set_capacity(size_t new_capacity) {
+    ptr      = (T *)Allcator_t::realloc(ptr, sizeof(T) * capacity, sizeof(T) * new_capacity);
+    capacity = new_capacity;
+  }
+  /** Makes sure `new_capacity` elements fit without further reallocations
+   */
+  void reserve(size_t new_capacity) {
+    if (new_capacity > capacity) set_capacity(new_capacity);
+  }
   void resize(size_t new_size) {
-    if (new_size > capacity) {
-      uint64_t new_capacity = new_size;
-      ptr      = (T *)Allcator_t::realloc(ptr, sizeof(T) * capacity, sizeof(T) * new_capacity);
-      capacity = new_capacity;
-    }
+    reserve(new_size);
     ASSERT_DEBUG(ptr != NULL);
     size = new_size;
   }
@@ -648,15 +1651,23 @@ struct Array {
   }
   void push(T elem) {
     if (size + 1 > capacity) {
-      uint64_t new_capacity = capacity + grow_k;
-      ptr      = (T *)Allcator_t::realloc(ptr, sizeof(T) * capacity, sizeof(T) * new_capacity);
-      capacity = new_capacity;
+      set_capacity(Grow_Policy::grow(capacity, size + 1));
     }
     ASSERT_DEBUG(capacity >= size + 1);
     ASSERT_DEBUG(ptr != NULL);
     memcpy(ptr + size, &elem, sizeof(T));
     size += 1;
   }
+  /** Appends `count` elements with at most one reallocation
+   */
+  void push_n(T const *elems, size_t count) {
+    if (count == 0) return;
+    if (size + count > capacity) {
+      set_capacity(Grow_Policy::grow(capacity, size + count));
+    }
+    memcpy(ptr + size, elems, sizeof(T) * count);
+    size += count;
+  }
 
   T &back() {
     ASSERT_DEBUG(size != 0);
@@ -667,17 +1678,15 @@ struct Array {
     ASSERT_DEBUG(size != 0);
     ASSERT_DEBUG(ptr != NULL);
     T elem = ptr[size - 1];
-    if (size + grow_k < capacity) {
-      uint64_t new_capacity = capacity - grow_k;
-      ptr      = (T *)Allcator_t::realloc(ptr, sizeof(T) * capacity, sizeof(T) * new_capacity);
-      capacity = new_capacity;
-    }
     ASSERT_DEBUG(size != 0);
     size -= 1;
     if (size == 0) {
       Allcator_t::free(ptr);
       ptr      = NULL;
       capacity = 0;
+    } else {
+      size_t new_capacity = Grow_Policy::shrink(capacity, size);
+      if (new_capacity != capacity) set_capacity(new_capacity);
     }
     return elem;
   }
@@ -688,184 +1697,381 @@ struct Array {
   }
 };
 
+/** Array with inline storage for the first N elements
+  Elements are always contiguous: once they outgrow the inline buffer all of them move to the
+  heap together, data() and size form a span either way. The struct is trivially copyable
+  but owns its heap block like Array does, copies alias it.
+ */
 template <typename T, u32 N, typename Allcator_t = Default_Allocator> //
 struct SmallArray {
-  T                           local[N];
-  size_t                      size;
-  Array<T, N * 3, Allcator_t> array;
-  void                        init() {
-    memset(this, 0, sizeof(*this));
-    array.init();
+  // NULL while the elements live in `local`
+  T *    heap;
+  size_t size;
+  size_t capacity;
+  T      local[N];
+  void   init() {
+    heap     = NULL;
+    size     = 0;
+    capacity = N;
   }
   void release() {
-    array.release();
-    memset(this, 0, sizeof(*this));
+    if (heap != NULL) Allcator_t::free(heap);
+    init();
   }
-  T &operator[](size_t i) {
-    if (i < N)
-      return local[i];
-    else
-      return array[i - N];
-  }
-  void push(T const &val) {
-    if (size < N) {
-      local[size++] = val;
+  T *       data() { return heap != NULL ? heap : local; }
+  T const * data() const { return heap != NULL ? heap : local; }
+  T *       begin() { return data(); }
+  T *       end() { return data() + size; }
+  bool      is_inline() const { return heap == NULL; }
+  /** Makes sure `new_capacity` elements fit, spills to the heap in one copy
+   */
+  void reserve(size_t new_capacity) {
+    if (new_capacity <= capacity) return;
+    new_capacity = MAX(new_capacity, capacity * 2);
+    if (heap == NULL) {
+      heap = (T *)Allcator_t::alloc(sizeof(T) * new_capacity);
+      memcpy(heap, local, sizeof(T) * size);
     } else {
-      array.push(val);
-      size++;
+      heap = (T *)Allcator_t::realloc(heap, sizeof(T) * capacity, sizeof(T) * new_capacity);
     }
+    capacity = new_capacity;
+  }
+  void resize(size_t new_size) {
+    reserve(new_size);
+    size = new_size;
+  }
+  // Keeps the storage
+  void reset() { size = 0; }
+  T &  operator[](size_t i) {
+    ASSERT_DEBUG(i < size);
+    return data()[i];
+  }
+  void push(T const &val) {
+    if (size == capacity) reserve(size + 1);
+    data()[size++] = val;
+  }
+  /** Appends `count` elements with at most one reallocation
+   */
+  void push_n(T const *elems, size_t count) {
+    if (count == 0) return;
+    reserve(size + count);
+    memcpy(data() + size, elems, sizeof(T) * count);
+    size += count;
+  }
+  T pop() {
+    ASSERT_DEBUG(size != 0);
+    return data()[--size];
+  }
+  T &back() {
+    ASSERT_DEBUG(size != 0);
+    return data()[size - 1];
+  }
+  /** Removes `count` elements starting at `i`, keeps the order of the rest
+   */
+  void erase(size_t i, size_t count = 1) {
+    ASSERT_DEBUG(i + count <= size);
+    T *ptr = data();
+    memmove(ptr + i, ptr + i + count, sizeof(T) * (size - i - count));
+    size -= count;
   }
   bool has(T elem) {
+    T *ptr = data();
     ito(size) {
-      if ((*this)[i] == elem) return true;
+      if (ptr[i] == elem) return true;
     }
     return false;
   }
 };
 
+/** Control bytes of the open addressing tables
+  Every slot has one: EMPTY, DELETED or the low 7 bits of the hash of the key stored there.
+  Slots are probed in aligned groups of 16, the whole group is matched at once.
+ */
+struct Hash_Ctrl {
+  static constexpr u8  EMPTY      = 0x80;
+  static constexpr u8  DELETED    = 0xfe;
+  static constexpr u32 GROUP_SIZE = 16;
+
+  static bool is_full(u8 c) { return (c & 0x80) == 0; }
+  static u8   h2(u64 hash) { return (u8)(hash & 0x7f); }
+  static u64  h1(u64 hash) { return hash >> 7; }
+#if defined(__SSE2__)
+  // Bit i is set when byte i of the group equals `c`
+  static u32 match(u8 const *group, u8 c) {
+    __m128i ctrl = _mm_loadu_si128((__m128i const *)group);
+    return (u32)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)c)));
+  }
+  static u32 match_empty(u8 const *group) { return match(group, EMPTY); }
+  // EMPTY and DELETED are the only values with the high bit set
+  static u32 match_free(u8 const *group) {
+    return (u32)_mm_movemask_epi8(_mm_loadu_si128((__m128i const *)group));
+  }
+#else
+  static u32 match(u8 const *group, u8 c) {
+    u32 mask = 0;
+    ito(GROUP_SIZE) mask |= (u32)(group[i] == c) << i;
+    return mask;
+  }
+  static u32 match_empty(u8 const *group) { return match(group, EMPTY); }
+  static u32 match_free(u8 const *group) {
+    u32 mask = 0;
+    ito(GROUP_SIZE) mask |= (u32)(group[i] >> 7) << i;
+    return mask;
+  }
+#endif
+};
+
+/** Open addressing hash set in the style of SwissTable
+  Capacity is a power of two and a multiple of the group size, the probe sequence walks groups
+  with triangular steps so every group is visited once. Live items plus tombstones stay under
+  7/8 of the capacity, so probing always terminates at a group with an EMPTY byte.
+  grow_k is the capacity of the first allocation.
+  shrink_k is the low-water mark: removals shrink the table once fewer than 1/shrink_k of the
+  slots are in use, 0 disables shrinking. The table is rebuilt at half the maximum load so it
+  takes many insertions or removals before the next rehash.
+ */
 template <typename K, typename Allcator_t = Default_Allocator, size_t grow_k = 0x100,
-          size_t MAX_ATTEMPTS = 0x100>
+          size_t shrink_k = 8>
 struct Hash_Set {
   struct Hash_Pair {
     K        key;
     uint64_t hash;
   };
   using Array_t = Array<Hash_Pair, grow_k, Allcator_t>;
+  // arr.size == arr.capacity == number of slots
   Array_t arr;
+  u8 *    ctrl;
   size_t  item_count;
-  void    release() {
+  size_t  deleted_count;
+
+  void release() {
     arr.release();
-    item_count = 0;
+    if (ctrl != NULL) Allcator_t::free(ctrl);
+    ctrl          = NULL;
+    item_count    = 0;
+    deleted_count = 0;
   }
   void init() {
     arr.init();
-    item_count = 0;
+    ctrl          = NULL;
+    item_count    = 0;
+    deleted_count = 0;
   }
+  // Drops all items, keeps the memory
   void reset() {
-    arr.memzero();
-    item_count = 0;
+    if (ctrl != NULL) memset(ctrl, Hash_Ctrl::EMPTY, arr.capacity);
+    item_count    = 0;
+    deleted_count = 0;
   }
-  i32 find(K key) {
-    if (item_count == 0) return -1;
-    uint64_t key_hash = hash_of(key);
-    uint64_t hash = key_hash;
-    uint64_t size = arr.capacity;
-    if (size == 0) return -1;
-    uint32_t attempt_id = 0;
-    for (; attempt_id < MAX_ATTEMPTS; ++attempt_id) {
-      uint64_t id = hash % size;
-      if (hash != 0) {
-        if (arr.ptr[id].hash == key_hash && arr.ptr[id].key == key) {
-          return (i32)id;
+  // Drops all items, the memory is kept only when shrinking is disabled
+  void clear() {
+    if (shrink_k == 0)
+      reset();
+    else
+      release();
+  }
+  bool is_alive(size_t id) { return Hash_Ctrl::is_full(ctrl[id]); }
+
+  static size_t get_initial_capacity() {
+    size_t capacity = Hash_Ctrl::GROUP_SIZE;
+    while (capacity < grow_k) capacity <<= 1;
+    return capacity;
+  }
+
+  // Smallest capacity that holds `count` items at no more than half the maximum load
+  static size_t get_capacity_for(size_t count) {
+    size_t capacity = get_initial_capacity();
+    while (count * 16 > capacity * 7) capacity <<= 1;
+    return capacity;
+  }
+
+  /** Walks the probe sequence of `hash`
+    Returns the slot of `key` or -1, in the latter case `*free_slot` gets the first slot where
+    `key` could be inserted.
+   */
+  i32 probe(K const &key, uint64_t hash, size_t *free_slot) {
+    if (arr.capacity == 0) return -1;
+    size_t num_groups = arr.capacity / Hash_Ctrl::GROUP_SIZE;
+    size_t mask       = num_groups - 1;
+    size_t group_id   = Hash_Ctrl::h1(hash) & mask;
+    bool   has_free   = false;
+    u8     h2         = Hash_Ctrl::h2(hash);
+    for (size_t step = 1; step <= num_groups; step++) {
+      size_t    base  = group_id * Hash_Ctrl::GROUP_SIZE;
+      u8 const *group = ctrl + base;
+      u32       match = Hash_Ctrl::match(group, h2);
+      while (match != 0) {
+        size_t id = base + ctz32(match);
+        if (arr.ptr[id].hash == hash && arr.ptr[id].key == key) return (i32)id;
+        match &= match - 1;
+      }
+      if (free_slot != NULL && !has_free) {
+        u32 free_mask = Hash_Ctrl::match_free(group);
+        if (free_mask != 0) {
+          *free_slot = base + ctz32(free_mask);
+          has_free   = true;
         }
       }
-      hash = hash_of(hash);
+      if (Hash_Ctrl::match_empty(group) != 0) return -1;
+      group_id = (group_id + step) & mask;
     }
     return -1;
   }
 
-  bool try_insert(K key) {
-    uint64_t key_hash = hash_of(key);
-    uint64_t hash = key_hash;
-    uint64_t size = arr.capacity;
-    if (size == 0) {
-      arr.resize(grow_k);
-      arr.memzero();
-      size = arr.capacity;
-    }
-    Hash_Pair pair;
-    pair.key  = key;
-    pair.hash = key_hash;
-    for (uint32_t attempt_id = 0; attempt_id < MAX_ATTEMPTS; ++attempt_id) {
-      uint64_t id = hash % size;
-      if (hash != 0) {
-        if (arr.ptr[id].hash == 0) { // Empty slot
-          arr.ptr[id] = pair;
-          item_count += 1;
-          return true;
-        } else if (arr.ptr[id].hash == key_hash && arr.ptr[id].key == key) { // Override
-          arr.ptr[id] = pair;
-          return true;
-        } else { // collision
-          (void)0;
-        }
-      }
-      hash = hash_of(hash);
+  size_t find_free_slot(uint64_t hash) {
+    size_t num_groups = arr.capacity / Hash_Ctrl::GROUP_SIZE;
+    size_t mask       = num_groups - 1;
+    size_t group_id   = Hash_Ctrl::h1(hash) & mask;
+    for (size_t step = 1; step <= num_groups; step++) {
+      size_t base      = group_id * Hash_Ctrl::GROUP_SIZE;
+      u32    free_mask = Hash_Ctrl::match_free(ctrl + base);
+      if (free_mask != 0) return base + ctz32(free_mask);
+      group_id = (group_id + step) & mask;
     }
-    return false;
+    TRAP;
   }
 
-  bool try_resize(size_t new_size) {
-    ASSERT_DEBUG(new_size > 0);
-    Array_t old_arr        = arr;
-    size_t  old_item_count = item_count;
-    {
-      Array_t new_arr;
-      new_arr.init();
-      ASSERT_DEBUG(new_size > 0);
-      new_arr.resize(new_size);
-      new_arr.memzero();
-      arr        = new_arr;
-      item_count = 0;
-    }
-    uint32_t i = 0;
-    for (; i < old_arr.capacity; ++i) {
-      Hash_Pair pair = old_arr.ptr[i];
-      if (pair.hash != 0) {
-        bool suc = try_insert(pair.key);
-        if (!suc) {
-          arr.release();
-          arr        = old_arr;
-          item_count = old_item_count;
-          return false;
-        }
+  void occupy(size_t id, K const &key, uint64_t hash) {
+    ASSERT_DEBUG(!Hash_Ctrl::is_full(ctrl[id]));
+    if (ctrl[id] == Hash_Ctrl::DELETED) deleted_count -= 1;
+    ctrl[id]         = Hash_Ctrl::h2(hash);
+    arr.ptr[id].key  = key;
+    arr.ptr[id].hash = hash;
+    item_count += 1;
+  }
+
+  /** Rebuilds the table with `new_capacity` slots, dropping all tombstones
+    The stored hashes are reused, keys are not hashed again.
+   */
+  void rehash(size_t new_capacity) {
+    ASSERT_DEBUG(new_capacity >= Hash_Ctrl::GROUP_SIZE);
+    ASSERT_DEBUG((new_capacity & (new_capacity - 1)) == 0);
+    ASSERT_DEBUG(item_count * 8 < new_capacity * 7);
+    Array_t old_arr      = arr;
+    u8 *    old_ctrl     = ctrl;
+    size_t  old_capacity = arr.capacity;
+    arr.init();
+    arr.resize(new_capacity);
+    ctrl = (u8 *)Allcator_t::alloc(new_capacity);
+    memset(ctrl, Hash_Ctrl::EMPTY, new_capacity);
+    item_count    = 0;
+    deleted_count = 0;
+    ito(old_capacity) {
+      if (Hash_Ctrl::is_full(old_ctrl[i])) {
+        Hash_Pair &pair = old_arr.ptr[i];
+        occupy(find_free_slot(pair.hash), pair.key, pair.hash);
       }
     }
     old_arr.release();
+    if (old_ctrl != NULL) Allcator_t::free(old_ctrl);
+  }
+
+  // Returns true when the table had to be rebuilt to fit one more item
+  bool reserve_one() {
+    size_t capacity = arr.capacity;
+    if (capacity == 0) {
+      rehash(get_initial_capacity());
+      return true;
+    }
+    if ((item_count + deleted_count + 1) * 8 <= capacity * 7) return false;
+    // Mostly tombstones: clean them up in place instead of growing
+    if ((item_count + 1) * 16 <= capacity * 7)
+      rehash(capacity);
+    else
+      rehash(capacity << 1);
     return true;
   }
 
+  i32 find(K key) {
+    if (item_count == 0) return -1;
+    return probe(key, hash_of(key), NULL);
+  }
+
+  /** Single probe lookup, inserts `key` when it is missing
+    Returns the slot index, `*found` tells whether the key was already there.
+   */
+  u32 find_or_insert(K key, bool *found) {
+    uint64_t hash      = hash_of(key);
+    size_t   free_slot = 0;
+    i32      id        = probe(key, hash, &free_slot);
+    if (id >= 0) {
+      *found = true;
+      return (u32)id;
+    }
+    *found = false;
+    if (reserve_one()) free_slot = find_free_slot(hash);
+    occupy(free_slot, key, hash);
+    return (u32)free_slot;
+  }
+
+  void erase_slot(size_t id) {
+    ASSERT_DEBUG(Hash_Ctrl::is_full(ctrl[id]));
+    // A lookup stops at the first group with an EMPTY byte, if this group already has one no
+    // probe sequence goes past it and the slot can become EMPTY right away
+    size_t base = id & ~(size_t)(Hash_Ctrl::GROUP_SIZE - 1);
+    if (Hash_Ctrl::match_empty(ctrl + base) != 0) {
+      ctrl[id] = Hash_Ctrl::EMPTY;
+    } else {
+      ctrl[id] = Hash_Ctrl::DELETED;
+      deleted_count += 1;
+    }
+    item_count -= 1;
+  }
+
+  // Applies the low-water mark after removals
+  void try_shrink() {
+    if (shrink_k == 0 || arr.capacity == 0) return;
+    if (item_count == 0) {
+      release();
+      return;
+    }
+    if (item_count * shrink_k >= arr.capacity) return;
+    size_t new_capacity = get_capacity_for(item_count);
+    if (new_capacity < arr.capacity) rehash(new_capacity);
+  }
+
   void remove(K key) {
-    if (item_count == 0) return;
-    while (true) {
-      i32 id = find(key);
-      if (id > -1) {
-        ASSERT_DEBUG(item_count > 0);
-        arr.ptr[id].hash = 0u;
-        item_count -= 1;
-        if (item_count == 0) {
-          arr.release();
-        } else if (arr.size + grow_k < arr.capacity) {
-          try_resize(arr.capacity - grow_k);
-        }
+    i32 id = find(key);
+    if (id < 0) return;
+    erase_slot((size_t)id);
+    try_shrink();
+  }
 
-      } else {
-        break;
-      }
+  /** Removes every key in `keys`, shrinking at most once at the end
+    Returns the number of removed items.
+   */
+  size_t remove_many(K const *keys, size_t count) {
+    size_t num_removed = 0;
+    ito(count) {
+      i32 id = find(keys[i]);
+      if (id < 0) continue;
+      erase_slot((size_t)id);
+      num_removed += 1;
     }
+    try_shrink();
+    return num_removed;
   }
 
-  bool insert(K key) {
-    u32  iters = 0x10;
-    bool suc   = false;
-    while (!(suc = try_insert(key))) {
-      u32    resize_iters = 6;
-      size_t new_size     = arr.capacity + grow_k;
-      bool   resize_suc   = false;
-      size_t grow_rate    = grow_k << 1;
-      while (!(resize_suc = try_resize(new_size))) {
-        if (resize_iters == 0) break;
-        new_size += grow_rate;
-        grow_rate = grow_rate << 1;
-        resize_iters -= 1;
+  /** Removes all items for which f(key) returns true in one pass over the table
+    Returns the number of removed items.
+   */
+  template <typename F> size_t remove_if(F f) {
+    size_t num_removed = 0;
+    ito(arr.capacity) {
+      if (Hash_Ctrl::is_full(ctrl[i]) && f(arr.ptr[i].key)) {
+        erase_slot(i);
+        num_removed += 1;
       }
-      (void)resize_suc;
-      ASSERT_DEBUG(resize_suc == true);
-      if (iters == 0) break;
-      iters -= 1;
     }
-    ASSERT_DEBUG(suc == true);
-    return suc;
+    try_shrink();
+    return num_removed;
+  }
+
+  bool insert(K key) {
+    bool found = false;
+    u32  id    = find_or_insert(key, &found);
+    if (found) arr.ptr[id].key = key; // Override
+    return true;
   }
 
   bool contains(K key) { return find(key) != -1; }
@@ -882,95 +2088,2531 @@ template <typename K, typename V> u64 hash_of(Map_Pair<K, V> const &item) {
 }
 
 template <typename K, typename V, typename Allcator_t = Default_Allocator, size_t grow_k = 0x100,
-          size_t MAX_ATTEMPTS = 0x20>
+          size_t shrink_k = 8>
 struct Hash_Table {
   using Pair_t = Map_Pair<K, V>;
-  Hash_Set<Map_Pair<K, V>, Allcator_t, grow_k, MAX_ATTEMPTS> set;
-  void                                                       release() { set.release(); }
-  void                                                       init() { set.init(); }
+  Hash_Set<Map_Pair<K, V>, Allcator_t, grow_k, shrink_k> set;
+  void                                                   release() { set.release(); }
+  void                                                   init() { set.init(); }
+  void                                                   reset() { set.reset(); }
+  void                                                   clear() { set.clear(); }
 
-  i32 find(K key) { return set.find(Map_Pair<K, V>{ key,  {}}); }
+  i32 find(K key) { return set.find(Map_Pair<K, V>{key, {}}); }
 
   V get(K key) {
-    i32 id = set.find(Map_Pair<K, V>{ key,  {}});
+    i32 id = set.find(Map_Pair<K, V>{key, {}});
     ASSERT_DEBUG(id >= 0);
     return set.arr[id].key.value;
   }
 
   V *get_or_null(K key) {
     if (set.item_count == 0) return 0;
-    i32 id = set.find(Map_Pair<K, V>{ key,  {}});
+    i32 id = set.find(Map_Pair<K, V>{key, {}});
     if (id < 0) return 0;
     return &set.arr[id].key.value;
   }
 
-  void remove(K key) { return set.remove(Map_Pair<K, V>{ key,  {}}); }
+  /** Single probe lookup, adds a value initialized entry when `key` is missing
+    The pointer stays valid until the next insertion.
+   */
+  V *get_or_insert(K key, bool *found) {
+    u32 id = set.find_or_insert(Map_Pair<K, V>{key, {}}, found);
+    return &set.arr[id].key.value;
+  }
+
+  void remove(K key) { return set.remove(Map_Pair<K, V>{key, {}}); }
+
+  size_t remove_many(K const *keys, size_t count) {
+    size_t num_removed = 0;
+    ito(count) {
+      i32 id = set.find(Map_Pair<K, V>{keys[i], {}});
+      if (id < 0) continue;
+      set.erase_slot((size_t)id);
+      num_removed += 1;
+    }
+    set.try_shrink();
+    return num_removed;
+  }
+
+  // f(Pair_t &) returns true for the entries to remove
+  template <typename F> size_t remove_if(F f) { return set.remove_if(f); }
 
-  bool insert(K key, V value) { return set.insert(Map_Pair<K, V>{ key,  value}); }
+  bool insert(K key, V value) { return set.insert(Map_Pair<K, V>{key, value}); }
 
-  bool contains(K key) { return set.contains(Map_Pair<K, V>{ key,  {}}); }
+  bool contains(K key) { return set.contains(Map_Pair<K, V>{key, {}}); }
 
   template <typename F> void iter(F f) {
     ito(set.arr.size) {
-      auto &item = set.arr[i];
-      if (item.hash != 0) {
-        f(item.key);
+      if (set.is_alive(i)) {
+        f(set.arr.ptr[i].key);
       }
     }
   }
   template <typename F> void iter_values(F f) {
     ito(set.arr.size) {
-      auto &item = set.arr[i];
-      if (item.hash != 0) {
-        f(item.key.value);
+      if (set.is_alive(i)) {
+        f(set.arr.ptr[i].key.value);
       }
     }
   }
 };
 
-#endif
+/** Hash table with densely packed entries
+  Entries live contiguously in `items`, in insertion order until a removal moves the last entry
+  into the hole. `index` maps a key to its position in `items`, so iteration is a linear scan
+  with no empty slots. Pointers into `items` are invalidated by insert and remove.
+ */
+template <typename K, typename V, typename Allcator_t = Default_Allocator, size_t grow_k = 0x100>
+struct Dense_Hash_Table {
+  using Pair_t = Map_Pair<K, V>;
+  Array<Pair_t, grow_k, Allcator_t>     items;
+  Hash_Table<K, u32, Allcator_t, grow_k> index;
+  void                                   init() {
+    items.init();
+    index.init();
+  }
+  void release() {
+    items.release();
+    index.release();
+  }
+  void reset() {
+    items.reset();
+    index.reset();
+  }
+  size_t get_size() { return items.size; }
 
-#ifdef UTILS_IMPL
-#ifndef UTILS_IMPL_H
-#define UTILS_IMPL_H
-#include <string.h>
+  i32 find(K key) {
+    u32 *id = index.get_or_null(key);
+    return id != NULL ? (i32)*id : -1;
+  }
 
-struct Thread_Local {
-  Temporary_Storage<> temporal_storage;
-  bool                initialized = false;
-  ~Thread_Local() { temporal_storage.release(); }
+  V get(K key) {
+    u32 *id = index.get_or_null(key);
+    ASSERT_DEBUG(id != NULL);
+    return items[*id].value;
+  }
+
+  V *get_or_null(K key) {
+    u32 *id = index.get_or_null(key);
+    if (id == NULL) return NULL;
+    return &items[*id].value;
+  }
+
+  /** Single probe lookup, appends a value initialized entry when `key` is missing
+   */
+  V *get_or_insert(K key, bool *found) {
+    u32 *id = index.get_or_insert(key, found);
+    if (!*found) {
+      *id = (u32)items.size;
+      items.push(Pair_t{key, {}});
+    }
+    return &items[*id].value;
+  }
+
+  bool insert(K key, V value) {
+    bool              found = false;
+    u32               slot  = index.set.find_or_insert(Map_Pair<K, u32>{key, 0}, &found);
+    Map_Pair<K, u32> &entry = index.set.arr.ptr[slot].key;
+    if (found) {
+      // Override, the key is replaced in both places
+      entry.key          = key;
+      items[entry.value] = Pair_t{key, value};
+    } else {
+      entry.value = (u32)items.size;
+      items.push(Pair_t{key, value});
+    }
+    return true;
+  }
+
+  // Swap-remove: the last entry takes the place of the removed one
+  void remove(K key) {
+    i32 slot = index.find(key);
+    if (slot < 0) return;
+    u32 id = index.set.arr.ptr[slot].key.value;
+    index.set.erase_slot((size_t)slot);
+    Pair_t last = items.pop();
+    if (id != items.size) {
+      items[id]                    = last;
+      *index.get_or_null(last.key) = id;
+    }
+    index.set.try_shrink();
+  }
+
+  bool contains(K key) { return index.contains(key); }
+
+  template <typename F> void iter(F f) {
+    ito(items.size) f(items.ptr[i]);
+  }
+  template <typename F> void iter_values(F f) {
+    ito(items.size) f(items.ptr[i].value);
+  }
 };
 
-// TODO(aschrein): Change to __thread?
-thread_local Thread_Local g_tl{};
+/** Insert-only hash table that many threads may use at once
+  Lookups are lock-free and never write. Inserts claim an empty slot with a CAS, entries are
+  built before they are published so a reader never sees a half written value. Entries are
+  allocated one by one and never move, value pointers stay valid until release.
+  Slots are probed linearly. Past half load the inserter that notices allocates a table twice
+  the size and links it as `next`; from then on every insert first migrates a chunk of slots, so
+  the resize is spread over many inserts and nobody waits for it. A migrated entry leaves MOVED
+  behind, probes step over it. An empty slot is turned into SEALED, which ends the probe in that
+  table like an empty one and sends lookups and inserts on to the next.
+  Old tables stay allocated until release since readers may still be walking them, together
+  they are smaller than the current one.
+  Keys are stored as given: string_ref keys must outlive the table.
+ */
+template <typename K, typename V, typename Allcator_t = Default_Allocator, size_t grow_k = 0x100>
+struct Concurrent_Hash_Table {
+  static constexpr size_t MIGRATE_CHUNK = 0x100;
+  struct Entry {
+    K   key;
+    V   value;
+    u64 hash;
+  };
+  struct Table {
+    size_t               capacity;
+    std::atomic<size_t>  count;
+    std::atomic<Table *> next;
+    std::atomic<bool>    resize_claimed;
+    std::atomic<size_t>  migrate_cursor;
+    std::atomic<size_t>  migrate_done;
+    std::atomic<Entry *> slots[1];
+  };
+  static Entry *moved() { return (Entry *)(uintptr_t)1; }
+  static Entry *sealed() { return (Entry *)(uintptr_t)2; }
+  static bool   is_entry(Entry *e) { return (uintptr_t)e > 2; }
 
-Thread_Local *get_tl() {
-  if (g_tl.initialized == false) {
-    g_tl.initialized      = true;
-    g_tl.temporal_storage = Temporary_Storage<>::create(1 << 24);
+  std::atomic<Table *> root;
+  // Start of the chain of tables linked by `next`
+  Table *             first;
+  std::atomic<size_t> item_count;
+
+  static Table *create_table(size_t capacity) {
+    Table *t = (Table *)Allcator_t::alloc(sizeof(Table) + sizeof(std::atomic<Entry *>) * capacity);
+    t->capacity = capacity;
+    t->count.store(0, std::memory_order_relaxed);
+    t->next.store(NULL, std::memory_order_relaxed);
+    t->resize_claimed.store(false, std::memory_order_relaxed);
+    t->migrate_cursor.store(0, std::memory_order_relaxed);
+    t->migrate_done.store(0, std::memory_order_relaxed);
+    ito(capacity) t->slots[i].store(NULL, std::memory_order_relaxed);
+    return t;
   }
-  return &g_tl;
-}
 
-void *tl_alloc_tmp(size_t size) { return get_tl()->temporal_storage.alloc(size); }
+  void init() {
+    size_t capacity = 0x10;
+    while (capacity < grow_k) capacity <<= 1;
+    first = create_table(capacity);
+    root.store(first, std::memory_order_release);
+    item_count.store(0, std::memory_order_relaxed);
+  }
+  // Not concurrent with anything else
+  void release() {
+    Table *t = first;
+    while (t != NULL) {
+      ito(t->capacity) {
+        Entry *e = t->slots[i].load(std::memory_order_relaxed);
+        if (is_entry(e)) Allcator_t::free(e);
+      }
+      Table *next = t->next.load(std::memory_order_relaxed);
+      Allcator_t::free(t);
+      t = next;
+    }
+    first = NULL;
+    root.store(NULL, std::memory_order_relaxed);
+    item_count.store(0, std::memory_order_relaxed);
+  }
+  size_t get_size() { return item_count.load(std::memory_order_relaxed); }
 
-void tl_alloc_tmp_enter() { get_tl()->temporal_storage.enter_scope(); }
-void tl_alloc_tmp_exit() { get_tl()->temporal_storage.exit_scope(); }
+  // Links a table twice the size, waits when another thread is already allocating it
+  static Table *grow(Table *t) {
+    Table *next = t->next.load(std::memory_order_acquire);
+    if (next != NULL) return next;
+    if (!t->resize_claimed.exchange(true, std::memory_order_acq_rel)) {
+      next = create_table(t->capacity * 2);
+      t->next.store(next, std::memory_order_release);
+      return next;
+    }
+    while ((next = t->next.load(std::memory_order_acquire)) == NULL) {
+#if defined(__SSE2__)
+      _mm_pause();
+#endif
+    }
+    return next;
+  }
 
-void *tl_alloc(size_t size) { return malloc(size); }
+  /** Returns the entry of `key`, inserting `fresh` when it's missing and `fresh` isn't NULL
+    Starts in `t` and follows the chain. During a resize new entries only go to the newest table:
+    an inserter seals the empty slot that ends its probe so no one can fill it late, then moves
+    on. No key sits past a sealed slot: it was empty when sealed and slots never empty again.
+   */
+  static Entry *find_or_insert(Table *t, K const &key, u64 hash, Entry *fresh) {
+    while (t != NULL) {
+      size_t mask = t->capacity - 1;
+      size_t id   = (size_t)hash & mask;
+      size_t n    = 0;
+      while (n < t->capacity) {
+        Entry *e = t->slots[id].load(std::memory_order_acquire);
+        // The probe sequence ends here, the key isn't in this table
+        if (e == sealed()) break;
+        if (e == NULL) {
+          if (fresh == NULL) break;
+          Entry *desired = t->next.load(std::memory_order_acquire) != NULL ? sealed() : fresh;
+          if (!t->slots[id].compare_exchange_strong(e, desired, std::memory_order_acq_rel,
+                                                    std::memory_order_acquire))
+            continue;
+          if (desired == sealed()) break;
+          if ((t->count.fetch_add(1, std::memory_order_relaxed) + 1) * 2 > t->capacity) grow(t);
+          return fresh;
+        }
+        if (e != moved() && e->hash == hash && e->key == key) return e;
+        id = (id + 1) & mask;
+        n++;
+      }
+      if (n == t->capacity && fresh != NULL)
+        t = grow(t);
+      else
+        t = t->next.load(std::memory_order_acquire);
+    }
+    return NULL;
+  }
 
-void *tl_realloc(void *ptr, size_t oldsize, size_t newsize) {
-  if (oldsize == newsize) return ptr;
-  size_t min_size = oldsize < newsize ? oldsize : newsize;
-  void * new_ptr  = NULL;
-  if (newsize != 0) new_ptr = malloc(newsize);
-  if (min_size != 0) {
-    memcpy(new_ptr, ptr, min_size);
+  // Moves one chunk of the root's slots into the next table, the last chunk retires the root
+  void help_migrate(Table *t) {
+    Table *next = t->next.load(std::memory_order_acquire);
+    if (next == NULL) return;
+    size_t begin = t->migrate_cursor.fetch_add(MIGRATE_CHUNK, std::memory_order_relaxed);
+    if (begin >= t->capacity) return;
+    size_t end = MIN(begin + MIGRATE_CHUNK, t->capacity);
+    for (size_t i = begin; i < end; i++) {
+      Entry *e = t->slots[i].load(std::memory_order_acquire);
+      if (e == NULL &&
+          t->slots[i].compare_exchange_strong(e, sealed(), std::memory_order_acq_rel,
+                                              std::memory_order_acquire))
+        continue;
+      if (!is_entry(e)) continue;
+      // Published in the next table before the slot is marked, lookups find it in one of them
+      Entry *placed = find_or_insert(next, e->key, e->hash, e);
+      ASSERT_DEBUG(placed == e);
+      t->slots[i].store(moved(), std::memory_order_release);
+    }
+    size_t done = t->migrate_done.fetch_add(end - begin, std::memory_order_acq_rel) + end - begin;
+    if (done == t->capacity) root.compare_exchange_strong(t, next, std::memory_order_acq_rel);
   }
-  if (ptr != NULL) free(ptr);
-  return new_ptr;
-}
 
-void tl_free(void *ptr) { free(ptr); }
+  V *get_or_null(K key) {
+    Entry *e = find_or_insert(root.load(std::memory_order_acquire), key, hash_of(key), NULL);
+    return e != NULL ? &e->value : NULL;
+  }
+
+  bool contains(K key) { return get_or_null(key) != NULL; }
+
+  /** Inserts `value` under `key` unless the key is present, returns the stored value
+    `*found` tells whether the key was already there. The first insert wins a race.
+   */
+  V *get_or_insert(K key, V value, bool *found) {
+    Table *t = root.load(std::memory_order_acquire);
+    if (t->next.load(std::memory_order_relaxed) != NULL) {
+      help_migrate(t);
+      t = root.load(std::memory_order_acquire);
+    }
+    u64 hash = hash_of(key);
+    // Skip the allocation when the key is already there
+    if (Entry *e = find_or_insert(t, key, hash, NULL)) {
+      *found = true;
+      return &e->value;
+    }
+    Entry *fresh = (Entry *)Allcator_t::alloc(sizeof(Entry));
+    fresh->key   = key;
+    fresh->value = value;
+    fresh->hash  = hash;
+    Entry *e     = find_or_insert(t, key, hash, fresh);
+    *found       = e != fresh;
+    if (*found)
+      Allcator_t::free(fresh);
+    else
+      item_count.fetch_add(1, std::memory_order_relaxed);
+    return &e->value;
+  }
+
+  // Existing values are kept, returns true when `key` was added
+  bool insert(K key, V value) {
+    bool found = false;
+    get_or_insert(key, value, &found);
+    return !found;
+  }
+
+  // f(K const &, V &) for every entry, not concurrent with inserts
+  template <typename F> void iter(F f) {
+    for (Table *t = root.load(std::memory_order_acquire); t != NULL;
+         t        = t->next.load(std::memory_order_acquire)) {
+      ito(t->capacity) {
+        Entry *e = t->slots[i].load(std::memory_order_acquire);
+        if (is_entry(e)) f(e->key, e->value);
+      }
+    }
+  }
+};
+
+/** Densely packed storage addressed by generation checked handles
+  A handle packs a slot index (low SLOTMAP_INDEX_BITS) and the slot generation (high bits). The
+  generation is bumped every time a slot is freed, so a stale handle never aliases a newer item.
+  Generations start at 1, the zero handle is never valid.
+  Items live contiguously in `items`, removal moves the last item into the hole. Iteration only
+  touches live items. Pointers into `items` are invalidated by insert and remove, handles are not.
+ */
+static constexpr u32 SLOTMAP_INDEX_BITS = 20;
+static constexpr u32 SLOTMAP_INDEX_MASK = (1u << SLOTMAP_INDEX_BITS) - 1;
+// Keeps handles within 31 bits so they survive a trip through i32
+static constexpr u32 SLOTMAP_GEN_MASK = (1u << (31 - SLOTMAP_INDEX_BITS)) - 1;
+
+template <typename T, size_t grow_k = 0x100, typename Allcator_t = Default_Allocator>
+struct SlotMap {
+  struct Slot {
+    // Position in `items` while in use, next free slot otherwise
+    u32  index;
+    u32  generation;
+    bool free;
+  };
+  Array<T, grow_k, Allcator_t>    items;
+  // Slot index of every item, parallel to `items`
+  Array<u32, grow_k, Allcator_t>  item_slots;
+  Array<Slot, grow_k, Allcator_t> slots;
+  u32                             free_head;
+
+  static u32 make_handle(u32 slot, u32 generation) {
+    return (generation << SLOTMAP_INDEX_BITS) | slot;
+  }
+  static u32 handle_slot(u32 handle) { return handle & SLOTMAP_INDEX_MASK; }
+  static u32 handle_generation(u32 handle) { return handle >> SLOTMAP_INDEX_BITS; }
+
+  void init() {
+    items.init();
+    item_slots.init();
+    slots.init();
+    free_head = SLOTMAP_INDEX_MASK;
+  }
+  void release() {
+    items.release();
+    item_slots.release();
+    slots.release();
+    free_head = SLOTMAP_INDEX_MASK;
+  }
+  void reset() {
+    release();
+    init();
+  }
+  size_t get_size() { return items.size; }
+
+  u32 insert(T value) {
+    u32 slot;
+    if (free_head != SLOTMAP_INDEX_MASK) {
+      slot             = free_head;
+      free_head        = slots[slot].index;
+      slots[slot].free = false;
+    } else {
+      slot = (u32)slots.size;
+      ASSERT_ALWAYS(slot < SLOTMAP_INDEX_MASK);
+      slots.push(Slot{0, 1, false});
+    }
+    slots[slot].index = (u32)items.size;
+    items.push(value);
+    item_slots.push(slot);
+    return make_handle(slot, slots[slot].generation);
+  }
+
+  /** Position of the item in `items` or -1 for a stale handle
+    Handles come from scripts too, a free slot is rejected even when its generation matches.
+   */
+  i32 find(u32 handle) {
+    u32 slot = handle_slot(handle);
+    if (handle == 0 || slot >= slots.size) return -1;
+    if (slots[slot].free || slots[slot].generation != handle_generation(handle)) return -1;
+    return (i32)slots[slot].index;
+  }
+
+  bool is_alive(u32 handle) { return find(handle) >= 0; }
+
+  T *get_or_null(u32 handle) {
+    i32 id = find(handle);
+    return id >= 0 ? &items[id] : NULL;
+  }
+
+  T &get(u32 handle) {
+    i32 id = find(handle);
+    ASSERT_DEBUG(id >= 0);
+    return items[id];
+  }
+
+  /** Handle of the item at `index` in `items`
+   */
+  u32 get_handle(u32 index) {
+    u32 slot = item_slots[index];
+    return make_handle(slot, slots[slot].generation);
+  }
+
+  /** Swap-remove: returns the position the item occupied, the last item now lives there.
+    Returns -1 for a stale handle. Owners of arrays parallel to `items` mirror the move.
+   */
+  i32 remove(u32 handle) {
+    i32 id = find(handle);
+    if (id < 0) return -1;
+    u32 slot  = handle_slot(handle);
+    T   last  = items.pop();
+    u32 lslot = item_slots.pop();
+    if ((u32)id != items.size) {
+      items[id]          = last;
+      item_slots[id]     = lslot;
+      slots[lslot].index = (u32)id;
+    }
+    u32 generation = (slots[slot].generation + 1) & SLOTMAP_GEN_MASK;
+    slots[slot].generation = generation == 0 ? 1 : generation;
+    slots[slot].index      = free_head;
+    slots[slot].free       = true;
+    free_head              = slot;
+    return id;
+  }
+
+  /** f(handle, item) for every live item
+   */
+  template <typename F> void iter(F f) {
+    ito(items.size) f(get_handle((u32)i), items.ptr[i]);
+  }
+};
+
+/** Handle of an interned string
+  Every distinct string is stored once in a global table, two atoms are equal iff their strings
+  are equal. The null atom stands for the empty string.
+ */
+struct Atom {
+  u32  id;
+  bool is_null() const { return id == 0; }
+};
+
+static inline bool operator==(Atom a, Atom b) { return a.id == b.id; }
+static inline bool operator!=(Atom a, Atom b) { return a.id != b.id; }
+static inline u64  hash_of(Atom a) { return hash_of((u64)a.id); }
+
+/** Returns the atom of `str`, copies it into the table the first time it's seen
+  Interned strings are zero terminated and never move or go away.
+  Safe from any thread, lookups of strings that are already interned don't take a lock.
+ */
+Atom intern(string_ref str);
+/** Returns the atom of `str` or the null atom if it has never been interned
+ */
+Atom atom_find(string_ref str);
+/** Zero terminated string of `atom`
+ */
+string_ref atom_str(Atom atom);
+
+/** Atom of a string literal, interned once per call site
+ */
+#define ATOM(lit)                                                                                  \
+  ([]() {                                                                                          \
+    static Atom _atom_ = intern(stref_s(lit));                                                     \
+    return _atom_;                                                                                 \
+  }())
+
+/** Work-stealing job system
+  Every worker owns a Chase-Lev deque, it pushes and pops jobs at the bottom while idle workers
+  steal from the top. The thread that calls jobs_init is worker 0, it runs jobs while it waits
+  for a group. A job runs inside a temporary storage scope of its worker's Thread_Local, memory
+  from tl_alloc_tmp is released when the job returns.
+  Before jobs_init and on threads that are not workers everything runs inline.
+ */
+typedef void (*Job_Fn)(void *data, u32 begin, u32 end);
+
+/** Number of unfinished jobs, wait for the group before it goes out of scope
+ */
+struct Job_Group {
+  std::atomic<u32> pending{0};
+};
+
+/** Starts `num_workers` - 1 threads, zero means one worker per hardware thread
+ */
+void jobs_init(u32 num_workers = 0);
+/** Joins the workers, call from the thread that called jobs_init with no jobs in flight
+ */
+void jobs_release();
+/** Number of workers including the caller of jobs_init, 1 when the system isn't running
+ */
+u32 jobs_num_workers();
+/** Index of the calling worker or -1
+ */
+i32 jobs_worker_index();
+/** Queues fn(data, begin, end) in `group`
+  Ranges longer than `grain` are halved when the job starts, the upper halves are pushed as new
+  jobs that other workers may steal.
+ */
+void jobs_run(Job_Group *group, Job_Fn fn, void *data, u32 begin, u32 end, u32 grain);
+/** Runs queued jobs until every job of `group` has finished
+ */
+void jobs_wait(Job_Group *group);
+
+/** Queues f() in `group`, `f` has to stay alive until the group is waited for
+ */
+template <typename F> static inline void jobs_run(Job_Group *group, F &f) {
+  jobs_run(
+      group, [](void *data, u32, u32) { (*(F *)data)(); }, (void *)&f, 0, 1, 1);
+}
+
+/** Calls f(begin, end) for disjoint subranges that cover [begin, end) and waits for them
+  Ranges are split down to `grain` items, small ranges run inline.
+ */
+template <typename F>
+static inline void parallel_for(u32 begin, u32 end, u32 grain, F const &f) {
+  if (begin >= end) return;
+  grain = MAX(grain, 1u);
+  if (end - begin <= grain || jobs_num_workers() == 1 || jobs_worker_index() < 0) {
+    f(begin, end);
+    return;
+  }
+  Job_Group group;
+  jobs_run(
+      &group, [](void *data, u32 b, u32 e) { (*(F const *)data)(b, e); }, (void *)&f, begin, end,
+      grain);
+  jobs_wait(&group);
+}
+
+/** Calls emit(i, dst + k) for every i in [0, count), keeps the items it returns true for
+  Order is preserved. Item i is only ever written at or below dst + i, so `dst` may be the array
+  emit reads from. Returns the number of items kept.
+ */
+template <typename T, typename F>
+static inline u32 parallel_compact(T *dst, u32 count, u32 grain, F const &emit) {
+  grain          = MAX(grain, 1u);
+  u32 num_chunks = (count + grain - 1) / grain;
+  if (num_chunks <= 1) {
+    u32 kept = 0;
+    ito(count) kept += emit((u32)i, dst + kept) ? 1 : 0;
+    return kept;
+  }
+  TMP_STORAGE_SCOPE;
+  u32 *chunk_sizes = (u32 *)tl_alloc_tmp(sizeof(u32) * num_chunks);
+  parallel_for(0, num_chunks, 1, [&](u32 chunk_begin, u32 chunk_end) {
+    for (u32 chunk = chunk_begin; chunk < chunk_end; chunk++) {
+      u32 begin = chunk * grain;
+      u32 end   = MIN(count, begin + grain);
+      u32 kept  = 0;
+      for (u32 i = begin; i < end; i++) kept += emit(i, dst + begin + kept) ? 1 : 0;
+      chunk_sizes[chunk] = kept;
+    }
+  });
+  u32 kept = chunk_sizes[0];
+  for (u32 chunk = 1; chunk < num_chunks; chunk++) {
+    if (chunk_sizes[chunk] != 0)
+      memmove(dst + kept, dst + chunk * grain, sizeof(T) * chunk_sizes[chunk]);
+    kept += chunk_sizes[chunk];
+  }
+  return kept;
+}
+
+/** Maps f32 to u32 keys that compare like the floats, for radix_sort
+ */
+static inline u32 radix_key_f32(f32 f) {
+  u32 bits;
+  memcpy(&bits, &f, 4);
+  return bits ^ ((u32)((i32)bits >> 31) | 0x80000000u);
+}
+
+/** Stable LSD radix sort of (keys[i], values[i]) by ascending key, 8 bits per pass
+  `K` is a 32 or 64 bit unsigned integer. The result ends up in `keys` and `values`, the *_tmp
+  arrays are scratch of `count` items. A pass whose digit is the same for every key is skipped,
+  so keys that differ only in a few bytes cost only those passes. Counting and scattering split
+  the input into chunks of `grain` pairs that run on the job system, chunk histograms are
+  prefixed in input order to keep the sort stable.
+ */
+template <typename K, typename V>
+static inline void radix_sort(K *keys, V *values, u32 count, K *keys_tmp, V *values_tmp,
+                              u32 grain = 1 << 14) {
+  static_assert(sizeof(K) == 4 || sizeof(K) == 8, "radix_sort: 32 or 64 bit keys");
+  if (count <= 1) return;
+  grain          = MAX(grain, 1u);
+  u32 num_chunks = (count + grain - 1) / grain;
+  TMP_STORAGE_SCOPE;
+  // Digit counts of each chunk, turned into its write cursors
+  u32 *counts     = (u32 *)tl_alloc_tmp(sizeof(u32) * 0x100 * num_chunks);
+  K *  src_keys   = keys;
+  V *  src_values = values;
+  K *  dst_keys   = keys_tmp;
+  V *  dst_values = values_tmp;
+  for (u32 shift = 0; shift < sizeof(K) * 8; shift += 8) {
+    parallel_for(0, num_chunks, 1, [&](u32 chunk_begin, u32 chunk_end) {
+      for (u32 chunk = chunk_begin; chunk < chunk_end; chunk++) {
+        u32 *chunk_counts = counts + chunk * 0x100;
+        u32  end          = MIN(count, (chunk + 1) * grain);
+        memset(chunk_counts, 0, sizeof(u32) * 0x100);
+        for (u32 i = chunk * grain; i < end; i++) chunk_counts[(src_keys[i] >> shift) & 0xff]++;
+      }
+    });
+    u32  offset = 0;
+    bool skip   = false;
+    for (u32 digit = 0; digit < 0x100 && !skip; digit++) {
+      u32 digit_count = 0;
+      for (u32 chunk = 0; chunk < num_chunks; chunk++) {
+        u32 c                         = counts[chunk * 0x100 + digit];
+        counts[chunk * 0x100 + digit] = offset + digit_count;
+        digit_count += c;
+      }
+      skip = digit_count == count;
+      offset += digit_count;
+    }
+    if (skip) continue;
+    parallel_for(0, num_chunks, 1, [&](u32 chunk_begin, u32 chunk_end) {
+      for (u32 chunk = chunk_begin; chunk < chunk_end; chunk++) {
+        u32 *cursors = counts + chunk * 0x100;
+        u32  end     = MIN(count, (chunk + 1) * grain);
+        for (u32 i = chunk * grain; i < end; i++) {
+          u32 dst         = cursors[(src_keys[i] >> shift) & 0xff]++;
+          dst_keys[dst]   = src_keys[i];
+          dst_values[dst] = src_values[i];
+        }
+      }
+    });
+    SWAP(src_keys, dst_keys);
+    SWAP(src_values, dst_values);
+  }
+  if (src_keys != keys) {
+    memcpy(keys, src_keys, sizeof(K) * count);
+    memcpy(values, src_values, sizeof(V) * count);
+  }
+}
+
+/** Fills `order` with the permutation that sorts `strs` by bytes, equal strings keep their order
+  Strings compare as if padded with zero bytes. Runs one radix_sort on 64 bit keys per 8 bytes of
+  the longest string, from the last 8 bytes to the first.
+ */
+static inline void radix_sort_strings(string_ref const *strs, u32 count, u32 *order) {
+  ito(count) order[i] = i;
+  size_t max_len = 0;
+  ito(count) max_len = MAX(max_len, strs[i].len);
+  if (count <= 1 || max_len == 0) return;
+  TMP_STORAGE_SCOPE;
+  u64 *keys      = (u64 *)tl_alloc_tmp(sizeof(u64) * count);
+  u64 *keys_tmp  = (u64 *)tl_alloc_tmp(sizeof(u64) * count);
+  u32 *order_tmp = (u32 *)tl_alloc_tmp(sizeof(u32) * count);
+  for (size_t offset = (max_len + 7) & ~(size_t)7; offset != 0;) {
+    offset -= 8;
+    ito(count) {
+      string_ref str = strs[order[i]];
+      u64        key = 0;
+      for (size_t k = offset; k < offset + 8; k++)
+        key = (key << 8) | (k < str.len ? (u64)(u8)str.ptr[k] : 0);
+      keys[i] = key;
+    }
+    radix_sort(keys, order, count, keys_tmp, order_tmp);
+  }
+}
+
+#endif
+
+#ifdef UTILS_IMPL
+#ifndef UTILS_IMPL_H
+#define UTILS_IMPL_H
+#include <string.h>
+
+struct Thread_Local {
+  Temporary_Storage<> temporal_storage;
+  bool                initialized      = false;
+  i32                 job_worker_index = -1;
+  ~Thread_Local() { temporal_storage.release(); }
+};
+
+#if __linux__
+// Address space only, pages are committed on use
+static constexpr size_t TL_TMP_RESERVE = (size_t)1 << 34;
+#else
+static constexpr size_t TL_TMP_RESERVE = 1 << 24;
+#endif
+
+// TODO(aschrein): Change to __thread?
+thread_local Thread_Local g_tl{};
+
+Thread_Local *get_tl() {
+  if (g_tl.initialized == false) {
+    g_tl.initialized      = true;
+    g_tl.temporal_storage = Temporary_Storage<>::create(TL_TMP_RESERVE);
+  }
+  return &g_tl;
+}
+
+void *tl_alloc_tmp(size_t size) { return get_tl()->temporal_storage.alloc(size); }
+
+void tl_alloc_tmp_enter() { get_tl()->temporal_storage.enter_scope(); }
+void tl_alloc_tmp_exit() { get_tl()->temporal_storage.exit_scope(); }
+void tl_alloc_tmp_get_stats(Temporary_Storage_Stats *stats) {
+  get_tl()->temporal_storage.get_stats(stats);
+}
+
+#if __linux__
+#include <atomic>
+#include <new>
+#include <sched.h>
+
+// Size-class slab allocator
+//
+// Blocks up to 128 KB come from 1 MB spans carved out of one reserved address range. A pointer is
+// classified with a range check and its span header is found by masking the address. Each span
+// is owned by one thread heap, the owner allocates and frees without synchronization. Other
+// threads push their frees onto the span's atomic remote list, the owner collects them when it
+// runs out of blocks. Larger blocks get their own mapping with a header in front and are grown
+// with mremap. Spans of an exiting thread are handed to whoever allocates from that size class
+// next.
+
+static constexpr size_t SLAB_SPAN_SIZE   = 1 << 20;
+static constexpr size_t SLAB_ARENA_SIZE  = (size_t)1 << 38;
+static constexpr size_t SLAB_HEADER_SIZE = 64;
+static constexpr size_t SLAB_MAX_SMALL   = 1 << 17;
+static constexpr u32    SLAB_NUM_CLASSES = Alloc_Stats::NUM_SIZE_CLASSES;
+// Empty spans a heap keeps before giving them back
+static constexpr u32 SLAB_SPAN_CACHE = 4;
+// Freed large mappings a heap keeps for reuse, bigger ones are always unmapped
+static constexpr u32    SLAB_LARGE_CACHE     = 8;
+static constexpr size_t SLAB_LARGE_CACHE_MAX = 1 << 20;
+
+// 16 byte steps up to 128, then 4 classes per power of two up to 128 KB
+static inline u32 slab_size_class(size_t size) {
+  if (size <= 128) return size == 0 ? 0 : (u32)((size - 1) >> 4);
+  u32 lg = 63 - __builtin_clzll((u64)(size - 1));
+  return 8 + (lg - 7) * 4 + (u32)((size - 1 - ((size_t)1 << lg)) >> (lg - 2));
+}
+
+static inline u32 slab_class_size(u32 size_class) {
+  if (size_class < 8) return (size_class + 1) * 16;
+  u32 k  = size_class - 8;
+  u32 lg = 7 + k / 4;
+  return (1u << lg) + (k % 4 + 1) * (1u << (lg - 2));
+}
+
+struct Slab_Heap;
+
+struct alignas(SLAB_HEADER_SIZE) Slab_Span {
+  enum List_t : u8 { NONE = 0, PARTIAL, FULL };
+  std::atomic<Slab_Heap *> owner;
+  std::atomic<void *>      remote_free;
+  Slab_Span *              next;
+  Slab_Span *              prev;
+  void *                   free_list;
+  u32                      size_class;
+  u32                      block_size;
+  // Blocks handed out, remote frees count until they're collected
+  u32 used;
+  // Offset of the first block that has never been handed out
+  u32    bump;
+  List_t list;
+
+  bool has_free() { return free_list != NULL || bump + block_size <= SLAB_SPAN_SIZE; }
+  // Moves blocks freed by other threads to the local free list, returns their number
+  u32 collect() {
+    if (remote_free.load(std::memory_order_relaxed) == NULL) return 0;
+    void *head  = remote_free.exchange(NULL, std::memory_order_acquire);
+    u32   count = 0;
+    while (head != NULL) {
+      void *next       = *(void **)head;
+      *(void **)head   = free_list;
+      free_list        = head;
+      head             = next;
+      count += 1;
+    }
+    used -= count;
+    return count;
+  }
+};
+static_assert(sizeof(Slab_Span) == SLAB_HEADER_SIZE, "Span header must fit in its slot");
+
+struct alignas(SLAB_HEADER_SIZE) Slab_Large {
+  Slab_Heap *owner;
+  size_t     map_size;
+};
+
+struct Slab_List {
+  Slab_Span *head;
+  void       push(Slab_Span *span, Slab_Span::List_t list) {
+    span->list = list;
+    span->prev = NULL;
+    span->next = head;
+    if (head != NULL) head->prev = span;
+    head = span;
+  }
+  void remove(Slab_Span *span) {
+    if (span->prev != NULL) span->prev->next = span->next;
+    if (span->next != NULL) span->next->prev = span->prev;
+    if (head == span) head = span->next;
+    span->next = NULL;
+    span->prev = NULL;
+    span->list = Slab_Span::NONE;
+  }
+  Slab_Span *pop() {
+    Slab_Span *span = head;
+    if (span != NULL) remove(span);
+    return span;
+  }
+};
+
+struct Slab_Heap {
+  Slab_Span *current[SLAB_NUM_CLASSES];
+  Slab_List  partial[SLAB_NUM_CLASSES];
+  Slab_List  full[SLAB_NUM_CLASSES];
+  // Bumped by remote frees, tells the owner the full lists are worth a scan
+  std::atomic<u32> remote_pending[SLAB_NUM_CLASSES];
+  Slab_Span *      span_cache;
+  u32              num_cached_spans;
+  Slab_Large *     large_cache[SLAB_LARGE_CACHE];
+  u32              num_cached_large;
+  // Large blocks may be freed by any thread
+  std::atomic<size_t> large_live_blocks;
+  std::atomic<size_t> large_live_bytes;
+  size_t              small_live_bytes;
+  size_t              peak_bytes;
+  size_t              num_spans;
+  size_t              live_blocks[SLAB_NUM_CLASSES];
+  size_t              total_blocks[SLAB_NUM_CLASSES];
+  size_t              class_spans[SLAB_NUM_CLASSES];
+  Slab_Heap *         next_free;
+};
+
+struct Slab_Global {
+  std::atomic<bool> lock;
+  std::atomic<u8 *> arena;
+  size_t            arena_cursor;
+  Slab_Span *       free_spans;
+  // Written under the lock, read without it to skip taking the lock when there's nothing there
+  std::atomic<Slab_Span *> abandoned[SLAB_NUM_CLASSES];
+  Slab_Heap *       free_heaps;
+  void              enter() {
+    u32 spins = 0;
+    while (lock.exchange(true, std::memory_order_acquire)) {
+      while (lock.load(std::memory_order_relaxed)) {
+        // The holder may be preempted, don't burn its time slice
+        if (++spins < 64)
+          _mm_pause();
+        else
+          sched_yield();
+      }
+    }
+  }
+  void exit() { lock.store(false, std::memory_order_release); }
+};
+
+static Slab_Global g_slab;
+
+static inline Slab_Span *slab_span_of(void *ptr) {
+  u8 *arena = g_slab.arena.load(std::memory_order_relaxed);
+  if (arena == NULL || (size_t)((u8 *)ptr - arena) >= SLAB_ARENA_SIZE) return NULL;
+  return (Slab_Span *)((size_t)ptr & ~(SLAB_SPAN_SIZE - 1));
+}
+
+static Slab_Span *slab_new_span(Slab_Heap *heap) {
+  if (heap->span_cache != NULL) {
+    Slab_Span *span  = heap->span_cache;
+    heap->span_cache = span->next;
+    heap->num_cached_spans -= 1;
+    return span;
+  }
+  g_slab.enter();
+  defer(g_slab.exit());
+  if (g_slab.free_spans != NULL) {
+    Slab_Span *span   = g_slab.free_spans;
+    g_slab.free_spans = span->next;
+    return span;
+  }
+  u8 *arena = g_slab.arena.load(std::memory_order_relaxed);
+  if (arena == NULL) {
+    // Address space only, spans are committed one at a time
+    arena = (u8 *)mmap(NULL, SLAB_ARENA_SIZE + SLAB_SPAN_SIZE, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    ASSERT_ALWAYS(arena != MAP_FAILED);
+    arena = (u8 *)(((size_t)arena + SLAB_SPAN_SIZE - 1) & ~(SLAB_SPAN_SIZE - 1));
+    g_slab.arena.store(arena, std::memory_order_release);
+  }
+  ASSERT_ALWAYS(g_slab.arena_cursor + SLAB_SPAN_SIZE <= SLAB_ARENA_SIZE);
+  u8 *span = arena + g_slab.arena_cursor;
+  g_slab.arena_cursor += SLAB_SPAN_SIZE;
+  ASSERT_ALWAYS(mprotect(span, SLAB_SPAN_SIZE, PROT_READ | PROT_WRITE) == 0);
+  return (Slab_Span *)span;
+}
+
+static void slab_release_span(Slab_Heap *heap, Slab_Span *span) {
+  heap->num_spans -= 1;
+  heap->class_spans[span->size_class] -= 1;
+  if (heap->num_cached_spans < SLAB_SPAN_CACHE) {
+    span->next       = heap->span_cache;
+    heap->span_cache = span;
+    heap->num_cached_spans += 1;
+    return;
+  }
+  madvise(span, SLAB_SPAN_SIZE, MADV_DONTNEED);
+  g_slab.enter();
+  span->next        = g_slab.free_spans;
+  g_slab.free_spans = span;
+  g_slab.exit();
+}
+
+static void slab_adopt_span(Slab_Heap *heap, Slab_Span *span) {
+  heap->num_spans += 1;
+  heap->class_spans[span->size_class] += 1;
+  span->owner.store(heap, std::memory_order_relaxed);
+}
+
+static void slab_collect(Slab_Heap *heap, Slab_Span *span) {
+  u32 count = span->collect();
+  heap->live_blocks[span->size_class] -= count;
+  heap->small_live_bytes -= (size_t)count * span->block_size;
+}
+
+// Finds a span with free blocks when the current one has run out
+static Slab_Span *slab_refill(Slab_Heap *heap, u32 size_class) {
+  Slab_Span *span = heap->current[size_class];
+  if (span != NULL) {
+    slab_collect(heap, span);
+    if (span->has_free()) return span;
+    heap->full[size_class].push(span, Slab_Span::FULL);
+    heap->current[size_class] = NULL;
+  }
+  if (heap->remote_pending[size_class].load(std::memory_order_relaxed) != 0) {
+    heap->remote_pending[size_class].store(0, std::memory_order_relaxed);
+    Slab_Span *cur = heap->full[size_class].head;
+    while (cur != NULL) {
+      Slab_Span *next = cur->next;
+      slab_collect(heap, cur);
+      if (cur->has_free()) {
+        heap->full[size_class].remove(cur);
+        heap->partial[size_class].push(cur, Slab_Span::PARTIAL);
+      }
+      cur = next;
+    }
+  }
+  span = heap->partial[size_class].pop();
+  while (span == NULL && g_slab.abandoned[size_class].load(std::memory_order_relaxed) != NULL) {
+    g_slab.enter();
+    span = g_slab.abandoned[size_class].load(std::memory_order_relaxed);
+    if (span != NULL) g_slab.abandoned[size_class].store(span->next, std::memory_order_relaxed);
+    g_slab.exit();
+    if (span == NULL) break;
+    span->next = NULL;
+    span->list = Slab_Span::NONE;
+    slab_adopt_span(heap, span);
+    span->collect();
+    heap->live_blocks[size_class] += span->used;
+    heap->small_live_bytes += (size_t)span->used * span->block_size;
+    if (span->used == 0) {
+      slab_release_span(heap, span);
+      span = NULL;
+    } else if (!span->has_free()) {
+      heap->full[size_class].push(span, Slab_Span::FULL);
+      span = NULL;
+    }
+  }
+  if (span == NULL) {
+    span             = slab_new_span(heap);
+    span->next       = NULL;
+    span->prev       = NULL;
+    span->free_list  = NULL;
+    span->size_class = size_class;
+    span->block_size = slab_class_size(size_class);
+    span->used       = 0;
+    span->bump       = SLAB_HEADER_SIZE;
+    span->list       = Slab_Span::NONE;
+    span->remote_free.store(NULL, std::memory_order_relaxed);
+    slab_adopt_span(heap, span);
+  }
+  heap->current[size_class] = span;
+  return span;
+}
+
+static void *slab_alloc_small(Slab_Heap *heap, size_t size) {
+  u32        size_class = slab_size_class(size);
+  Slab_Span *span       = heap->current[size_class];
+  if (span == NULL || !span->has_free()) span = slab_refill(heap, size_class);
+  void *ptr = NULL;
+  if (span->free_list != NULL) {
+    ptr             = span->free_list;
+    span->free_list = *(void **)ptr;
+  } else {
+    ptr = (u8 *)span + span->bump;
+    span->bump += span->block_size;
+  }
+  span->used += 1;
+  heap->live_blocks[size_class] += 1;
+  heap->total_blocks[size_class] += 1;
+  heap->small_live_bytes += span->block_size;
+  size_t live = heap->small_live_bytes + heap->large_live_bytes.load(std::memory_order_relaxed);
+  if (live > heap->peak_bytes) heap->peak_bytes = live;
+  return ptr;
+}
+
+static void slab_free_small(Slab_Heap *heap, Slab_Span *span, void *ptr) {
+  Slab_Heap *owner = span->owner.load(std::memory_order_relaxed);
+  if (owner != heap || heap == NULL) {
+    void *head = span->remote_free.load(std::memory_order_relaxed);
+    do {
+      *(void **)ptr = head;
+    } while (!span->remote_free.compare_exchange_weak(head, ptr, std::memory_order_release,
+                                                      std::memory_order_relaxed));
+    // Heaps are never unmapped, a stale owner only causes a spurious scan
+    if (owner != NULL)
+      owner->remote_pending[span->size_class].fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  u32 size_class  = span->size_class;
+  *(void **)ptr   = span->free_list;
+  span->free_list = ptr;
+  span->used -= 1;
+  heap->live_blocks[size_class] -= 1;
+  heap->small_live_bytes -= span->block_size;
+  if (span == heap->current[size_class]) return;
+  if (span->used == 0) {
+    if (span->list == Slab_Span::PARTIAL)
+      heap->partial[size_class].remove(span);
+    else
+      heap->full[size_class].remove(span);
+    slab_release_span(heap, span);
+  } else if (span->list == Slab_Span::FULL) {
+    heap->full[size_class].remove(span);
+    heap->partial[size_class].push(span, Slab_Span::PARTIAL);
+  }
+}
+
+static void *slab_alloc_large(Slab_Heap *heap, size_t size) {
+  size_t      map_size = page_align_up(size + SLAB_HEADER_SIZE);
+  Slab_Large *header   = NULL;
+  // Best fit among the cached mappings, wasting at most half of it
+  u32 best = SLAB_LARGE_CACHE;
+  ito(heap->num_cached_large) {
+    size_t cached_size = heap->large_cache[i]->map_size;
+    if (cached_size >= map_size && cached_size / 2 <= map_size &&
+        (best == SLAB_LARGE_CACHE || cached_size < heap->large_cache[best]->map_size))
+      best = i;
+  }
+  if (best != SLAB_LARGE_CACHE) {
+    header                  = heap->large_cache[best];
+    map_size                = header->map_size;
+    heap->large_cache[best] = heap->large_cache[--heap->num_cached_large];
+  } else {
+    void *mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_ALWAYS(mem != MAP_FAILED);
+    header           = (Slab_Large *)mem;
+    header->map_size = map_size;
+  }
+  header->owner = heap;
+  heap->large_live_blocks.fetch_add(1, std::memory_order_relaxed);
+  size_t large = heap->large_live_bytes.fetch_add(map_size, std::memory_order_relaxed) + map_size;
+  if (heap->small_live_bytes + large > heap->peak_bytes)
+    heap->peak_bytes = heap->small_live_bytes + large;
+  return (u8 *)header + SLAB_HEADER_SIZE;
+}
+
+// The mapping goes to the freeing thread's cache, not necessarily the owner's
+static void slab_free_large(Slab_Heap *heap, void *ptr) {
+  Slab_Large *header = (Slab_Large *)((u8 *)ptr - SLAB_HEADER_SIZE);
+  header->owner->large_live_blocks.fetch_sub(1, std::memory_order_relaxed);
+  header->owner->large_live_bytes.fetch_sub(header->map_size, std::memory_order_relaxed);
+  if (heap != NULL && header->map_size <= SLAB_LARGE_CACHE_MAX) {
+    if (heap->num_cached_large == SLAB_LARGE_CACHE) {
+      // Evict the oldest
+      Slab_Large *evicted = heap->large_cache[0];
+      unmap_pages(evicted, evicted->map_size / get_page_size());
+      memmove(heap->large_cache, heap->large_cache + 1,
+              sizeof(Slab_Large *) * (SLAB_LARGE_CACHE - 1));
+      heap->num_cached_large -= 1;
+    }
+    heap->large_cache[heap->num_cached_large++] = header;
+    return;
+  }
+  unmap_pages(header, header->map_size / get_page_size());
+}
+
+static Slab_Heap *slab_acquire_heap() {
+  g_slab.enter();
+  Slab_Heap *heap = g_slab.free_heaps;
+  if (heap != NULL) g_slab.free_heaps = heap->next_free;
+  g_slab.exit();
+  if (heap == NULL) {
+    void *mem = mmap(NULL, page_align_up(sizeof(Slab_Heap)), PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    ASSERT_ALWAYS(mem != MAP_FAILED);
+    heap = new (mem) Slab_Heap();
+  }
+  return heap;
+}
+
+// Called at thread exit: empty spans go back, the rest is left for other heaps to adopt
+static void slab_abandon_heap(Slab_Heap *heap) {
+  ito(SLAB_NUM_CLASSES) {
+    if (heap->current[i] != NULL) heap->full[i].push(heap->current[i], Slab_Span::FULL);
+    heap->current[i] = NULL;
+    Slab_List *lists[] = {&heap->partial[i], &heap->full[i]};
+    for (Slab_List *list : lists) {
+      while (Slab_Span *span = list->pop()) {
+        slab_collect(heap, span);
+        if (span->used == 0) {
+          slab_release_span(heap, span);
+          continue;
+        }
+        span->owner.store(NULL, std::memory_order_relaxed);
+        g_slab.enter();
+        span->next = g_slab.abandoned[i].load(std::memory_order_relaxed);
+        g_slab.abandoned[i].store(span, std::memory_order_relaxed);
+        g_slab.exit();
+      }
+    }
+  }
+  ito(heap->num_cached_large) {
+    unmap_pages(heap->large_cache[i], heap->large_cache[i]->map_size / get_page_size());
+  }
+  g_slab.enter();
+  while (Slab_Span *span = heap->span_cache) {
+    heap->span_cache  = span->next;
+    span->next        = g_slab.free_spans;
+    g_slab.free_spans = span;
+  }
+  // Large blocks still alive keep pointing at the heap and may be freed from other threads at any
+  // time, so large_live_* are left alone and the heap is never unmapped
+  ito(SLAB_NUM_CLASSES) {
+    heap->partial[i].head = NULL;
+    heap->full[i].head    = NULL;
+    heap->remote_pending[i].store(0, std::memory_order_relaxed);
+    heap->live_blocks[i]  = 0;
+    heap->total_blocks[i] = 0;
+    heap->class_spans[i]  = 0;
+  }
+  ito(SLAB_LARGE_CACHE) heap->large_cache[i] = NULL;
+  heap->num_cached_large = 0;
+  heap->num_cached_spans = 0;
+  heap->small_live_bytes = 0;
+  heap->peak_bytes       = 0;
+  heap->num_spans        = 0;
+  heap->next_free   = g_slab.free_heaps;
+  g_slab.free_heaps = heap;
+  g_slab.exit();
+}
+
+static thread_local Slab_Heap *tl_slab_heap;
+
+struct Slab_Heap_Guard {
+  ~Slab_Heap_Guard() {
+    if (tl_slab_heap != NULL) slab_abandon_heap(tl_slab_heap);
+    tl_slab_heap = NULL;
+  }
+};
+
+static Slab_Heap *slab_get_heap() {
+  if (tl_slab_heap == NULL) {
+    tl_slab_heap = slab_acquire_heap();
+    // Allocations made by thread local destructors after this one has run get a heap that is
+    // never given back
+    static thread_local Slab_Heap_Guard guard;
+    (void)guard;
+  }
+  return tl_slab_heap;
+}
+
+void *tl_alloc(size_t size) {
+  Slab_Heap *heap = slab_get_heap();
+  if (size <= SLAB_MAX_SMALL) return slab_alloc_small(heap, size);
+  return slab_alloc_large(heap, size);
+}
+
+void tl_free(void *ptr) {
+  if (ptr == NULL) return;
+  if (Slab_Span *span = slab_span_of(ptr)) {
+    slab_free_small(tl_slab_heap, span, ptr);
+  } else {
+    slab_free_large(tl_slab_heap, ptr);
+  }
+}
+
+void *tl_realloc(void *ptr, size_t oldsize, size_t newsize) {
+  // The block knows its size, `oldsize` is only a hint
+  (void)oldsize;
+  if (ptr == NULL) return newsize == 0 ? NULL : tl_alloc(newsize);
+  if (newsize == 0) {
+    tl_free(ptr);
+    return NULL;
+  }
+  size_t old_capacity = 0;
+  if (Slab_Span *span = slab_span_of(ptr)) {
+    if (newsize <= SLAB_MAX_SMALL && slab_size_class(newsize) == span->size_class) return ptr;
+    old_capacity = span->block_size;
+  } else {
+    Slab_Large *header = (Slab_Large *)((u8 *)ptr - SLAB_HEADER_SIZE);
+    old_capacity       = header->map_size - SLAB_HEADER_SIZE;
+    if (newsize > SLAB_MAX_SMALL) {
+      // Pages are moved, not copied
+      size_t map_size = page_align_up(newsize + SLAB_HEADER_SIZE);
+      if (map_size == header->map_size) return ptr;
+      Slab_Heap *owner    = header->owner;
+      size_t     old_size = header->map_size;
+      header = (Slab_Large *)mremap(header, old_size, map_size, MREMAP_MAYMOVE);
+      ASSERT_ALWAYS(header != MAP_FAILED);
+      header->map_size = map_size;
+      owner->large_live_bytes.fetch_add(map_size - old_size, std::memory_order_relaxed);
+      return (u8 *)header + SLAB_HEADER_SIZE;
+    }
+  }
+  void *new_ptr = tl_alloc(newsize);
+  memcpy(new_ptr, ptr, MIN(old_capacity, newsize));
+  tl_free(ptr);
+  return new_ptr;
+}
+
+// Collects remote frees of every span of the heap
+static void slab_collect_all(Slab_Heap *heap) {
+  ito(SLAB_NUM_CLASSES) {
+    heap->remote_pending[i].store(0, std::memory_order_relaxed);
+    if (heap->current[i] != NULL) slab_collect(heap, heap->current[i]);
+    Slab_List *lists[] = {&heap->partial[i], &heap->full[i]};
+    for (Slab_List *list : lists) {
+      Slab_Span *span = list->head;
+      while (span != NULL) {
+        Slab_Span *next = span->next;
+        slab_collect(heap, span);
+        if (span->used == 0) {
+          list->remove(span);
+          slab_release_span(heap, span);
+        } else if (span->list == Slab_Span::FULL && span->has_free()) {
+          list->remove(span);
+          heap->partial[i].push(span, Slab_Span::PARTIAL);
+        }
+        span = next;
+      }
+    }
+  }
+}
+
+void tl_alloc_get_stats(Alloc_Stats *stats) {
+  Slab_Heap *heap = slab_get_heap();
+  slab_collect_all(heap);
+  memset(stats, 0, sizeof(*stats));
+  stats->large_live_blocks = heap->large_live_blocks.load(std::memory_order_relaxed);
+  stats->large_live_bytes  = heap->large_live_bytes.load(std::memory_order_relaxed);
+  stats->live_bytes        = heap->small_live_bytes + stats->large_live_bytes;
+  stats->peak_bytes        = MAX(heap->peak_bytes, stats->live_bytes);
+  stats->mapped_bytes =
+      (heap->num_spans + heap->num_cached_spans) * SLAB_SPAN_SIZE + stats->large_live_bytes;
+  ito(heap->num_cached_large) { stats->mapped_bytes += heap->large_cache[i]->map_size; }
+  ito(SLAB_NUM_CLASSES) {
+    stats->size_classes[i].block_size   = slab_class_size(i);
+    stats->size_classes[i].live_blocks  = heap->live_blocks[i];
+    stats->size_classes[i].total_blocks = heap->total_blocks[i];
+    stats->size_classes[i].num_spans    = heap->class_spans[i];
+  }
+}
+#else
+void *tl_alloc(size_t size) { return malloc(size); }
+
+void *tl_realloc(void *ptr, size_t oldsize, size_t newsize) {
+  if (oldsize == newsize) return ptr;
+  if (newsize == 0) {
+    if (ptr != NULL) free(ptr);
+    return NULL;
+  }
+  void *new_ptr = realloc(ptr, newsize);
+  NOTNULL(new_ptr);
+  return new_ptr;
+}
+
+void tl_free(void *ptr) { free(ptr); }
+
+void tl_alloc_get_stats(Alloc_Stats *stats) { memset(stats, 0, sizeof(*stats)); }
+#endif
+
+#include <mutex>
+
+struct Atom_Table {
+  static constexpr size_t CHUNK_SIZE   = 1 << 16;
+  static constexpr u32    IDS_PER_PAGE = 1 << 12;
+  static constexpr u32    MAX_PAGES    = 1 << 12;
+  Concurrent_Hash_Table<string_ref, u32> index;
+  // Interned strings by atom id in pages that never move, the first one is the null atom
+  string_ref *     pages[MAX_PAGES];
+  std::atomic<u32> num_atoms;
+  // Taken by intern when the string is new, lookups go through the index without it
+  std::mutex lock;
+  char *     cursor;
+  char *     end;
+
+  void init() {
+    index.init();
+    ito(MAX_PAGES) pages[i] = NULL;
+    cursor = NULL;
+    end    = NULL;
+    push(string_ref{NULL, 0});
+  }
+  // Chunks are never freed so the strings keep their addresses
+  char *put(string_ref str) {
+    size_t size = str.len + 1;
+    char * dst  = NULL;
+    if (size > CHUNK_SIZE / 4) {
+      // Big strings get their own chunk so the current one isn't wasted
+      dst = (char *)tl_alloc(size);
+    } else {
+      if (cursor == NULL || (size_t)(end - cursor) < size) {
+        cursor = (char *)tl_alloc(CHUNK_SIZE);
+        end    = cursor + CHUNK_SIZE;
+      }
+      dst = cursor;
+      cursor += size;
+    }
+    memcpy(dst, str.ptr, str.len);
+    dst[str.len] = '\0';
+    return dst;
+  }
+  u32 push(string_ref str) {
+    u32 id   = num_atoms.load(std::memory_order_relaxed);
+    u32 page = id / IDS_PER_PAGE;
+    ASSERT_ALWAYS(page < MAX_PAGES);
+    if (pages[page] == NULL)
+      pages[page] = (string_ref *)tl_alloc(sizeof(string_ref) * IDS_PER_PAGE);
+    pages[page][id % IDS_PER_PAGE] = str;
+    num_atoms.store(id + 1, std::memory_order_release);
+    return id;
+  }
+  Atom intern(string_ref str) {
+    if (str.ptr == NULL || str.len == 0) return Atom{0};
+    if (u32 *id = index.get_or_null(str)) return Atom{*id};
+    // The page slot is written before the index entry is published, so whoever finds the atom
+    // can read its string
+    std::lock_guard<std::mutex> guard(lock);
+    if (u32 *id = index.get_or_null(str)) return Atom{*id};
+    string_ref key = string_ref{put(str), str.len};
+    u32        id  = push(key);
+    index.insert(key, id);
+    return Atom{id};
+  }
+  Atom find(string_ref str) {
+    if (str.ptr == NULL || str.len == 0) return Atom{0};
+    u32 *id = index.get_or_null(str);
+    return id != NULL ? Atom{*id} : Atom{0};
+  }
+  string_ref get(Atom atom) {
+    ASSERT_DEBUG(atom.id < num_atoms.load(std::memory_order_acquire));
+    return pages[atom.id / IDS_PER_PAGE][atom.id % IDS_PER_PAGE];
+  }
+};
+
+Atom_Table *get_atom_table() {
+  static Atom_Table table;
+  static bool       initialized = [] {
+    table.init();
+    return true;
+  }();
+  (void)initialized;
+  return &table;
+}
+
+Atom intern(string_ref str) { return get_atom_table()->intern(str); }
+
+Atom atom_find(string_ref str) { return get_atom_table()->find(str); }
+
+string_ref atom_str(Atom atom) { return get_atom_table()->get(atom); }
+#if __linux__
+bool Mapped_File::init(char const *path) {
+  memset(this, 0, sizeof(*this));
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return false;
+  }
+  size_t file_size = (size_t)st.st_size;
+  // The file is mapped over an anonymous reservation, the zero tail after it is the terminator
+  // even when the size is a multiple of the page size
+  size_t reserve = page_align_up(file_size + 1);
+  void * mem     = mmap(NULL, reserve, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+  if (file_size != 0) {
+    void *file_mem =
+        mmap(mem, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED | MAP_POPULATE, fd, 0);
+    if (file_mem == MAP_FAILED) {
+      munmap(mem, reserve);
+      close(fd);
+      return false;
+    }
+    madvise(mem, file_size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  ptr      = (char const *)mem;
+  size     = file_size;
+  map_size = reserve;
+  return true;
+}
+#else
+bool Mapped_File::init(char const *path) {
+  memset(this, 0, sizeof(*this));
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) return false;
+  fseek(file, 0, SEEK_END);
+  long fsize = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if (fsize < 0) {
+    fclose(file);
+    return false;
+  }
+  char *data = (char *)tl_alloc((size_t)fsize + 1);
+  size       = fread(data, 1, (size_t)fsize, file);
+  data[size] = '\0';
+  fclose(file);
+  ptr = data;
+  return true;
+}
+#endif
+
+void Mapped_File::release() {
+  if (ptr == NULL) return;
+#if __linux__
+  if (map_size != 0) {
+    munmap((void *)ptr, map_size);
+  } else
+#endif
+    tl_free((void *)ptr);
+  memset(this, 0, sizeof(*this));
+}
+
+// PNG output
+#include <thread>
+#include <zlib.h>
+
+static inline u8 png_paeth(u8 a, u8 b, u8 c) {
+  i32 pa = abs((i32)b - (i32)c);
+  i32 pb = abs((i32)a - (i32)c);
+  i32 pc = abs((i32)a + (i32)b - 2 * (i32)c);
+  if (pa <= pb && pa <= pc) return a;
+  if (pb <= pc) return b;
+  return c;
+}
+
+// Residuals are scored as signed bytes
+static u64 png_score(u8 const *residuals, size_t size) {
+  u64 sum = 0;
+  for (size_t i = 0; i < size; i++) sum += (u64)abs((i32)(i8)residuals[i]);
+  return sum;
+}
+
+#if defined(__SSSE3__)
+// Paeth predictor of 8 bytes widened to 16 bits
+static inline __m128i png_paeth_epi16(__m128i a, __m128i b, __m128i c) {
+  __m128i pa    = _mm_sub_epi16(b, c);
+  __m128i pb    = _mm_sub_epi16(a, c);
+  __m128i pc    = _mm_abs_epi16(_mm_add_epi16(pa, pb));
+  pa            = _mm_abs_epi16(pa);
+  pb            = _mm_abs_epi16(pb);
+  __m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+  __m128i use_c = _mm_cmpgt_epi16(pb, pc);
+  __m128i bc    = _mm_or_si128(_mm_and_si128(use_c, c), _mm_andnot_si128(use_c, b));
+  return _mm_or_si128(_mm_and_si128(not_a, bc), _mm_andnot_si128(not_a, a));
+}
+#endif
+
+/** Filters one row into `dst`, the first byte is the filter type
+  Picks the filter with the smallest sum of absolute residuals, the usual heuristic.
+  `prev` is a row of zeros for the first row. `scratch` holds 4 rows of `size` bytes.
+ */
+static void png_filter_row(u8 *dst, u8 const *cur, u8 const *prev, size_t size, u32 bpp,
+                           u8 *scratch) {
+  u8 *sub   = scratch;
+  u8 *up    = scratch + size;
+  u8 *avg   = scratch + size * 2;
+  u8 *paeth = scratch + size * 3;
+  u64 scores[5] = {};
+  // The first pixel has no left neighbour
+  for (size_t i = 0; i < bpp; i++) {
+    sub[i]   = cur[i];
+    up[i]    = cur[i] - prev[i];
+    avg[i]   = cur[i] - (prev[i] >> 1);
+    paeth[i] = cur[i] - prev[i];
+  }
+  size_t i = bpp;
+#if defined(__SSSE3__)
+  __m128i zero    = _mm_setzero_si128();
+  __m128i one     = _mm_set1_epi8(1);
+  __m128i sums[5] = {zero, zero, zero, zero, zero};
+  for (; i + 16 <= size; i += 16) {
+    __m128i x = _mm_loadu_si128((__m128i const *)(cur + i));
+    __m128i a = _mm_loadu_si128((__m128i const *)(cur + i - bpp));
+    __m128i b = _mm_loadu_si128((__m128i const *)(prev + i));
+    __m128i c = _mm_loadu_si128((__m128i const *)(prev + i - bpp));
+    // avg_epu8 rounds up, the filter rounds down
+    __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    __m128i pred_lo = png_paeth_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                                      _mm_unpacklo_epi8(c, zero));
+    __m128i pred_hi = png_paeth_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                                      _mm_unpackhi_epi8(c, zero));
+    __m128i residuals[] = {x, _mm_sub_epi8(x, a), _mm_sub_epi8(x, b), _mm_sub_epi8(x, average),
+                           _mm_sub_epi8(x, _mm_packus_epi16(pred_lo, pred_hi))};
+    _mm_storeu_si128((__m128i *)(sub + i), residuals[1]);
+    _mm_storeu_si128((__m128i *)(up + i), residuals[2]);
+    _mm_storeu_si128((__m128i *)(avg + i), residuals[3]);
+    _mm_storeu_si128((__m128i *)(paeth + i), residuals[4]);
+    for (u32 f = 0; f < 5; f++)
+      sums[f] = _mm_add_epi64(sums[f], _mm_sad_epu8(_mm_abs_epi8(residuals[f]), zero));
+  }
+  for (u32 f = 0; f < 5; f++)
+    scores[f] = (u64)_mm_cvtsi128_si64(sums[f]) +
+                (u64)_mm_cvtsi128_si64(_mm_unpackhi_epi64(sums[f], sums[f]));
+#endif
+  size_t simd_end = i;
+  for (; i < size; i++) {
+    u8 a     = cur[i - bpp];
+    u8 b     = prev[i];
+    u8 c     = prev[i - bpp];
+    sub[i]   = cur[i] - a;
+    up[i]    = cur[i] - b;
+    avg[i]   = cur[i] - (u8)(((u32)a + (u32)b) >> 1);
+    paeth[i] = cur[i] - png_paeth(a, b, c);
+  }
+  u8 const *candidates[] = {cur, sub, up, avg, paeth};
+  u32       best         = 0;
+  for (u32 f = 0; f < 5; f++) {
+    // Bytes the SIMD loop didn't score
+    scores[f] += png_score(candidates[f], bpp);
+    scores[f] += png_score(candidates[f] + simd_end, size - simd_end);
+    if (scores[f] < scores[best]) best = f;
+  }
+  dst[0] = (u8)best;
+  memcpy(dst + 1, candidates[best], size);
+}
+
+struct Png_Strip {
+  u32    row_begin;
+  u32    row_end;
+  u8 *   out;
+  size_t out_size;
+  uLong  adler;
+  size_t raw_size;
+  bool   ok;
+};
+
+static void png_deflate_strip(Png_Strip *strip, u8 const *data, u32 pitch, size_t row_size,
+                              u32 bpp, int level, bool last) {
+  size_t raw_size = (row_size + 1) * (strip->row_end - strip->row_begin);
+  u8 *   raw      = (u8 *)tl_alloc(raw_size);
+  u8 *   scratch  = (u8 *)tl_alloc(row_size * 5);
+  u8 *   zero_row = scratch + row_size * 4;
+  memset(zero_row, 0, row_size);
+  for (u32 i = strip->row_begin; i < strip->row_end; i++) {
+    u8 const *cur  = data + (size_t)i * pitch;
+    u8 const *prev = i == 0 ? zero_row : cur - pitch;
+    png_filter_row(raw + (row_size + 1) * (i - strip->row_begin), cur, prev, row_size, bpp,
+                   scratch);
+  }
+  tl_free(scratch);
+  strip->raw_size = raw_size;
+  strip->adler    = adler32(adler32(0, NULL, 0), raw, (uInt)raw_size);
+  strip->ok       = false;
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // Raw deflate, the zlib header and the checksum are written once for all strips
+  if (deflateInit2(&stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    tl_free(raw);
+    return;
+  }
+  size_t bound    = deflateBound(&stream, raw_size) + 16;
+  strip->out      = (u8 *)tl_alloc(bound);
+  stream.next_in  = raw;
+  stream.avail_in = (uInt)raw_size;
+  stream.next_out = strip->out;
+  stream.avail_out = (uInt)bound;
+  // A sync flush ends on a byte boundary without the final block bit
+  int ret         = deflate(&stream, last ? Z_FINISH : Z_SYNC_FLUSH);
+  strip->out_size = bound - stream.avail_out;
+  strip->ok       = last ? ret == Z_STREAM_END : ret == Z_OK && stream.avail_in == 0;
+  deflateEnd(&stream);
+  tl_free(raw);
+}
+
+static void png_put_u32_be(u8 *dst, u32 v) {
+  dst[0] = (u8)(v >> 24);
+  dst[1] = (u8)(v >> 16);
+  dst[2] = (u8)(v >> 8);
+  dst[3] = (u8)v;
+}
+
+static void png_write_chunk(Buffered_Writer *writer, char const *type, u8 const *data,
+                            size_t size) {
+  writer->write_u32_be((u32)size);
+  writer->write(type, 4);
+  uLong crc = crc32(crc32(0, NULL, 0), (u8 const *)type, 4);
+  if (size != 0) {
+    writer->write(data, size);
+    crc = crc32(crc, data, (uInt)size);
+  }
+  writer->write_u32_be((u32)crc);
+}
+
+bool write_image_2d_png(const char *file_name, void const *data, uint32_t pitch, uint32_t width,
+                        uint32_t height, uint32_t channels, int level, uint32_t num_threads) {
+  ASSERT_ALWAYS(channels == 1 || channels == 3 || channels == 4);
+  ASSERT_ALWAYS(width != 0 && height != 0);
+  size_t row_size = (size_t)width * channels;
+  // Strips of at least 256 KB of pixels, so small images don't pay for threads
+  size_t min_strip_rows = MAX((size_t)1, ((size_t)1 << 18) / row_size);
+  if (num_threads == 0) num_threads = MAX(1u, std::thread::hardware_concurrency());
+#if __EMSCRIPTEN__
+  num_threads = 1;
+#endif
+  u32 num_strips = (u32)MIN((size_t)num_threads, (height + min_strip_rows - 1) / min_strip_rows);
+  num_strips     = MAX(num_strips, 1u);
+  Png_Strip *strips = (Png_Strip *)tl_alloc(sizeof(Png_Strip) * num_strips);
+  memset(strips, 0, sizeof(Png_Strip) * num_strips);
+  ito(num_strips) {
+    strips[i].row_begin = (u32)((u64)height * i / num_strips);
+    strips[i].row_end   = (u32)((u64)height * (i + 1) / num_strips);
+  }
+  {
+    auto run_strip = [&](u32 i) {
+      png_deflate_strip(&strips[i], (u8 const *)data, pitch, row_size, channels, level,
+                        i == num_strips - 1);
+    };
+    std::thread *threads = (std::thread *)tl_alloc(sizeof(std::thread) * num_strips);
+    for (u32 i = 1; i < num_strips; i++) new (&threads[i]) std::thread(run_strip, i);
+    run_strip(0);
+    for (u32 i = 1; i < num_strips; i++) {
+      threads[i].join();
+      threads[i].~thread();
+    }
+    tl_free(threads);
+  }
+  bool ok = true;
+  ito(num_strips) ok = ok && strips[i].ok;
+  Buffered_Writer writer;
+  if (ok && writer.init(file_name)) {
+    u8 const signature[] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    writer.write(signature, sizeof(signature));
+    // Width, height, bit depth, color type, then default compression, filtering and no
+    // interlacing
+    u8 const color_types[] = {0, 0, 0, 2, 6};
+    u8       ihdr[13]      = {};
+    png_put_u32_be(ihdr, width);
+    png_put_u32_be(ihdr + 4, height);
+    ihdr[8] = 8;
+    ihdr[9] = color_types[channels];
+    png_write_chunk(&writer, "IHDR", ihdr, sizeof(ihdr));
+    // zlib header for a 32 KB window
+    u8 const zlib_header[] = {0x78, 0x9c};
+    png_write_chunk(&writer, "IDAT", zlib_header, sizeof(zlib_header));
+    uLong adler = adler32(0, NULL, 0);
+    ito(num_strips) {
+      png_write_chunk(&writer, "IDAT", strips[i].out, strips[i].out_size);
+      adler = adler32_combine(adler, strips[i].adler, (z_off_t)strips[i].raw_size);
+    }
+    u8 trailer[4];
+    png_put_u32_be(trailer, (u32)adler);
+    png_write_chunk(&writer, "IDAT", trailer, sizeof(trailer));
+    png_write_chunk(&writer, "IEND", NULL, 0);
+    ok = writer.release();
+  } else {
+    ok = false;
+  }
+  ito(num_strips) {
+    if (strips[i].out != NULL) tl_free(strips[i].out);
+  }
+  tl_free(strips);
+  return ok;
+}
+
+// Tracking allocator
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+static constexpr u32 ALLOC_MAX_SITES = 0x100;
+
+struct Tracking_Header {
+  u64 size;
+  // Zero for blocks allocated while tracking was off
+  u64 alloc_ns;
+};
+static_assert(sizeof(Tracking_Header) == 16, "Keeps the blocks 16 byte aligned");
+
+struct Alloc_Tracking {
+  std::atomic<bool> enabled;
+  std::mutex        lock;
+  u32               num_sites;
+  Alloc_Site_Stats *sites[ALLOC_MAX_SITES];
+  ~Alloc_Tracking() { alloc_tracking_report_leaks(stderr); }
+};
+
+static Alloc_Tracking g_alloc_tracking;
+
+static u64 alloc_tracking_get_ns() {
+  return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+u32 alloc_site_register(char const *name) {
+  std::lock_guard<std::mutex> guard(g_alloc_tracking.lock);
+  ito(g_alloc_tracking.num_sites) {
+    if (strcmp(g_alloc_tracking.sites[i]->name, name) == 0) return i;
+  }
+  ASSERT_ALWAYS(g_alloc_tracking.num_sites < ALLOC_MAX_SITES);
+  Alloc_Site_Stats *stats = (Alloc_Site_Stats *)tl_alloc(sizeof(Alloc_Site_Stats));
+  memset(stats, 0, sizeof(Alloc_Site_Stats));
+  stats->name = name;
+  stats->lifetime_ns.reset();
+  g_alloc_tracking.sites[g_alloc_tracking.num_sites] = stats;
+  return g_alloc_tracking.num_sites++;
+}
+
+void *tracking_alloc(u32 site, size_t size) {
+  Tracking_Header *header = (Tracking_Header *)tl_alloc(size + sizeof(Tracking_Header));
+  header->size            = size;
+  header->alloc_ns        = 0;
+  if (g_alloc_tracking.enabled.load(std::memory_order_relaxed)) {
+    header->alloc_ns = MAX(alloc_tracking_get_ns(), 1);
+    std::lock_guard<std::mutex> guard(g_alloc_tracking.lock);
+    Alloc_Site_Stats *          stats = g_alloc_tracking.sites[site];
+    stats->num_allocs++;
+    stats->live_blocks++;
+    stats->live_bytes += size;
+    stats->total_bytes += size;
+    stats->peak_bytes = MAX(stats->peak_bytes, stats->live_bytes);
+  }
+  return header + 1;
+}
+
+void *tracking_realloc(u32 site, void *ptr, size_t old_size, size_t new_size) {
+  if (ptr == NULL) return tracking_alloc(site, new_size);
+  Tracking_Header *header = (Tracking_Header *)ptr - 1;
+  ASSERT_DEBUG(header->size == old_size);
+  header = (Tracking_Header *)tl_realloc(header, old_size + sizeof(Tracking_Header),
+                                         new_size + sizeof(Tracking_Header));
+  header->size = new_size;
+  if (header->alloc_ns != 0) {
+    std::lock_guard<std::mutex> guard(g_alloc_tracking.lock);
+    Alloc_Site_Stats *          stats = g_alloc_tracking.sites[site];
+    stats->num_reallocs++;
+    stats->live_bytes = stats->live_bytes + new_size - old_size;
+    if (new_size > old_size) stats->total_bytes += new_size - old_size;
+    stats->peak_bytes = MAX(stats->peak_bytes, stats->live_bytes);
+  }
+  return header + 1;
+}
+
+void tracking_free(u32 site, void *ptr) {
+  if (ptr == NULL) return;
+  Tracking_Header *header = (Tracking_Header *)ptr - 1;
+  if (header->alloc_ns != 0) {
+    u64                         lifetime = alloc_tracking_get_ns() - header->alloc_ns;
+    std::lock_guard<std::mutex> guard(g_alloc_tracking.lock);
+    Alloc_Site_Stats *          stats = g_alloc_tracking.sites[site];
+    stats->num_frees++;
+    stats->live_blocks--;
+    stats->live_bytes -= header->size;
+    stats->lifetime_ns.record(lifetime);
+  }
+  tl_free(header);
+}
+
+void alloc_tracking_enable(bool enable) { g_alloc_tracking.enabled.store(enable); }
+bool alloc_tracking_is_enabled() { return g_alloc_tracking.enabled.load(); }
+
+u32 alloc_tracking_get_summaries(Alloc_Site_Summary *out, u32 max_sites) {
+  std::lock_guard<std::mutex> guard(g_alloc_tracking.lock);
+  ito(MIN(max_sites, g_alloc_tracking.num_sites)) out[i] = *g_alloc_tracking.sites[i];
+  return g_alloc_tracking.num_sites;
+}
+
+bool alloc_tracking_get_site(u32 index, Alloc_Site_Stats *out) {
+  std::lock_guard<std::mutex> guard(g_alloc_tracking.lock);
+  if (index >= g_alloc_tracking.num_sites) return false;
+  memcpy(out, g_alloc_tracking.sites[index], sizeof(Alloc_Site_Stats));
+  return true;
+}
+
+void alloc_tracking_reset() {
+  std::lock_guard<std::mutex> guard(g_alloc_tracking.lock);
+  ito(g_alloc_tracking.num_sites) {
+    Alloc_Site_Stats *stats = g_alloc_tracking.sites[i];
+    stats->num_allocs       = 0;
+    stats->num_reallocs     = 0;
+    stats->num_frees        = 0;
+    stats->total_bytes      = 0;
+    stats->peak_bytes       = stats->live_bytes;
+    stats->lifetime_ns.reset();
+  }
+}
+
+u64 alloc_tracking_report_leaks(FILE *file) {
+  std::lock_guard<std::mutex> guard(g_alloc_tracking.lock);
+  u64                         leaked = 0;
+  ito(g_alloc_tracking.num_sites) {
+    Alloc_Site_Stats *stats = g_alloc_tracking.sites[i];
+    if (stats->live_blocks == 0) continue;
+    fprintf(file, "[LEAK] %s: %lu blocks, %lu bytes\n", stats->name,
+            (unsigned long)stats->live_blocks, (unsigned long)stats->live_bytes);
+    leaked += stats->live_blocks;
+  }
+  return leaked;
+}
+
+#ifdef PERF_ENABLE
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static constexpr u32 PERF_RING_SIZE      = 1 << 16;
+static constexpr u32 PERF_MAX_DEPTH      = 0x100;
+static constexpr u32 PERF_MAX_THREADS    = 0x40;
+static constexpr u32 PERF_MAX_HISTOGRAMS = 0x40;
+
+static inline u64 perf_get_ns() {
+  return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static inline u64 perf_get_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return perf_get_ns();
+#endif
+}
+
+struct Perf_Event {
+  enum class Event_t : u32 { ENTER = 0, EXIT, HIST };
+  u64         ticks;
+  char const *name;
+  f64         value;
+  Event_t     type;
+};
+
+// Single producer ring, only the owning thread writes. `head` counts all events ever written and
+// is published after the event, readers recheck it to drop slots overwritten during the copy
+struct Perf_Ring {
+  std::atomic<u64> head;
+  u32              thread_id;
+  u32              depth;
+  char const *     stack[PERF_MAX_DEPTH];
+  Perf_Event       events[PERF_RING_SIZE];
+};
+
+struct Perf_Global {
+  std::atomic<u32>        num_rings;
+  std::atomic<Perf_Ring *> rings[PERF_MAX_THREADS];
+  u64                     start_ticks;
+  u64                     start_ns;
+};
+
+// Zero initialized before any dynamic initializer runs, the start time is set right after
+static Perf_Global g_perf;
+static bool        g_perf_started = [] {
+  g_perf.start_ticks = perf_get_ticks();
+  g_perf.start_ns    = perf_get_ns();
+  return true;
+}();
+
+// Rings outlive their threads so the trace keeps their events
+thread_local Perf_Ring *g_perf_ring = NULL;
+
+static Perf_Ring *perf_get_ring() {
+  if (g_perf_ring != NULL) return g_perf_ring;
+  ASSERT_DEBUG(g_perf_started);
+  Perf_Ring *ring = (Perf_Ring *)tl_alloc(sizeof(Perf_Ring));
+  memset((void *)ring, 0, sizeof(Perf_Ring));
+  u32 id = g_perf.num_rings.fetch_add(1);
+  if (id < PERF_MAX_THREADS) {
+    ring->thread_id = id;
+    g_perf.rings[id].store(ring, std::memory_order_release);
+  }
+  g_perf_ring = ring;
+  return ring;
+}
+
+static inline void perf_push(Perf_Ring *ring, Perf_Event::Event_t type, char const *name,
+                             f64 value) {
+  u64         head = ring->head.load(std::memory_order_relaxed);
+  Perf_Event &e    = ring->events[head & (PERF_RING_SIZE - 1)];
+  e.type           = type;
+  e.name           = name;
+  e.value          = value;
+  e.ticks          = perf_get_ticks();
+  ring->head.store(head + 1, std::memory_order_release);
+}
+
+void perf_enter(char const *name) {
+  Perf_Ring *ring = perf_get_ring();
+  ASSERT_DEBUG(ring->depth < PERF_MAX_DEPTH);
+  ring->stack[ring->depth++] = name;
+  perf_push(ring, Perf_Event::Event_t::ENTER, name, 0.0);
+}
+
+void perf_exit(char const *name) {
+  Perf_Ring *ring = perf_get_ring();
+  // Zones must nest
+  ASSERT_DEBUG(ring->depth > 0);
+  char const *top = ring->stack[--ring->depth];
+  ASSERT_DEBUG(top == name || strcmp(top, name) == 0);
+  (void)top;
+  perf_push(ring, Perf_Event::Event_t::EXIT, name, 0.0);
+}
+
+u64 perf_get_time_ns() { return perf_get_ns(); }
+
+// Histograms are shared by all threads, samples are rare enough for a lock
+struct Perf_Histograms {
+  std::mutex     lock;
+  u32            count;
+  char const *   names[PERF_MAX_HISTOGRAMS];
+  Hdr_Histogram *histograms[PERF_MAX_HISTOGRAMS];
+
+  Hdr_Histogram *find(char const *name) {
+    ito(count) {
+      if (names[i] == name || strcmp(names[i], name) == 0) return histograms[i];
+    }
+    return NULL;
+  }
+};
+
+static Perf_Histograms g_perf_histograms;
+
+void perf_hist_add(char const *name, f64 val) {
+  perf_push(perf_get_ring(), Perf_Event::Event_t::HIST, name, val);
+  std::lock_guard<std::mutex> guard(g_perf_histograms.lock);
+  Hdr_Histogram *             hist = g_perf_histograms.find(name);
+  if (hist == NULL) {
+    if (g_perf_histograms.count == PERF_MAX_HISTOGRAMS) return;
+    hist = (Hdr_Histogram *)tl_alloc(sizeof(Hdr_Histogram));
+    hist->reset();
+    g_perf_histograms.names[g_perf_histograms.count]      = name;
+    g_perf_histograms.histograms[g_perf_histograms.count] = hist;
+    g_perf_histograms.count++;
+  }
+  hist->record(val > 0.0 ? (u64)val : 0);
+}
+
+u32 perf_get_histogram_names(char const **names, u32 max_names) {
+  std::lock_guard<std::mutex> guard(g_perf_histograms.lock);
+  u32                         count = MIN(max_names, g_perf_histograms.count);
+  ito(count) names[i] = g_perf_histograms.names[i];
+  return count;
+}
+
+bool perf_get_histogram(char const *name, Hdr_Histogram *out) {
+  std::lock_guard<std::mutex> guard(g_perf_histograms.lock);
+  Hdr_Histogram *             hist = g_perf_histograms.find(name);
+  if (hist == NULL) return false;
+  memcpy(out, hist, sizeof(Hdr_Histogram));
+  return true;
+}
+
+void perf_reset_histograms() {
+  std::lock_guard<std::mutex> guard(g_perf_histograms.lock);
+  ito(g_perf_histograms.count) g_perf_histograms.histograms[i]->reset();
+}
+
+static void perf_write_name(FILE *file, char const *name) {
+  fputc('"', file);
+  for (char const *c = name; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') fputc('\\', file);
+    if ((u8)*c >= 0x20) fputc(*c, file);
+  }
+  fputc('"', file);
+}
+
+bool perf_write_chrome_trace(char const *path) {
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) return false;
+  TMP_STORAGE_SCOPE;
+  Perf_Event *events      = (Perf_Event *)tl_alloc_tmp(sizeof(Perf_Event) * PERF_RING_SIZE);
+  u64         ticks       = perf_get_ticks() - g_perf.start_ticks;
+  u64         ns          = perf_get_ns() - g_perf.start_ns;
+  f64         us_per_tick = ticks == 0 ? 0.0 : (f64)ns / (f64)ticks * 1.0e-3;
+  bool        first       = true;
+  fprintf(file, "{\"traceEvents\":[\n");
+  u32 num_rings = MIN(g_perf.num_rings.load(std::memory_order_acquire), PERF_MAX_THREADS);
+  ito(num_rings) {
+    Perf_Ring *ring = g_perf.rings[i].load(std::memory_order_acquire);
+    if (ring == NULL) continue;
+    u64 head     = ring->head.load(std::memory_order_acquire);
+    u64 first_id = head > PERF_RING_SIZE ? head - PERF_RING_SIZE : 0;
+    for (u64 j = first_id; j < head; j++) {
+      events[j - first_id] = ring->events[j & (PERF_RING_SIZE - 1)];
+    }
+    // Drop the slots the owner overwrote during the copy, the one at new_head may be mid-write
+    u64 new_head = ring->head.load(std::memory_order_acquire);
+    u64 begin    = first_id;
+    if (new_head + 1 > first_id + PERF_RING_SIZE) begin = MIN(head, new_head + 1 - PERF_RING_SIZE);
+    u32 depth = 0;
+    for (u64 j = begin; j < head; j++) {
+      Perf_Event &e  = events[j - first_id];
+      f64         ts = (f64)(e.ticks - g_perf.start_ticks) * us_per_tick;
+      char const *ph = NULL;
+      if (e.type == Perf_Event::Event_t::ENTER) {
+        depth++;
+        ph = "B";
+      } else if (e.type == Perf_Event::Event_t::EXIT) {
+        // The matching enter has been overwritten
+        if (depth == 0) continue;
+        depth--;
+        ph = "E";
+      } else {
+        ph = "C";
+      }
+      fprintf(file, first ? " {" : ",{");
+      first = false;
+      fprintf(file, "\"name\":");
+      perf_write_name(file, e.name);
+      fprintf(file, ",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":0,\"tid\":%u", ph, ts, ring->thread_id);
+      if (e.type == Perf_Event::Event_t::HIST) fprintf(file, ",\"args\":{\"value\":%g}", e.value);
+      fprintf(file, "}\n");
+    }
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+  return true;
+}
+#else
+bool perf_write_chrome_trace(char const *path) {
+  (void)path;
+  return false;
+}
+u32 perf_get_histogram_names(char const **names, u32 max_names) {
+  (void)names;
+  (void)max_names;
+  return 0;
+}
+bool perf_get_histogram(char const *name, Hdr_Histogram *out) {
+  (void)name;
+  (void)out;
+  return false;
+}
+void perf_reset_histograms() {}
+#endif
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+static constexpr u32 JOB_DEQUE_SIZE   = 1 << 10;
+static constexpr u32 JOBS_MAX_WORKERS = 0x40;
+// Pauses, then yields before an idle worker goes to sleep
+static constexpr u32 JOBS_SPIN_COUNT  = 1 << 10;
+static constexpr u32 JOBS_YIELD_COUNT = 0x10;
+
+static inline void jobs_pause() {
+#if defined(__SSE2__)
+  _mm_pause();
+#endif
+}
+
+struct Job {
+  Job_Fn     fn;
+  void *     data;
+  Job_Group *group;
+  u32        begin;
+  u32        end;
+  u32        grain;
+};
+
+// Thieves may read a slot the owner is overwriting, the CAS on top discards those reads
+struct Job_Slot {
+  std::atomic<Job_Fn>      fn;
+  std::atomic<void *>      data;
+  std::atomic<Job_Group *> group;
+  std::atomic<u64>         range;
+  std::atomic<u32>         grain;
+
+  void store(Job const &job) {
+    fn.store(job.fn, std::memory_order_relaxed);
+    data.store(job.data, std::memory_order_relaxed);
+    group.store(job.group, std::memory_order_relaxed);
+    range.store((u64)job.begin | ((u64)job.end << 32), std::memory_order_relaxed);
+    grain.store(job.grain, std::memory_order_relaxed);
+  }
+  void load(Job *job) {
+    job->fn    = fn.load(std::memory_order_relaxed);
+    job->data  = data.load(std::memory_order_relaxed);
+    job->group = group.load(std::memory_order_relaxed);
+    u64 r      = range.load(std::memory_order_relaxed);
+    job->begin = (u32)r;
+    job->end   = (u32)(r >> 32);
+    job->grain = grain.load(std::memory_order_relaxed);
+  }
+};
+
+// Chase-Lev deque with a fixed ring, see "Correct and Efficient Work-Stealing for Weak Memory
+// Models" by Le et al.
+struct Job_Deque {
+  alignas(64) std::atomic<i64> top;
+  alignas(64) std::atomic<i64> bottom;
+  Job_Slot slots[JOB_DEQUE_SIZE];
+
+  // Owner only, fails when the ring is full
+  bool push(Job const &job) {
+    i64 b = bottom.load(std::memory_order_relaxed);
+    i64 t = top.load(std::memory_order_acquire);
+    if (b - t >= (i64)JOB_DEQUE_SIZE) return false;
+    slots[b & (JOB_DEQUE_SIZE - 1)].store(job);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
+  }
+  // Owner only, takes the most recently pushed job
+  bool pop(Job *job) {
+    i64 b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+    }
+    slots[b & (JOB_DEQUE_SIZE - 1)].load(job);
+    if (t != b) return true;
+    // Last job, race the thieves for it
+    bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                           std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_relaxed);
+    return won;
+  }
+  // Any thread, takes the oldest job
+  bool steal(Job *job) {
+    i64 t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return false;
+    slots[t & (JOB_DEQUE_SIZE - 1)].load(job);
+    return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed);
+  }
+  bool is_empty() {
+    return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+  }
+};
+
+static struct Job_System {
+  u32               num_workers;
+  Job_Deque         deques[JOBS_MAX_WORKERS];
+  std::thread       threads[JOBS_MAX_WORKERS];
+  std::atomic<bool> quit;
+  // Sleepers wait for the epoch to change, it's bumped under the lock
+  std::mutex              lock;
+  std::condition_variable wake;
+  u64                     epoch;
+  std::atomic<u32>        num_sleeping;
+} g_jobs;
+
+static bool jobs_any_queued() {
+  ito(g_jobs.num_workers) if (!g_jobs.deques[i].is_empty()) return true;
+  return false;
+}
+
+static bool jobs_try_get(u32 self, Job *job) {
+  if (g_jobs.deques[self].pop(job)) return true;
+  // Start from a different victim every time so thieves don't pile onto one deque
+  static thread_local u32 seed = 0x9e3779b9u * (self + 1);
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  u32 n = g_jobs.num_workers;
+  ito(n) {
+    u32 victim = (seed + i) % n;
+    if (victim != self && g_jobs.deques[victim].steal(job)) return true;
+  }
+  return false;
+}
+
+static void jobs_execute(u32 self, Job job);
+
+static void jobs_push(u32 self, Job const &job) {
+  if (!g_jobs.deques[self].push(job)) {
+    jobs_execute(self, job);
+    return;
+  }
+  // Pairs with the fence between a sleeper's num_sleeping increment and its queue check
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (g_jobs.num_sleeping.load(std::memory_order_relaxed) != 0) {
+    std::lock_guard<std::mutex> guard(g_jobs.lock);
+    g_jobs.epoch++;
+    g_jobs.wake.notify_one();
+  }
+}
+
+static void jobs_execute(u32 self, Job job) {
+  // Lazy binary splitting, the upper halves are left for thieves
+  while (job.end - job.begin > job.grain) {
+    Job upper   = job;
+    upper.begin = job.begin + (job.end - job.begin) / 2;
+    job.end     = upper.begin;
+    job.group->pending.fetch_add(1, std::memory_order_relaxed);
+    jobs_push(self, upper);
+  }
+  tl_alloc_tmp_enter();
+  job.fn(job.data, job.begin, job.end);
+  tl_alloc_tmp_exit();
+  job.group->pending.fetch_sub(1, std::memory_order_release);
+}
+
+static void jobs_worker_main(u32 self) {
+  g_tl.job_worker_index = (i32)self;
+  u32 spins             = 0;
+  while (!g_jobs.quit.load(std::memory_order_relaxed)) {
+    Job job;
+    if (jobs_try_get(self, &job)) {
+      jobs_execute(self, job);
+      spins = 0;
+      continue;
+    }
+    if (++spins < JOBS_SPIN_COUNT) {
+      jobs_pause();
+      continue;
+    }
+    if (spins < JOBS_SPIN_COUNT + JOBS_YIELD_COUNT) {
+      std::this_thread::yield();
+      continue;
+    }
+    spins = 0;
+    std::unique_lock<std::mutex> guard(g_jobs.lock);
+    u64                          epoch = g_jobs.epoch;
+    g_jobs.num_sleeping.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!jobs_any_queued()) {
+      g_jobs.wake.wait(guard, [&] {
+        return g_jobs.epoch != epoch || g_jobs.quit.load(std::memory_order_relaxed);
+      });
+    }
+    g_jobs.num_sleeping.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+void jobs_init(u32 num_workers) {
+  ASSERT_ALWAYS(g_jobs.num_workers == 0);
+  if (num_workers == 0) num_workers = std::thread::hardware_concurrency();
+#if __EMSCRIPTEN__
+  num_workers = 1;
+#endif
+  num_workers        = CLAMP(num_workers, 1u, JOBS_MAX_WORKERS);
+  g_jobs.num_workers = num_workers;
+  g_jobs.quit        = false;
+  g_jobs.epoch       = 0;
+  ito(num_workers) {
+    g_jobs.deques[i].top    = 0;
+    g_jobs.deques[i].bottom = 0;
+  }
+  g_tl.job_worker_index = 0;
+  for (u32 i = 1; i < num_workers; i++) g_jobs.threads[i] = std::thread(jobs_worker_main, i);
+}
+
+void jobs_release() {
+  if (g_jobs.num_workers == 0) return;
+  ASSERT_ALWAYS(g_tl.job_worker_index == 0);
+  {
+    std::lock_guard<std::mutex> guard(g_jobs.lock);
+    g_jobs.quit = true;
+    g_jobs.wake.notify_all();
+  }
+  for (u32 i = 1; i < g_jobs.num_workers; i++) g_jobs.threads[i].join();
+  g_jobs.num_workers    = 0;
+  g_tl.job_worker_index = -1;
+}
+
+u32 jobs_num_workers() { return MAX(g_jobs.num_workers, 1u); }
+
+i32 jobs_worker_index() { return g_tl.job_worker_index; }
+
+void jobs_run(Job_Group *group, Job_Fn fn, void *data, u32 begin, u32 end, u32 grain) {
+  if (begin >= end) return;
+  i32 self = g_tl.job_worker_index;
+  if (self < 0) {
+    fn(data, begin, end);
+    return;
+  }
+  group->pending.fetch_add(1, std::memory_order_relaxed);
+  jobs_push((u32)self, Job{fn, data, group, begin, end, MAX(grain, 1u)});
+}
+
+void jobs_wait(Job_Group *group) {
+  i32 self  = g_tl.job_worker_index;
+  u32 spins = 0;
+  while (group->pending.load(std::memory_order_acquire) != 0) {
+    ASSERT_ALWAYS(self >= 0);
+    Job job;
+    if (jobs_try_get((u32)self, &job)) {
+      jobs_execute((u32)self, job);
+      spins = 0;
+    } else if (++spins < JOBS_SPIN_COUNT) {
+      jobs_pause();
+    } else {
+      // The remaining jobs run on other workers, let them have the core if it's shared
+      std::this_thread::yield();
+    }
+  }
+}
+
+// Pending messages, a power of two
+static constexpr u32 LOG_RING_SIZE = 1 << 12;
+// Lines kept after draining, a power of two
+static constexpr u32 LOG_HISTORY_SIZE = 1 << 13;
+
+// Bounded MPSC queue of Vyukov: a cell is free for ticket t when its sequence is t, holds the
+// message of ticket t when it's t + 1
+struct Log_Cell {
+  std::atomic<u64> sequence;
+  Log_Record       record;
+};
+
+// Absolute line numbers of the lines of one view, oldest first
+struct Log_Index {
+  u64 *lines;
+  u64  begin;
+  u64  end;
+};
+
+static struct Log_State {
+  Log_Cell *                   cells;
+  alignas(64) std::atomic<u64> tail;
+  alignas(64) u64              head;
+  std::atomic<u64>             dropped;
+  u64                          start_ns;
+  Log_Record *                 history;
+  // Absolute numbers of the first and one past the last line in `history`
+  u64       history_begin;
+  u64       history_end;
+  Log_Index views[LOG_ALL_SEVERITIES + 1];
+} g_log;
+
+static thread_local bool tl_log_drainer;
+
+static u64 log_now_ns() {
+  return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static Log_State *log_get() {
+  static bool initialized = [] {
+    g_log.cells = (Log_Cell *)tl_alloc(sizeof(Log_Cell) * LOG_RING_SIZE);
+    ito(LOG_RING_SIZE) g_log.cells[i].sequence.store(i, std::memory_order_relaxed);
+    g_log.tail.store(0, std::memory_order_relaxed);
+    g_log.head     = 0;
+    g_log.start_ns = log_now_ns();
+    g_log.history  = (Log_Record *)tl_alloc(sizeof(Log_Record) * LOG_HISTORY_SIZE);
+    ito(LOG_ALL_SEVERITIES + 1) {
+      g_log.views[i].lines = (u64 *)tl_alloc(sizeof(u64) * LOG_HISTORY_SIZE);
+      g_log.views[i].begin = 0;
+      g_log.views[i].end   = 0;
+    }
+    return true;
+  }();
+  (void)initialized;
+  return &g_log;
+}
+
+static void log_append(Log_Record const &record) {
+  Log_State *log  = &g_log;
+  u64        line = log->history_end++;
+  if (log->history_end - log->history_begin > LOG_HISTORY_SIZE) log->history_begin++;
+  log->history[line & (LOG_HISTORY_SIZE - 1)] = record;
+  u32 severity_bit                            = 1u << (u32)record.severity;
+  for (u32 mask = 1; mask <= LOG_ALL_SEVERITIES; mask++) {
+    Log_Index *view = &log->views[mask];
+    // Evicted lines are always at the front
+    while (view->begin != view->end &&
+           view->lines[view->begin & (LOG_HISTORY_SIZE - 1)] < log->history_begin)
+      view->begin++;
+    if ((mask & severity_bit) != 0) view->lines[view->end++ & (LOG_HISTORY_SIZE - 1)] = line;
+  }
+}
+
+void log_drain() {
+  Log_State *log = log_get();
+  tl_log_drainer = true;
+  while (true) {
+    Log_Cell *cell = &log->cells[log->head & (LOG_RING_SIZE - 1)];
+    if (cell->sequence.load(std::memory_order_acquire) != log->head + 1) break;
+    log_append(cell->record);
+    cell->sequence.store(log->head + LOG_RING_SIZE, std::memory_order_release);
+    log->head++;
+  }
+}
+
+static void log_push_line(Log_Severity severity, u64 time_ns, char const *text, size_t len) {
+  Log_State *log = log_get();
+  u64        pos = log->tail.load(std::memory_order_relaxed);
+  Log_Cell * cell;
+  while (true) {
+    cell    = &log->cells[pos & (LOG_RING_SIZE - 1)];
+    i64 dif = (i64)(cell->sequence.load(std::memory_order_acquire) - pos);
+    if (dif == 0) {
+      if (log->tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+    } else if (dif < 0) {
+      // Full
+      if (!tl_log_drainer) {
+        log->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      log_drain();
+      pos = log->tail.load(std::memory_order_relaxed);
+    } else {
+      pos = log->tail.load(std::memory_order_relaxed);
+    }
+  }
+  len                   = MIN(len, (size_t)LOG_LINE_MAX);
+  cell->record.time_ns  = time_ns;
+  cell->record.severity = severity;
+  cell->record.len      = (u16)len;
+  memcpy(cell->record.text, text, len);
+  cell->sequence.store(pos + 1, std::memory_order_release);
+}
+
+void log_pushv(Log_Severity severity, char const *fmt, va_list args) {
+  Log_State *log     = log_get();
+  u64        time_ns = log_now_ns() - log->start_ns;
+  char       buf[0x1000];
+  i32        len = vsnprintf(buf, sizeof(buf), fmt, args);
+  if (len < 0) return;
+  len             = MIN(len, (i32)sizeof(buf) - 1);
+  char const *cur = buf;
+  char const *end = buf + len;
+  while (true) {
+    char const *eol = (char const *)memchr(cur, '\n', (size_t)(end - cur));
+    if (eol == NULL) eol = end;
+    log_push_line(severity, time_ns, cur, (size_t)(eol - cur));
+    if (eol == end || eol + 1 == end) break;
+    cur = eol + 1;
+  }
+}
+
+void log_push(Log_Severity severity, char const *fmt, ...) {
+  va_list args;
+  va_start(args, fmt);
+  log_pushv(severity, fmt, args);
+  va_end(args);
+}
+
+void log_clear() {
+  Log_State *log     = log_get();
+  log->history_begin = log->history_end;
+  ito(LOG_ALL_SEVERITIES + 1) log->views[i].begin = log->views[i].end;
+}
+
+u32 log_view_size(u32 mask) {
+  Log_State *log = log_get();
+  mask &= LOG_ALL_SEVERITIES;
+  if (mask == LOG_ALL_SEVERITIES) return (u32)(log->history_end - log->history_begin);
+  Log_Index *view = &log->views[mask];
+  return (u32)(view->end - view->begin);
+}
+
+Log_Record const *log_view_get(u32 mask, u32 i) {
+  Log_State *log = log_get();
+  mask &= LOG_ALL_SEVERITIES;
+  ASSERT_DEBUG(i < log_view_size(mask));
+  u64 line = mask == LOG_ALL_SEVERITIES
+                 ? log->history_begin + i
+                 : log->views[mask].lines[(log->views[mask].begin + i) & (LOG_HISTORY_SIZE - 1)];
+  return &log->history[line & (LOG_HISTORY_SIZE - 1)];
+}
+
+u64 log_get_dropped() { return log_get()->dropped.load(std::memory_order_relaxed); }
 #endif
 #endif